@@ -0,0 +1,57 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#pragma once
+
+#include <string>
+#include <sys/types.h>
+
+namespace RV4L2
+{
+
+/*
+	CaptureBackend
+
+	What a Device talks to in order to capture images. The default backend is a V4L2 device 
+	node (V4L2CaptureBackend); other backends emulate the V4L2 streaming I/O so that the 
+	whole capture path can run without hardware (see SyntheticCaptureBackend).
+
+	The calls follow the system ones: ioctl() takes the V4L2 requests and structures, and 
+	like munmap(), it returns -1 and sets errno on failure. mmap() returns MAP_FAILED on 
+	failure. The handle is what the Device polls: it must become readable when a buffer can 
+	be dequeued.
+*/
+class CaptureBackend
+{
+public:
+	virtual ~CaptureBackend() {}
+
+	virtual bool				open( const std::string& deviceName ) = 0;
+	virtual void				close() = 0;
+	virtual int					getHandle() const = 0;
+	virtual int					ioctl( unsigned long request, void* arg ) = 0;
+	virtual void*				mmap( std::size_t length, off_t offset ) = 0;
+	virtual int					munmap( void* start, std::size_t length ) = 0;
+};
+
+}
@@ -0,0 +1,120 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include "RV4L2Device.h"
+#include "RV4L2DeviceMonitor.h"
+
+namespace RV4L2
+{
+
+/*
+	CaptureManager
+
+	Delivers the images of many devices from a single epoll set, watched by one or a few 
+	threads, rather than having each device polled or running its own capture thread. 
+	
+	The devices must use the Device::ManualUpdate mode. They are watched while they are 
+	capturing: starting or stopping the capture of a registered device is taken into 
+	account automatically. The listeners of a device are called from the manager threads, 
+	a given device never being updated by two threads at once.
+
+	DeviceMonitors can be watched in the same epoll set: their listeners are then called 
+	from the manager threads as soon as a device node appears or disappears. A device that 
+	gets disconnected while capturing is no longer watched.
+*/
+class CaptureManager : public Device::Listener
+{
+public:
+	CaptureManager();
+	virtual ~CaptureManager();
+
+	bool				addDevice( Device* device );
+	bool				removeDevice( Device* device );
+	std::size_t			getNumDevices() const;
+
+	bool				addDeviceMonitor( DeviceMonitor* deviceMonitor );
+	bool				removeDeviceMonitor( DeviceMonitor* deviceMonitor );
+
+	bool				start( unsigned int numThreads=1 );
+	bool				isRunning() const					{ return !mThreads.empty(); }
+	void				stop();
+
+	struct DeviceStatistics
+	{
+		DeviceStatistics();
+		uint64_t		numWakeUps;				// Times the device was found ready
+		uint64_t		numEmptyWakeUps;		// Wake-ups that didn't deliver any image
+		uint64_t		numDeliveredImages;
+	};
+	bool				getDeviceStatistics( const Device* device, DeviceStatistics& statistics ) const;
+
+protected:
+	virtual void		onDeviceStarted( Device* device );
+	virtual void		onDeviceStopped( Device* device );
+	virtual bool		consumesImages() const			{ return false; }
+
+private:
+	CaptureManager( const CaptureManager& other );				// Not implemented on purpose
+	CaptureManager& operator=( const CaptureManager& other );	// Not implemented on purpose
+
+	// Entry of the epoll set: either a device or a device monitor
+	struct DeviceEntry
+	{
+		DeviceEntry( Device* device );
+		DeviceEntry( DeviceMonitor* deviceMonitor );
+		int						getHandle() const;
+		Device*					device;
+		DeviceMonitor*			deviceMonitor;
+		std::atomic<bool>		isWatched;
+		std::atomic<bool>		isBusy;				// Being updated by a manager thread
+		std::atomic<bool>		isRemoved;
+		std::atomic<uint64_t>	numWakeUps;
+		std::atomic<uint64_t>	numEmptyWakeUps;
+		std::atomic<uint64_t>	numDeliveredImages;
+	};
+
+	DeviceEntry*		findDeviceEntry( const Device* device ) const;
+	void				removeDeviceEntry( DeviceEntry* deviceEntry );
+	bool				watchDevice( DeviceEntry* deviceEntry );
+	void				unwatchDevice( DeviceEntry* deviceEntry );
+	void				threadMain();
+
+	int									mEpollHandle;
+	int									mWakeUpHandle;		// eventfd used to stop the threads
+	typedef std::vector<DeviceEntry*> DeviceEntries;
+	DeviceEntries						mDeviceEntries;
+	DeviceEntries						mDeviceMonitorEntries;
+	DeviceEntries						mRemovedDeviceEntries;	// Kept until destruction as threads may still refer to them
+	mutable std::mutex					mDeviceEntriesMutex;
+	std::vector<std::thread>			mThreads;
+	static const int					mMaxEventsPerWait = 16;
+};
+
+}
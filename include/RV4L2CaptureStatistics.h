@@ -0,0 +1,92 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include "RV4L2Histogram.h"
+
+namespace RV4L2
+{
+
+/*
+	CaptureStatistics
+
+	Counters and timing histograms maintained by a Device while it captures. Everything is 
+	updated with atomic operations so that a monitoring thread can poll them at any time
+	without disturbing the capture. Durations are in nanoseconds.
+
+	- the buffer hold time goes from the dequeuing of a buffer to its re-queuing, it includes
+	  the listener callbacks and the time leases are kept by the application
+	- the listener time is the time taken by the capture notification of all the listeners
+	- the delivery latency goes from the driver timestamp to the notification. It is only 
+	  recorded for devices that timestamp their buffers with the monotonic clock
+	- the frame interval goes from one dequeued image to the next. Its spread around the 
+	  capture period is the scheduling jitter of the capture path
+*/
+class CaptureStatistics
+{
+public:
+	CaptureStatistics();
+
+	uint64_t			getNumDeliveredFrames() const			{ return mNumDeliveredFrames; }
+	uint64_t			getNumDroppedFrames() const				{ return mNumDroppedFrames; }
+	uint64_t			getNumDecimatedFrames() const			{ return mNumDecimatedFrames; }		// Given back to the driver without being delivered (see Device::setDeliveryDecimation())
+	uint64_t			getNumDequeueRetries() const			{ return mNumDequeueRetries; }		// DQBUF calls that found no image ready (EAGAIN)
+	uint64_t			getNumQueueUnderruns() const			{ return mNumQueueUnderruns; }		// Times the driver was left without any queued buffer
+
+	const Histogram&	getBufferHoldTimeHistogram() const		{ return mBufferHoldTimeHistogram; }
+	const Histogram&	getListenerTimeHistogram() const		{ return mListenerTimeHistogram; }
+	const Histogram&	getDeliveryLatencyHistogram() const		{ return mDeliveryLatencyHistogram; }
+	const Histogram&	getFrameIntervalHistogram() const		{ return mFrameIntervalHistogram; }
+
+	void				reset();
+
+	// Used by the Device
+	void				addDeliveredFrame()						{ mNumDeliveredFrames.fetch_add( 1, std::memory_order_relaxed ); }
+	void				addDroppedFrames( unsigned int count )	{ mNumDroppedFrames.fetch_add( count, std::memory_order_relaxed ); }
+	void				addDecimatedFrame()						{ mNumDecimatedFrames.fetch_add( 1, std::memory_order_relaxed ); }
+	void				addDequeueRetry()						{ mNumDequeueRetries.fetch_add( 1, std::memory_order_relaxed ); }
+	void				addQueueUnderrun()						{ mNumQueueUnderruns.fetch_add( 1, std::memory_order_relaxed ); }
+	Histogram&			getBufferHoldTimeHistogram()			{ return mBufferHoldTimeHistogram; }
+	Histogram&			getListenerTimeHistogram()				{ return mListenerTimeHistogram; }
+	Histogram&			getDeliveryLatencyHistogram()			{ return mDeliveryLatencyHistogram; }
+	Histogram&			getFrameIntervalHistogram()				{ return mFrameIntervalHistogram; }
+
+private:
+	CaptureStatistics( const CaptureStatistics& other );				// Not implemented on purpose
+	CaptureStatistics& operator=( const CaptureStatistics& other );		// Not implemented on purpose
+
+	std::atomic<uint64_t>	mNumDeliveredFrames;
+	std::atomic<uint64_t>	mNumDroppedFrames;
+	std::atomic<uint64_t>	mNumDecimatedFrames;
+	std::atomic<uint64_t>	mNumDequeueRetries;
+	std::atomic<uint64_t>	mNumQueueUnderruns;
+	Histogram				mBufferHoldTimeHistogram;
+	Histogram				mListenerTimeHistogram;
+	Histogram				mDeliveryLatencyHistogram;
+	Histogram				mFrameIntervalHistogram;
+};
+
+}
@@ -25,26 +25,71 @@
 
 #include "RV4L2Image.h"
 
+#include <stdint.h>
+
 namespace RV4L2
 {
 
+/*
+	CapturedImage
+
+	The sequence number is the one of the driver: it counts the frames the hardware 
+	captured, so a gap between two consecutive images means frames were dropped (usually
+	because no buffer was queued at the time). The timestamp is in nanoseconds, taken from 
+	the clock indicated by getTimestampClock() (normally CLOCK_MONOTONIC)
+*/
 class CapturedImage
 {
 public:
+	enum TimestampClock
+	{
+		UnknownTimestampClock,
+		MonotonicTimestampClock,
+		CopyTimestampClock				// Copied from an output buffer (memory-to-memory devices)
+	};
+
+	enum TimestampSource
+	{
+		EndOfFrameTimestamp,
+		StartOfExposureTimestamp
+	};
+
 	CapturedImage( ImageFormat imageFormat );
+	CapturedImage( ImageFormat imageFormat, unsigned char* externalBytes );
+	CapturedImage( ImageFormat imageFormat, unsigned char* const* externalPlaneBytes, const unsigned int* planeSizesInBytes, unsigned int numPlanes );
+	CapturedImage( const CapturedImage& other );
+	CapturedImage( CapturedImage&& other );
+
+	CapturedImage&	operator=( const CapturedImage& other );
+	CapturedImage&	operator=( CapturedImage&& other );
+	void			swap( CapturedImage& other );
 
 	const Image&	getImage() const									{ return mImage; }
 	unsigned int	getSequenceNumber() const							{ return mSequenceNumber; }
-	float			getTimestampInSec()	const							{ return mTimestampInSec; }
+	unsigned int	getNumDroppedFrames() const							{ return mNumDroppedFrames; }
+	int64_t			getTimestampInNs() const							{ return mTimestampInNs; }
+	double			getTimestampInSec()	const							{ return static_cast<double>(mTimestampInNs) / 1000000000.0; }
+	TimestampClock	getTimestampClock() const							{ return mTimestampClock; }
+	TimestampSource	getTimestampSource() const							{ return mTimestampSource; }
 
 	Image&			getImage()											{ return mImage; }
 	void			setSequenceNumber( unsigned int	sequenceNumber )	{ mSequenceNumber = sequenceNumber; }
-	void			setTimestampInSec( float timestamp )				{ mTimestampInSec = timestamp; }
+	void			setNumDroppedFrames( unsigned int numDroppedFrames ){ mNumDroppedFrames = numDroppedFrames; }
+	void			setTimestampInNs( int64_t timestamp )				{ mTimestampInNs = timestamp; }
+	void			setTimestampClock( TimestampClock clock )			{ mTimestampClock = clock; }
+	void			setTimestampSource( TimestampSource source )		{ mTimestampSource = source; }
+	void			copyCaptureInfo( const CapturedImage& other );
+	void			resetCaptureInfo();
 
 private:
 	Image			mImage;
 	unsigned int	mSequenceNumber;
-	float			mTimestampInSec;
+	unsigned int	mNumDroppedFrames;		// Frames dropped between the previous image and this one
+	int64_t			mTimestampInNs;
+	TimestampClock	mTimestampClock;
+	TimestampSource	mTimestampSource;
 };
 
+inline void swap( CapturedImage& a, CapturedImage& b )	{ a.swap( b ); }
+
 }
\ No newline at end of file
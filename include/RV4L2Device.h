@@ -24,8 +24,20 @@
 #pragma once
 
 #include <string>
+#include <stdint.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <atomic>
 #include "RV4L2CaptureSettings.h"
 #include "RV4L2CapturedImage.h"
+#include "RV4L2FrameLease.h"
+#include "RV4L2FrameRing.h"
+#include "RV4L2CaptureStatistics.h"
+#include "RV4L2FrameDecimator.h"
+#include "RV4L2CaptureBackend.h"
 
 namespace RV4L2
 {
@@ -33,44 +45,205 @@ namespace RV4L2
 class Device
 {
 public:
-    Device( const char* deviceName );
+	// The device takes ownership of the backend. Without one, deviceName is a V4L2 device node
+    Device( const char* deviceName, CaptureBackend* backend=NULL );
 	virtual ~Device();
 	
 	const std::string&			getDeviceName() const					{ return mDeviceName; }	
 	bool						isValid() const							{ return mHandle!=-1; }
+	int							getHandle() const						{ return mHandle; }
+	bool						isMultiPlanar() const					{ return mIsMultiPlanar; }		// Uses the V4L2 multi-planar API
 
 	const CaptureSettingsList&	getSupportedCaptureSettingsList() const	{ return mCaptureSettingsList; }
 	bool						getSupportedCaptureSettingsIndex( const CaptureSettings& captureSettings, std::size_t& index ) const;
+	bool						requestCaptureSettings( unsigned int width, unsigned int height, ImageFormat::Encoding encoding, float frameRateInHz, std::size_t& captureSettingsIndex );
 
-	bool						startCapture( std::size_t captureSettingsIndex ); 
+	// Enumerating the capture settings of a device can take hundreds of milliseconds. When a cache 
+	// directory is set (before creating the devices), the enumeration result is stored there, one 
+	// file per device. A file is only reused for a device reporting the same driver, card, bus
+	// and driver version. invalidateCachedCaptureSettings() forces a new enumeration
+	static void					setCaptureSettingsCacheDirectory( const char* directory );
+	static const std::string&	getCaptureSettingsCacheDirectory()		{ return mCaptureSettingsCacheDirectory; }
+	bool						invalidateCachedCaptureSettings();
+
+	// How captured images are handed to the listeners. In ZeroCopyDelivery mode, the CapturedImage
+	// refers directly to the memory-mapped driver buffer and is only guaranteed to be valid during 
+	// onDeviceCapturedImage() (acquire a FrameLease to keep it longer). CopyDelivery is the 
+	// compatibility mode where each image is copied into a CapturedImage owned by the Device
+	enum DeliveryMode
+	{
+		ZeroCopyDelivery,
+		CopyDelivery
+	};
+	bool						setDeliveryMode( DeliveryMode deliveryMode );
+	DeliveryMode				getDeliveryMode() const					{ return mDeliveryMode; }
+
+	// How the device gets its captured images. In ManualUpdate mode, client code is responsible 
+	// for calling update() regularly. In ThreadedUpdate mode, startCapture() launches a capture 
+	// thread that waits for the driver and notifies the listeners as soon as an image is ready.
+	// The listeners are then called from that thread
+	enum UpdateMode
+	{
+		ManualUpdate,
+		ThreadedUpdate
+	};
+	bool						setUpdateMode( UpdateMode updateMode );
+	UpdateMode					getUpdateMode() const					{ return mUpdateMode; }
+
+	// Number of buffers shared with the driver. Fewer buffers mean less latency between the 
+	// capture and the delivery of an image, more buffers leave more time to the consumers before 
+	// the driver runs out of buffers and drops frames. AutoBufferCount sizes the queue from the 
+	// buffer hold time measured during the previous capture and the frame interval of the new one
+	enum BufferCount
+	{
+		AutoBufferCount = 0,
+		LowLatencyBufferCount = 2,
+		DefaultBufferCount = 3,
+		BalancedBufferCount = 4,
+		HighThroughputBufferCount = 8
+	};
+
+	bool						startCapture( std::size_t captureSettingsIndex, unsigned int bufferCount=DefaultBufferCount ); 
 	bool						isCapturing() const { return mIsCapturing; }
+	bool						isDisconnected() const					{ return mIsDisconnected; }
+	unsigned int				getNumBuffers() const					{ return mNumBuffers; }
+	float						getMeasuredBufferHoldTimeInSec() const;
+	uint64_t					getNumDroppedFrames() const				{ return mStatistics.getNumDroppedFrames(); }
+	const CaptureStatistics&	getStatistics() const					{ return mStatistics; }
+	void						resetStatistics()						{ mStatistics.reset(); }
 	bool						stopCapture(); 
-	const CapturedImage*		getCapturedImage() const				{ return mCapturedImage; }
-	void						update();
+	bool						reconfigure( std::size_t captureSettingsIndex );
+
+	// Non-blocking variants of startCapture() and stopCapture(), run by a worker thread of the
+	// device in the order they are requested. Completion is reported to the listeners from that 
+	// thread, exactly once per request: onDeviceStarted() or onDeviceStartFailed(), and 
+	// onDeviceStopped(). Requesting the current state (starting a capturing device, stopping
+	// a stopped one) is reported as done
+	bool						startCaptureAsync( std::size_t captureSettingsIndex, unsigned int bufferCount=DefaultBufferCount );
+	bool						stopCaptureAsync();
+	bool						isCaptureOperationPending() const;
+	std::size_t					getCaptureSettingsIndex() const			{ return mCaptureSettingsIndex; }
+	const CapturedImage*		getCapturedImage() const;
+	unsigned int				update();
+
+	// See FrameLease. Every lease must be released before the Device is destroyed
+	FrameLease*					acquireFrameLease();
+
+	// Capture into buffers owned by the application (V4L2_MEMORY_USERPTR) rather than into driver 
+	// memory. The buffers must be page-aligned, large enough for the captured images and must 
+	// outlive the capture. They replace the buffer count given to startCapture(). Passing no 
+	// buffer reverts to memory-mapped driver buffers
+	bool						setUserBuffers( void* const* buffers, unsigned int numBuffers, std::size_t bufferLength );
+	bool						isUsingUserBuffers() const				{ return !mUserBuffers.empty(); }
+
+	bool						setDmaBufExportEnabled( bool enabled );
+	bool						isDmaBufExportEnabled() const			{ return mDmaBufExportEnabled; }
+
+	bool						setFrameRing( FrameRing* frameRing );
+	FrameRing*					getFrameRing() const					{ return mFrameRing; }
+
+	// Real-time capture. The capture thread (ThreadedUpdate mode) can be pinned to some CPUs and 
+	// run with the SCHED_FIFO policy at the given priority (1 to 99, 0 keeps the normal policy), 
+	// which usually requires CAP_SYS_NICE or an rtprio limit. With memory locking, the buffers 
+	// and the CapturedImage are locked in RAM and prefaulted when the capture starts, so that 
+	// no page fault happens on the capture path. Failing to apply these settings is reported 
+	// but doesn't prevent the capture. They can only be changed while not capturing
+	bool						setCaptureThreadCpus( const std::vector<unsigned int>& cpus );		// Empty for any CPU
+	const std::vector<unsigned int>&	getCaptureThreadCpus() const	{ return mCaptureThreadCpus; }
+	bool						setCaptureThreadPriority( int priority );
+	int							getCaptureThreadPriority() const		{ return mCaptureThreadPriority; }
+	bool						setMemoryLockingEnabled( bool enabled );
+	bool						isMemoryLockingEnabled() const			{ return mMemoryLockingEnabled; }
+
+	// Only deliver one image out of every frameDivider, and/or no more than maxRateInHz measured 
+	// on the driver timestamps (see FrameDecimator). The other frames are given back to the 
+	// driver as soon as they're dequeued: their data isn't copied, the FrameRing and the 
+	// listeners don't see them and the frames dropped meanwhile by the driver are reported with
+	// the next delivered image. Passing 1 and 0 delivers every image again
+	bool						setDeliveryDecimation( unsigned int frameDivider, float maxRateInHz=0.f );
+	unsigned int				getDeliveryFrameDivider() const;
+	float						getDeliveryMaxRateInHz() const;
 
 	class Listener
 	{
 	public:
 		virtual ~Listener() {}
 		virtual void onDeviceStarted( Device* /*device*/ ) {}
+		virtual void onDeviceStartFailed( Device* /*device*/ ) {}		// Only for startCaptureAsync()
+		virtual void onDeviceDroppedFrames( Device* /*device*/, unsigned int /*numDroppedFrames*/ ) {}		// Called before the image that follows the gap
 		virtual void onDeviceCapturedImage( Device* /*device*/ ) {}
 		virtual void onDeviceStopped( Device* /*device*/ ) {}
+		virtual void onDeviceReconfigured( Device* /*device*/ ) {}		// The capture settings changed while capturing
+		virtual void onDeviceDisconnected( Device* /*device*/ ) {}		// The device went away (unplugged, USB reset...) while capturing
+		
+		// A listener only following the state of the device doesn't get the images, and doesn't
+		// keep a frame that nobody else takes from being decimated
+		virtual bool consumesImages() const { return true; }
 	};
 
+	// By default, the listeners are called one after the other from the thread delivering the 
+	// images, and the buffer goes back to the driver once the slowest of them has returned. 
+	// A listener added with a queue depth is given the images on a dispatch thread of its own 
+	// instead, through a FrameRing of that depth with the given overflow policy. Each queued 
+	// image holds a reference onto its buffer, which is re-queued once every listener is done 
+	// with it. getCapturedImage() and acquireFrameLease() refer to the queued image when called 
+	// from that thread. Only onDeviceCapturedImage() is queued, the other notifications are 
+	// made synchronously to all the listeners. The dispatch threads drain their queue when the 
+	// capture stops. No lock on the listener list is held during the notifications, so the 
+	// listeners can query or change their queue and decimation from there. Once 
+	// removeListener() has returned, the listener isn't called anymore
 	void						addListener( Listener* listener );
+	void						addListener( Listener* listener, unsigned int queueDepth, FrameRing::OverflowPolicy overflowPolicy=FrameRing::OverwriteOldest );
 	bool						removeListener( Listener* listener );
+	const FrameRing*			getListenerQueue( const Listener* listener ) const;		// NULL for a synchronous listener
+
+	// Decimation of the images given to one listener, on top of the one of the device. A frame
+	// that no listener (nor the FrameRing) takes is not copied either
+	bool						setListenerDecimation( Listener* listener, unsigned int frameDivider, float maxRateInHz=0.f );
 
 protected:
-	static int					xioctl( int fh, int request, void *arg );
 	bool						openDevice();
 	bool						checkDeviceCapabilities();
 	void						closeDevice();	
 	void						initializeInternalCaptureSettingsList();
+	std::string					getCaptureSettingsCacheFileName() const;
+	bool						loadInternalCaptureSettingsList();
+	bool						saveInternalCaptureSettingsList() const;
 	static bool					getImageFormatEncoding( unsigned int v4l2PixelFormat, ImageFormat::Encoding& encoding );
 	void						initializeCaptureSettingsList();
-	bool						updateCapturedImage();
+	static unsigned int			getDistance( unsigned int a, unsigned int b );
+	static unsigned int			snapToStep( unsigned int value, unsigned int min, unsigned int max, unsigned int step );
+	static int64_t				getMonotonicTimeInNs();
+	static CapturedImage::TimestampClock	getTimestampClock( unsigned int v4l2BufferFlags );
+	unsigned int				getAutoBufferCount( float frameIntervalInS ) const;
+	unsigned int				getBufferType() const;
+	unsigned int				getMemoryType() const;
+	bool						exportBuffers();
+	bool						queueBuffer( unsigned int bufferIndex );
+	bool						updateCapturedImage( bool& imageDelivered );
+	bool						startCaptureThread();
+	void						applyCaptureThreadSettings();
+	void						lockBuffers();
+	void						unlockBuffers();
+	void						stopCaptureThread();
+	void						captureThreadMain();
+	void						releaseFrameLease( FrameLease* frameLease );
+	bool						setCaptureFormat( std::size_t captureSettingsIndex );
+	bool						allocateBuffers( unsigned int bufferCount );
+	void						releaseBuffers( bool keepAllocations );
+	bool						startStreaming();
+	bool						stopStreaming();
+	void						stopDelivery();
+	bool						startCapture( std::size_t captureSettingsIndex, unsigned int bufferCount, bool& isStartNotified );
+	void						stopAsyncThread();
+	void						asyncThreadMain();
+	void						startListenerDispatch();
+	void						stopListenerDispatch();
+	void						resetDecimation();
 
 private:
+	friend class FrameLease;
+
 	struct InternalCaptureSettings
 	{
 		InternalCaptureSettings();
@@ -85,28 +258,134 @@ private:
 		float			getFrameIntervalInS() const; 
 		std::string		toString() const;
 	};
+	bool									probeFrameInterval( InternalCaptureSettings& internalCaptureSettings, float frameRateInHz ) const;
+
+	// Frame sizes the driver reports as stepwise or continuous ranges
+	struct FrameSizeRange
+	{
+		FrameSizeRange();
+		std::string		pixelFormatName;
+		unsigned int	pixelFormat;
+		unsigned int	minWidth;
+		unsigned int	maxWidth;
+		unsigned int	stepWidth;
+		unsigned int	minHeight;
+		unsigned int	maxHeight;
+		unsigned int	stepHeight;
+	};
 
 	std::string								mDeviceName;
-	int 									mHandle;
+	CaptureBackend*							mBackend;
+	int 									mHandle;		// The backend one, polled for captured images
+	bool									mIsMultiPlanar;
+	std::string								mCapabilitiesKey;		// Identifies the device and driver in the capture settings cache
+	static std::string						mCaptureSettingsCacheDirectory;
 
 	std::vector<InternalCaptureSettings>	mInternalCaptureSettingsList;
+	std::vector<FrameSizeRange>				mFrameSizeRanges;
 	CaptureSettingsList						mCaptureSettingsList;
 	std::vector<std::size_t>				mCaptureSettingsToInternalCaptureSettingsIndices;
+	std::size_t								mCaptureSettingsIndex;		// Of the current or last capture
 	
-	bool									mIsCapturing;
+	DeliveryMode							mDeliveryMode;
+	UpdateMode								mUpdateMode;
+	bool									mDmaBufExportEnabled;
+	std::vector<void*>						mUserBuffers;
+	std::size_t								mUserBufferLength;
+	std::atomic<bool>						mIsCapturing;
+	std::atomic<bool>						mIsDisconnected;
+	std::recursive_mutex					mCaptureMutex;				// Serializes update() and the capture setters with startCapture()/stopCapture()
 	CapturedImage*							mCapturedImage;
 
-	struct buffer 
+	struct bufferPlane
 	{
         void   *start;		// unsigned char?
         size_t  length;
+		int		dmaBufFd;
 	};
+	struct buffer 
+	{
+		bufferPlane	planes[Image::MaxNumPlanes];
+		int64_t		dequeueTimeInNs;
+	};
+	bool									mapBuffers( struct buffer* buffers, unsigned int numBuffers );
+	bool									useUserBuffers( struct buffer* buffers, unsigned int numBuffers );
+
 	struct buffer*							mBuffers;
 	unsigned int							mNumBuffers;
-    static const unsigned int				mNumBuffersToUse = 3;
+	unsigned int							mMaxNumBuffers;							// Allocated size of mBuffers
+	unsigned int							mNumPlanes;								// Memory planes per buffer
+	unsigned int							mPlaneSizesInBytes[Image::MaxNumPlanes];
+	unsigned int							mPlaneBytesPerLine[Image::MaxNumPlanes];
+	static const unsigned int				mMaxAutoBufferCount = 16;
+	static const unsigned int				mMaxSequenceGap = 1000;			// Larger jumps of the driver sequence number aren't believed
+	std::atomic<int64_t>					mMeasuredBufferHoldTimeInNs;	// Decaying peak of the time buffers spend out of the driver queue
+	unsigned int							mLastSequenceNumber;
+	bool									mHasLastSequenceNumber;
+	std::atomic<unsigned int>				mNumQueuedBuffers;				// Buffers currently owned by the driver
+	CaptureStatistics						mStatistics;
+
+	typedef std::vector<FrameLease*> FrameLeases;
+	FrameLeases								mFrameLeases;				// One per buffer
+	FrameLeases								mRetiredFrameLeases;		// Still held by client code after their buffers were released
+	unsigned int							mBufferGeneration;			// Incremented each time the buffers are released
+	std::mutex								mLeaseMutex;				// Serializes the lease releases with the buffer release
+	FrameLease*								mDispatchedFrameLease;		// The lease of the buffer being notified to the listeners
+	FrameRing*								mFrameRing;
+
+	std::thread								mCaptureThread;
+	std::vector<unsigned int>				mCaptureThreadCpus;
+	int										mCaptureThreadPriority;
+	bool									mMemoryLockingEnabled;
+	std::vector<std::pair<void*, std::size_t> >	mLockedMemoryRanges;		// To unlock when the buffers are released
+	int64_t									mLastDequeueTimeInNs;		// 0 until the first image of the capture
+	int										mEpollHandle;
+	int										mWakeUpHandle;				// eventfd used to stop the capture thread
+	static const int						mCaptureThreadTimeoutInMs = 1000;
+
+	struct AsyncOperation
+	{
+		bool			isStart;
+		std::size_t		captureSettingsIndex;
+		unsigned int	bufferCount;
+	};
+	std::thread								mAsyncThread;				// Started on the first asynchronous operation
+	mutable std::mutex						mAsyncMutex;
+	std::condition_variable					mAsyncCondition;
+	std::deque<AsyncOperation>				mAsyncOperations;
+	bool									mIsAsyncOperationRunning;
+	bool									mIsAsyncThreadExiting;
 
 	typedef	std::vector<Listener*> Listeners; 
-    Listeners								mListeners;
+    Listeners								mListeners;				// All of them, queued or not
+	mutable std::mutex						mListenersMutex;
+
+	struct QueuedListener
+	{
+		QueuedListener( Listener* listener, unsigned int queueDepth, FrameRing::OverflowPolicy overflowPolicy );
+		Listener*		listener;
+		FrameRing		queue;
+		std::thread		dispatchThread;
+	};
+	typedef std::vector<QueuedListener*> QueuedListeners;
+	QueuedListeners							mQueuedListeners;
+	FrameDecimator							mDeliveryDecimator;
+	unsigned int							mNumUndeliveredDroppedFrames;	// Dropped by the driver before decimated frames
+	typedef std::map<const Listener*, FrameDecimator> ListenerDecimators;
+	ListenerDecimators						mListenerDecimators;
+	struct DispatchedListener
+	{
+		Listener*		listener;
+		QueuedListener*	queuedListener;		// NULL for a synchronous listener
+		bool			isDelivered;		// Whether it gets the image being delivered
+	};
+	std::vector<DispatchedListener>			mDispatchedListeners;			// The listeners of the image being delivered
+	std::recursive_mutex					mDispatchMutex;					// Held while notifying, unlike mListenersMutex
+	void									notifyListeners( void (Listener::*notification)( Device* ) );
+	QueuedListener*							findQueuedListener( const Listener* listener ) const;
+	void									startDispatchThread( QueuedListener* queuedListener );
+	static void								stopDispatchThread( QueuedListener* queuedListener );
+	void									dispatchThreadMain( QueuedListener* queuedListener );
 
     std::vector<std::pair< unsigned int, unsigned int> > mFallbackFrameSizes;
 };
@@ -0,0 +1,100 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+namespace RV4L2
+{
+
+/*
+	DeviceMonitor
+
+	Watches a directory (/dev by default) with inotify and reports the video device nodes 
+	that appear or disappear, typically when a USB camera is plugged, unplugged or reset. 
+	There is no dependency on udev.
+
+	A node is reported as added once it is accessible for reading and writing: udev creates 
+	it first and sets its permissions afterwards. The monitor does nothing on its own, its
+	handle must be watched for readability and update() called when it is. The handle can 
+	be added to a CaptureManager (see CaptureManager::addDeviceMonitor()) so that new devices
+	get reported by the same threads that capture images, without any polling delay.
+
+	After a removal, the Device object of the node can't be used anymore: a new one must be 
+	created once the node is added again.
+*/
+class DeviceMonitor
+{
+public:
+	DeviceMonitor( const char* directory="/dev", const char* namePrefix="video" );
+	virtual ~DeviceMonitor();
+
+	bool						isValid() const					{ return mHandle!=-1; }
+	int							getHandle() const				{ return mHandle; }
+	const std::string&			getDirectory() const			{ return mDirectory; }
+	std::vector<std::string>	getDeviceNames() const;
+
+	unsigned int				update();
+	bool						waitForEvents( int timeoutInMs );
+
+	class Listener
+	{
+	public:
+		virtual ~Listener() {}
+		virtual void onDeviceAdded( DeviceMonitor* /*deviceMonitor*/, const std::string& /*deviceName*/ ) {}
+		virtual void onDeviceRemoved( DeviceMonitor* /*deviceMonitor*/, const std::string& /*deviceName*/ ) {}
+	};
+
+	// The listeners are notified without any lock on the list held, so they can add or remove
+	// listeners from there. Once removeListener() has returned, the listener isn't called anymore
+	void						addListener( Listener* listener );
+	bool						removeListener( Listener* listener );
+
+private:
+	DeviceMonitor( const DeviceMonitor& other );				// Not implemented on purpose
+	DeviceMonitor& operator=( const DeviceMonitor& other );		// Not implemented on purpose
+
+	bool						isMonitoredName( const char* name ) const;
+	bool						isAccessible( const std::string& deviceName ) const;
+	void						scanDirectory( std::vector<std::string>& deviceNames ) const;
+	unsigned int				rescan();
+	bool						addDeviceName( const std::string& deviceName );
+	bool						removeDeviceName( const std::string& deviceName );
+	void						notifyListeners( void (Listener::*notification)( DeviceMonitor*, const std::string& ), const std::string& deviceName );
+
+	std::string					mDirectory;
+	std::string					mNamePrefix;
+	int							mHandle;
+	std::vector<std::string>	mDeviceNames;
+	mutable std::mutex			mDeviceNamesMutex;
+	
+	typedef	std::vector<Listener*> Listeners; 
+	Listeners					mListeners;
+	std::mutex					mListenersMutex;
+	std::recursive_mutex		mDispatchMutex;				// Held while notifying, unlike mListenersMutex
+};
+
+}
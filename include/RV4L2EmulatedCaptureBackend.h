@@ -0,0 +1,168 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "RV4L2CaptureBackend.h"
+#include "RV4L2ImageFormat.h"
+
+namespace RV4L2
+{
+
+/*
+	EmulatedCaptureBackend
+
+	Base of the backends that emulate a V4L2 capture device in-process: it implements the 
+	single-planar streaming I/O (MMAP and USERPTR buffers) and a generator thread filling the 
+	queued buffers. The derived classes describe the formats, frame sizes and frame rates 
+	they support, and fill the buffers in generateFrame().
+
+	Frames are produced at the frame interval of the current capture settings (or the one 
+	getFrameIntervalInNs() returns). When no buffer is queued at that time, the frame is 
+	dropped and its sequence number skipped, like a driver would do. In free-running mode, a 
+	frame is produced as soon as a buffer is queued.
+*/
+class EmulatedCaptureBackend : public CaptureBackend
+{
+public:
+	virtual ~EmulatedCaptureBackend();
+
+	void						setFreeRunning( bool freeRunning );
+	bool						isFreeRunning() const					{ return mIsFreeRunning; }
+
+	// From now on, the device behaves as if it was unplugged: the pending and future 
+	// queue, dequeue and stream-off requests fail with ENODEV
+	void						simulateDisconnection();
+
+	virtual bool				open( const std::string& deviceName );
+	virtual void				close();
+	virtual int					getHandle() const						{ return mHandle; }
+	virtual int					ioctl( unsigned long request, void* arg );
+	virtual void*				mmap( std::size_t length, off_t offset );
+	virtual int					munmap( void* start, std::size_t length );
+
+protected:
+	EmulatedCaptureBackend( const char* driverName, const char* cardName, const char* busInfoPrefix );
+
+	// Called by open() and close(). openSource() must fill the supported formats, sizes and rates 
+	virtual bool				openSource( const std::string& deviceName ) = 0;
+	virtual void				closeSource() {}
+	
+	// Called by the generator thread, without any lock held. A frame is only produced when hasFrame() 
+	// returns true, the next one getFrameIntervalInNs() later (unless free-running)
+	virtual void				generateFrame( unsigned char* data, uint32_t sequenceNumber ) = 0;
+	virtual bool				hasFrame( uint32_t /*sequenceNumber*/ ) const		{ return true; }
+	virtual int64_t				getFrameIntervalInNs( uint32_t sequenceNumber ) const;
+
+	const ImageFormat&			getImageFormat() const					{ return mImageFormat; }
+	unsigned int				getFrameRateInHz() const				{ return mFrameRateInHz; }
+	const std::string&			getDeviceName() const					{ return mDeviceName; }
+	bool						hasFrameSize( unsigned int width, unsigned int height ) const;
+	static bool					isSupportedEncoding( ImageFormat::Encoding encoding );
+	static std::vector<ImageFormat::Encoding>	getSupportedEncodings();		// The most common camera formats first
+
+	std::vector<ImageFormat::Encoding>						mEncodings;
+	std::vector< std::pair<unsigned int, unsigned int> >	mFrameSizes;
+	std::vector<unsigned int>								mFrameRates;
+
+private:
+	EmulatedCaptureBackend( const EmulatedCaptureBackend& other );				// Not implemented on purpose
+	EmulatedCaptureBackend& operator=( const EmulatedCaptureBackend& other );	// Not implemented on purpose
+
+	struct PixelFormat
+	{
+		ImageFormat::Encoding	encoding;
+		unsigned int			v4l2PixelFormat;
+		const char*				description;
+	};
+	static const PixelFormat	mPixelFormats[];
+	static const unsigned int	mNumPixelFormats;
+	static const PixelFormat*	findPixelFormat( unsigned int v4l2PixelFormat );
+	static const PixelFormat*	findPixelFormat( ImageFormat::Encoding encoding );
+	const PixelFormat*			findSupportedPixelFormat( unsigned int v4l2PixelFormat ) const;
+	unsigned int				getConfigurationChecksum() const;
+
+	int							queryCapabilities( void* arg );
+	int							enumerateFormat( void* arg );
+	int							enumerateFrameSize( void* arg );
+	int							enumerateFrameInterval( void* arg );
+	int							getFormat( void* arg );
+	int							setFormat( void* arg, bool tryOnly );
+	int							getStreamParameters( void* arg );
+	int							setStreamParameters( void* arg );
+	int							requestBuffers( void* arg );
+	int							queryBuffer( void* arg );
+	int							queueBuffer( void* arg );
+	int							dequeueBuffer( void* arg );
+	int							startStreaming( void* arg );
+	int							stopStreaming( void* arg );
+	void						freeBuffers();
+	void						resetHandle();
+
+	void						generatorThreadMain();
+	static int64_t				getMonotonicTimeInNs();
+
+	std::string					mDriverName;
+	std::string					mCardName;
+	std::string					mBusInfoPrefix;
+	std::atomic<bool>			mIsFreeRunning;
+	std::string					mDeviceName;
+	int							mHandle;		// eventfd in semaphore mode, counting the buffers ready to be dequeued
+	
+	// Current format and frame interval
+	ImageFormat					mImageFormat;
+	unsigned int				mV4L2PixelFormat;
+	unsigned int				mFrameRateInHz;
+
+	// Buffers: in MMAP mode, allocated here and mapped at an offset identifying them
+	struct Buffer
+	{
+		Buffer();
+		unsigned char*			memory;			// Owned in MMAP mode, the application one in USERPTR mode
+		std::size_t				length;
+		bool					isQueued;
+		bool					isDone;
+		uint32_t				sequenceNumber;
+		int64_t					timestampInNs;
+	};
+	std::vector<Buffer>			mBuffers;
+	unsigned int				mMemoryType;
+	std::size_t					mBufferStride;	// Between the mmap offsets of two buffers
+	std::vector<unsigned int>	mQueuedBuffers;		// In queuing order. Reserved for all the buffers, so that queuing never allocates
+	std::vector<unsigned int>	mDoneBuffers;
+	bool						mIsStreaming;
+	bool						mIsDisconnected;
+	uint32_t					mSequenceNumber;
+	std::mutex					mMutex;
+	std::condition_variable		mCondition;
+	std::thread					mGeneratorThread;
+	bool						mIsGeneratorThreadExiting;
+};
+
+}
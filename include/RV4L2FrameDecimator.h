@@ -0,0 +1,74 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#pragma once
+
+#include <stdint.h>
+
+namespace RV4L2
+{
+
+/*
+	FrameDecimator
+
+	Decides which frames of a capture are kept when only part of them is needed: one frame 
+	out of every N, and/or no more frames than a maximum rate. The rate is measured on the 
+	capture timestamps rather than on the processing time, so that the choice doesn't depend 
+	on the scheduling. When both are set, a frame is kept once both agree.
+
+	The kept frames follow a schedule at the maximum rate, so that a rate which isn't a 
+	divider of the capture rate is still met on average. Half a frame interval of tolerance 
+	absorbs the timestamp jitter. A gap in the capture (or timestamps going back) restarts 
+	the schedule from the next frame.
+*/
+class FrameDecimator
+{
+public:
+	FrameDecimator( unsigned int frameDivider=1, float maxRateInHz=0.f );
+
+	void				setFrameDivider( unsigned int frameDivider );			// 0 or 1 to keep every frame
+	unsigned int		getFrameDivider() const					{ return mFrameDivider; }
+	void				setMaxRateInHz( float maxRateInHz );					// 0 for no limit
+	float				getMaxRateInHz() const					{ return mMaxRateInHz; }
+	bool				isEnabled() const						{ return mFrameDivider>1 || mMinIntervalInNs>0; }
+
+	bool				keepFrame( int64_t timestampInNs );
+	void				reset();
+
+	uint64_t			getNumKeptFrames() const				{ return mNumKeptFrames; }
+	uint64_t			getNumSkippedFrames() const				{ return mNumSkippedFrames; }
+
+private:
+	unsigned int		mFrameDivider;
+	float				mMaxRateInHz;
+	int64_t				mMinIntervalInNs;
+	unsigned int		mNumFramesSinceKept;
+	bool				mHasKeptFrame;
+	int64_t				mNextTimestampInNs;				// Of the next frame to keep, on the schedule
+	bool				mHasLastTimestamp;
+	int64_t				mLastTimestampInNs;
+	uint64_t			mNumKeptFrames;
+	uint64_t			mNumSkippedFrames;
+};
+
+}
@@ -0,0 +1,87 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#pragma once
+
+#include <atomic>
+#include "RV4L2CapturedImage.h"
+
+namespace RV4L2
+{
+
+class Device;
+
+/*
+	FrameLease
+
+	A read-only view onto one of the memory-mapped buffers of a capturing Device. 
+	While a lease is held, the buffer is kept out of the driver queue, so the image 
+	data remains valid without having been copied. Releasing the last lease on a 
+	buffer gives it back to the driver. 
+	
+	Leases are obtained with Device::acquireFrameLease() from within 
+	Device::Listener::onDeviceCapturedImage(). They can be released from any thread.
+	When the capture is stopped or reconfigured, the buffers go away and the image of a 
+	lease still held must no longer be read, but releasing the lease remains safe. 
+	Releasing goes through the Device though: every lease must be released before the 
+	Device is destroyed.
+
+	When the Device exports its buffers (see Device::setDmaBufExportEnabled()), the lease 
+	also describes the buffer as a dmabuf, so that other components or processes can import 
+	the image without copying it. The file descriptor belongs to the Device: importers that 
+	keep it beyond the capture session must dup() it.
+*/
+class FrameLease
+{
+public:
+	Device*					getDevice() const			{ return mDevice; }
+	unsigned int			getBufferIndex() const		{ return mBufferIndex; }
+	const CapturedImage&	getCapturedImage() const	{ return mCapturedImage; }
+
+	unsigned int			getPixelFormat() const		{ return mPixelFormat; }		// V4L2 fourcc
+	unsigned int			getNumPlanes() const		{ return mCapturedImage.getImage().getNumPlanes(); }
+	int						getDmaBufFd( unsigned int planeIndex=0 ) const;				// -1 if not exported
+	unsigned int			getBytesPerLine( unsigned int planeIndex=0 ) const;
+	unsigned int			getBytesUsed( unsigned int planeIndex=0 ) const;
+
+	void					release();
+
+private:
+	friend class Device;
+
+	FrameLease( Device* device, unsigned int bufferIndex, const ImageFormat& imageFormat, unsigned char* const* planeBytes, const unsigned int* planeSizesInBytes, unsigned int numPlanes );
+	FrameLease( const FrameLease& other );				// Not implemented on purpose
+	FrameLease& operator=( const FrameLease& other );	// Not implemented on purpose
+
+	Device*					mDevice;
+	unsigned int			mBufferIndex;
+	unsigned int			mGeneration;		// Device buffer generation this lease views
+	CapturedImage			mCapturedImage;
+	unsigned int			mPixelFormat;
+	int						mDmaBufFds[Image::MaxNumPlanes];
+	unsigned int			mBytesPerLine[Image::MaxNumPlanes];
+	unsigned int			mBytesUsed[Image::MaxNumPlanes];
+	std::atomic<unsigned int>	mNumReferences;
+};
+
+}
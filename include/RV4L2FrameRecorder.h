@@ -0,0 +1,152 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "RV4L2Device.h"
+
+namespace RV4L2
+{
+
+/*
+	FrameRecorder
+
+	Records raw captured images to disk at high throughput. Each image is copied into one of 
+	a fixed number of pre-allocated slots, then a background thread appends the slots to 
+	segment files, several of them per write call. A segment file is allocated up front with
+	fallocate() and trimmed to its content when closed. The files are opened with O_DIRECT 
+	when the file system supports it (bypassing the page cache) and with plain buffered I/O 
+	otherwise. The file layout is the same in both cases.
+
+	Each image is stored as a FrameHeader followed by the image data (planes one after the 
+	other), padded to a multiple of RecordAlignment bytes. A segment ends with the last record,
+	the next image being in the next segment file.
+
+	When all the slots are waiting to be written, the disk doesn't keep up: depending on 
+	the backpressure policy, the image is dropped or record() blocks until a slot is free. 
+	Dropped images are counted, and the header of the next recorded image tells how many 
+	images were dropped just before it.
+
+	The recorder can be added as a listener of a Device to record all its images.
+*/
+class FrameRecorder : public Device::Listener
+{
+public:
+	static const unsigned int	RecordAlignment = 4096;
+	static const uint32_t		FrameHeaderMagic = 0x46345652;		// "RV4F" in little endian
+
+	struct FrameHeader
+	{
+		uint32_t	magic;
+		uint32_t	headerSizeInBytes;
+		uint32_t	recordSizeInBytes;		// Header, data and padding: the next header follows
+		uint32_t	encoding;				// ImageFormat::Encoding
+		uint32_t	width;
+		uint32_t	height;
+		uint32_t	dataSizeInBytes;
+		uint32_t	sequenceNumber;
+		int64_t		timestampInNs;
+		uint32_t	timestampClock;			// CapturedImage::TimestampClock
+		uint32_t	numDroppedFrames;		// Images the recorder dropped just before this one
+		uint32_t	reserved[4];
+	};
+
+	enum BackpressurePolicy
+	{
+		DropFrames,
+		BlockUntilWritten
+	};
+
+	FrameRecorder( const char* directory, const char* baseName="recording", uint64_t segmentSizeInBytes=1024ULL*1024ULL*1024ULL, unsigned int numSlots=16 );
+	virtual ~FrameRecorder();
+
+	bool						setBackpressurePolicy( BackpressurePolicy policy );
+	BackpressurePolicy			getBackpressurePolicy() const			{ return mBackpressurePolicy; }
+
+	bool						start( const ImageFormat& largestImageFormat );
+	bool						isRecording() const						{ return mIsRecording; }
+	void						stop();
+
+	bool						record( const CapturedImage& capturedImage );
+
+	uint64_t					getNumRecordedFrames() const			{ return mNumRecordedFrames; }
+	uint64_t					getNumDroppedFrames() const				{ return mNumDroppedFrames; }
+	uint64_t					getNumRecordedBytes() const				{ return mNumRecordedBytes; }
+	unsigned int				getNumSegments() const					{ return mNumSegments; }
+	bool						isUsingDirectIO() const					{ return mIsUsingDirectIO; }
+	std::string					getSegmentFileName( unsigned int segmentIndex ) const;
+
+protected:
+	virtual void				onDeviceCapturedImage( Device* device );
+
+private:
+	FrameRecorder( const FrameRecorder& other );				// Not implemented on purpose
+	FrameRecorder& operator=( const FrameRecorder& other );		// Not implemented on purpose
+
+	static uint32_t				getRecordSizeInBytes( uint32_t dataSizeInBytes );
+	unsigned char*				getSlot( unsigned int slotIndex ) const	{ return mSlotMemory + static_cast<std::size_t>(slotIndex) * mSlotSizeInBytes; }
+	bool						openSegment( bool reopen );
+	void						closeSegment();
+	bool						writeSlots( const unsigned int* slotIndices, unsigned int numSlots );
+	void						writerThreadMain();
+
+	std::string					mDirectory;
+	std::string					mBaseName;
+	uint64_t					mSegmentSizeInBytes;
+	unsigned int				mNumSlots;
+	BackpressurePolicy			mBackpressurePolicy;
+	std::atomic<bool>			mIsRecording;
+
+	// Slots, all in one aligned allocation
+	unsigned char*				mSlotMemory;
+	std::size_t					mSlotSizeInBytes;
+	std::deque<unsigned int>	mFreeSlots;
+	std::deque<unsigned int>	mFilledSlots;
+	unsigned int				mNumSlotsBeingFilled;		// Taken by record() but not filled yet
+	uint32_t					mNumPendingDroppedFrames;	// Since the last recorded image
+	bool						mIsStopping;
+	std::mutex					mSlotsMutex;
+	std::condition_variable		mSlotFreedCondition;
+	std::condition_variable		mSlotFilledCondition;
+	std::thread					mWriterThread;
+
+	// Current segment, only used by the writer thread once started
+	int							mSegmentHandle;
+	uint64_t					mSegmentOffset;
+	std::atomic<unsigned int>	mNumSegments;
+	std::atomic<bool>			mIsUsingDirectIO;
+
+	std::atomic<uint64_t>		mNumRecordedFrames;
+	std::atomic<uint64_t>		mNumDroppedFrames;
+	std::atomic<uint64_t>		mNumRecordedBytes;
+	static const unsigned int	mMaxSlotsPerWrite = 16;
+};
+
+}
@@ -0,0 +1,106 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <semaphore.h>
+#include <atomic>
+#include "RV4L2FrameLease.h"
+
+namespace RV4L2
+{
+
+/*
+	FrameRing
+
+	A bounded, lock-free, single-producer/single-consumer ring of FrameLeases. A Device 
+	publishes each captured image into it (see Device::setFrameRing()) and a consumer 
+	thread pops the leases at its own pace, releasing them once done.
+
+	When the ring is full, the OverwriteOldest policy drops (and releases) the oldest lease 
+	to make room, which keeps the capture going at the cost of lost frames. The BlockProducer 
+	policy makes the producer wait for the consumer instead, which holds the buffer away from 
+	the driver and lets it drop frames itself.
+
+	The ring is closed when the capture stops: blocked threads are woken up, pop() returns 
+	NULL once the ring is empty and the pending leases are released.
+*/
+class FrameRing
+{
+public:
+	enum OverflowPolicy
+	{
+		OverwriteOldest,
+		BlockProducer
+	};
+
+	FrameRing( unsigned int capacity, OverflowPolicy overflowPolicy=OverwriteOldest );
+	~FrameRing();
+
+	unsigned int		getCapacity() const					{ return mCapacity; }
+	OverflowPolicy		getOverflowPolicy() const			{ return mOverflowPolicy; }
+	unsigned int		getSize() const;
+	bool				isClosed() const					{ return mIsClosed; }
+
+	// Producer side
+	bool				push( FrameLease* frameLease );
+	
+	// Consumer side. A timeout of 0 doesn't wait, a negative one waits indefinitely
+	FrameLease*			pop( int timeoutInMs=-1 );
+
+	void				open();
+	void				close();
+	void				clear();
+	
+	uint64_t			getNumPushedFrames() const			{ return mNumPushedFrames; }
+	uint64_t			getNumPoppedFrames() const			{ return mNumPoppedFrames; }
+	uint64_t			getNumOverwrittenFrames() const		{ return mNumOverwrittenFrames; }
+	uint64_t			getNumBlockedPushes() const			{ return mNumBlockedPushes; }
+	uint64_t			getNumRejectedFrames() const		{ return mNumRejectedFrames; }
+	void				resetCounters();
+
+private:
+	FrameRing( const FrameRing& other );				// Not implemented on purpose
+	FrameRing& operator=( const FrameRing& other );		// Not implemented on purpose
+
+	FrameLease*			popOldest();
+	static bool			waitSemaphore( sem_t* semaphore, int timeoutInMs );
+
+	const unsigned int				mCapacity;
+	const OverflowPolicy			mOverflowPolicy;
+	std::atomic<FrameLease*>*		mSlots;
+	std::atomic<uint64_t>			mHead;				// Next slot to write, only modified by the producer
+	std::atomic<uint64_t>			mTail;				// Oldest slot, advanced by the consumer (or by the producer when overwriting)
+	std::atomic<bool>				mIsClosed;
+	sem_t							mNumPendingFrames;
+	sem_t							mNumFreeSlots;		// Only used with the BlockProducer policy
+
+	std::atomic<uint64_t>			mNumPushedFrames;
+	std::atomic<uint64_t>			mNumPoppedFrames;
+	std::atomic<uint64_t>			mNumOverwrittenFrames;
+	std::atomic<uint64_t>			mNumBlockedPushes;
+	std::atomic<uint64_t>			mNumRejectedFrames;
+};
+
+}
@@ -0,0 +1,76 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+namespace RV4L2
+{
+
+/*
+	Histogram
+
+	A histogram of positive integer values (typically durations in nanoseconds) that can be 
+	recorded into from one or several threads and read from another one without locking.
+
+	The buckets are log-linear, in the manner of HDR histograms: each power-of-two range 
+	is split into NumSubBuckets linear buckets. The relative error of the reported values
+	is therefore bounded (about 3%) whatever their magnitude, from nanoseconds to hours.
+*/
+class Histogram
+{
+public:
+	static const unsigned int		NumSubBucketBits = 5;
+	static const unsigned int		NumSubBuckets = 1 << NumSubBucketBits;
+	static const unsigned int		NumBuckets = NumSubBuckets * (64 - NumSubBucketBits + 1);
+
+	Histogram();
+
+	void					record( uint64_t value );
+	void					reset();
+
+	uint64_t				getCount() const					{ return mCount; }
+	uint64_t				getMin() const;
+	uint64_t				getMax() const						{ return mMax; }
+	double					getMean() const;
+	uint64_t				getValueAtPercentile( double percentile ) const;
+
+	uint64_t				getBucketCount( unsigned int bucketIndex ) const;
+	static unsigned int		getBucketIndex( uint64_t value );
+	static uint64_t			getBucketLowerBound( unsigned int bucketIndex );
+	static uint64_t			getBucketUpperBound( unsigned int bucketIndex );
+
+private:
+	Histogram( const Histogram& other );				// Not implemented on purpose
+	Histogram& operator=( const Histogram& other );		// Not implemented on purpose
+
+	std::atomic<uint64_t>	mBuckets[NumBuckets];
+	std::atomic<uint64_t>	mCount;
+	std::atomic<uint64_t>	mSum;
+	std::atomic<uint64_t>	mMin;
+	std::atomic<uint64_t>	mMax;
+};
+
+}
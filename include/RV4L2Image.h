@@ -31,22 +31,46 @@ namespace RV4L2
 
 /*
 	Image
+
+	The image data is usually held in a single buffer. An image can also refer to data
+	split into separate memory planes (as delivered by multi-planar capture devices), in 
+	which case getBuffer() is the first plane
 */
 class Image
 {
 public:
+	static const unsigned int		MaxNumPlanes = 3;
+
 	Image();
 	Image( const ImageFormat& imageFormat );
+	Image( const ImageFormat& imageFormat, unsigned char* externalBytes );
+	Image( const ImageFormat& imageFormat, unsigned char* const* externalPlaneBytes, const unsigned int* planeSizesInBytes, unsigned int numPlanes );
 	Image( const Image& other );
+	Image( Image&& other );
+
+	Image&							operator=( const Image& other );
+	Image&							operator=( Image&& other );
+	void							swap( Image& other );
 
 	const ImageFormat&				getFormat() const		{ return mFormat; }
 	
-	MemoryBuffer&					getBuffer()				{ return mBuffer; }
-	const MemoryBuffer&				getBuffer() const		{ return mBuffer; }
+	MemoryBuffer&					getBuffer()				{ return mPlaneBuffers[0]; }
+	const MemoryBuffer&				getBuffer() const		{ return mPlaneBuffers[0]; }
+
+	unsigned int					getNumPlanes() const	{ return mNumPlanes; }
+	MemoryBuffer&					getPlaneBuffer( unsigned int planeIndex );
+	const MemoryBuffer&				getPlaneBuffer( unsigned int planeIndex ) const;
+	unsigned int					getSizeInBytes() const;
+
+	void							setFormat( const ImageFormat& imageFormat );
+	void							attachPlanes( unsigned char* const* externalPlaneBytes, const unsigned int* planeSizesInBytes, unsigned int numPlanes );
 		
 private:
 	ImageFormat						mFormat;
-	MemoryBuffer					mBuffer;	
+	MemoryBuffer					mPlaneBuffers[MaxNumPlanes];
+	unsigned int					mNumPlanes;
 };
 
+inline void swap( Image& a, Image& b )		{ a.swap( b ); }
+
 }
\ No newline at end of file
@@ -33,18 +33,36 @@ class ImageConverter
 {
 public:
 	ImageConverter( const ImageFormat& outputImageFormat );
+	ImageConverter( ImageConverter&& other );		// The other converter can only be destroyed or assigned to afterwards
 	virtual ~ImageConverter();
 
+	ImageConverter&	operator=( ImageConverter&& other );
+	void			swap( ImageConverter& other );
+
 	bool			update( const Image& sourceImage );
 	const Image&	getImage() const			{ return *mImage; }
 	Image&			getImage()					{ return *mImage; }
 
 	static bool		convertYUYVImageToRGB24Image( const Image& sourceImage, Image& destImage );
+	static bool		convertUYVYImageToRGB24Image( const Image& sourceImage, Image& destImage );
+	static bool		convertNV12ImageToRGB24Image( const Image& sourceImage, Image& destImage );
+	static bool		convertI420ImageToRGB24Image( const Image& sourceImage, Image& destImage );
+	static bool		convertGrayscale8ImageToRGB24Image( const Image& sourceImage, Image& destImage );
+	static bool		convertBayerImageToRGB24Image( const Image& sourceImage, Image& destImage );
 	
 	static bool		convertImage( const Image& source, Image& destinationImage );
 
 private:
+	ImageConverter( const ImageConverter& other );				// Not implemented on purpose
+	ImageConverter& operator=( const ImageConverter& other );	// Not implemented on purpose
+
+	static bool				checkConversion( const Image& sourceImage, ImageFormat::Encoding sourceEncoding, const Image& destImage );
+	static const unsigned char*	getPlaneBytes( const Image& image, unsigned int planeIndex );
+	static bool				isBayerEncoding( ImageFormat::Encoding encoding );
+
 	Image*			mImage;
 };
 
+inline void swap( ImageConverter& a, ImageConverter& b )	{ a.swap( b ); }
+
 }
\ No newline at end of file
@@ -36,6 +36,13 @@ public:
 		Grayscale8,
 		RGB24,	
 		YUYV,
+		UYVY,
+		NV12,			// Y plane followed by an interleaved half-resolution CbCr plane
+		I420,			// Y plane followed by half-resolution Cb and Cr planes
+		BayerBGGR8,
+		BayerGBRG8,
+		BayerGRBG8,
+		BayerRGGB8,
 		
 		_32Bits,
 				
@@ -53,9 +60,16 @@ public:
 	
 	unsigned int			getNumBitsPerPixel() const		{ return getNumBitsPerPixel( getEncoding() ); }
 	static unsigned int		getNumBitsPerPixel( Encoding encoding );
-	unsigned int			getNumBytesPerLine() const		{ return getNumBitsPerPixel()*getWidth()/8; }	// Note: rounded to the upper byte?
+	unsigned int			getNumBytesPerLine() const		{ return getPlaneNumBytesPerLine(0); }
 	unsigned int			getDataSizeInBytes() const;
 
+	unsigned int			getNumPlanes() const			{ return getNumPlanes( getEncoding() ); }
+	static unsigned int		getNumPlanes( Encoding encoding );
+	unsigned int			getPlaneNumBytesPerLine( unsigned int planeIndex ) const;
+	unsigned int			getPlaneHeight( unsigned int planeIndex ) const;
+	unsigned int			getPlaneSizeInBytes( unsigned int planeIndex ) const	{ return getPlaneHeight(planeIndex) * getPlaneNumBytesPerLine(planeIndex); }
+	unsigned int			getPlaneOffsetInBytes( unsigned int planeIndex ) const;
+
 	bool					operator==( const ImageFormat& other ) const;
 	bool					operator!=( const ImageFormat& other ) const;
 
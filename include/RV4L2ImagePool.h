@@ -0,0 +1,119 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
+#include "RV4L2CapturedImage.h"
+
+namespace RV4L2
+{
+
+/*
+	ImagePool
+
+	Recycles CapturedImages for the consumers that keep frames beyond their notification 
+	(history buffers, processing pipelines...). acquire() hands out a Handle onto an image of
+	the requested format, taken from the free list of that format or newly allocated. Handles
+	are reference-counted: copying one only bumps the count, and the image goes back to its 
+	free list (rather than to the heap) once the last handle onto it is released. At most 
+	maxNumFreeImagesPerFormat images are kept per format, the others are deleted.
+
+	Handles can be copied and released from any thread. They must all be released before
+	the pool is destroyed.
+*/
+class ImagePool
+{
+private:
+	struct Entry;
+
+public:
+	class Handle
+	{
+	public:
+		Handle();
+		Handle( const Handle& other );
+		Handle( Handle&& other );
+		Handle& operator=( const Handle& other );
+		Handle& operator=( Handle&& other );
+		~Handle();
+		void					swap( Handle& other );
+
+		bool					isValid() const				{ return mEntry!=NULL; }
+		unsigned int			getNumReferences() const;
+		const CapturedImage&	getCapturedImage() const;
+		CapturedImage&			getCapturedImage();
+		const Image&			getImage() const			{ return getCapturedImage().getImage(); }
+		Image&					getImage()					{ return getCapturedImage().getImage(); }
+
+		void					release();
+
+	private:
+		friend class ImagePool;
+		explicit Handle( Entry* entry );
+		Entry*					mEntry;
+	};
+
+	ImagePool( unsigned int maxNumFreeImagesPerFormat=8 );
+	~ImagePool();
+
+	Handle					acquire( const ImageFormat& imageFormat );
+	Handle					acquireCopy( const CapturedImage& capturedImage );		// With the image data packed into a single buffer
+	void					trim();		// Deletes the free images
+
+	unsigned int			getMaxNumFreeImagesPerFormat() const	{ return mMaxNumFreeImagesPerFormat; }
+	unsigned int			getNumUsedImages() const;
+	unsigned int			getNumFreeImages() const;
+	uint64_t				getNumAllocatedImages() const;
+	uint64_t				getNumRecycledImages() const;
+
+private:
+	ImagePool( const ImagePool& other );				// Not implemented on purpose
+	ImagePool& operator=( const ImagePool& other );		// Not implemented on purpose
+
+	struct Entry
+	{
+		Entry( ImagePool* pool, const ImageFormat& imageFormat );
+		ImagePool*					pool;
+		CapturedImage				capturedImage;
+		std::atomic<unsigned int>	numReferences;
+	};
+	struct FreeList
+	{
+		ImageFormat					imageFormat;
+		std::vector<Entry*>			entries;
+	};
+	void					recycle( Entry* entry );
+
+	const unsigned int		mMaxNumFreeImagesPerFormat;
+	mutable std::mutex		mMutex;
+	std::vector<FreeList>	mFreeLists;
+	unsigned int			mNumUsedImages;
+	uint64_t				mNumAllocatedImages;
+	uint64_t				mNumRecycledImages;
+};
+
+}
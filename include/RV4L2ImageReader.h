@@ -31,6 +31,7 @@ namespace RV4L2
 class ImageReader
 {
 public:
+	static bool readBinaryPGMImage( const char* filename, Image& image );		// The image is left untouched on failure
 	static Image* readBinaryPGMImage( const char* filename );
 };
 
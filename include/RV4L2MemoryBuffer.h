@@ -31,22 +31,35 @@ class MemoryBuffer
 public:
 	MemoryBuffer();
 	MemoryBuffer( unsigned int sizeInBytes );
+	MemoryBuffer( unsigned char* externalBytes, unsigned int sizeInBytes );
 	MemoryBuffer( const MemoryBuffer& other );
+	MemoryBuffer( MemoryBuffer&& other );
 	~MemoryBuffer();	
 
+	MemoryBuffer&			operator=( MemoryBuffer&& other );
+	void					swap( MemoryBuffer& other );
+
 	unsigned int			getSizeInBytes() const	{ return mSizeInBytes; }
 	const unsigned char*	getBytes() const		{ return mBytes; }
 	unsigned char*			getBytes()				{ return mBytes; }
+	bool					ownsBytes() const		{ return mOwnsBytes; }
 	
 	void					fill( char value );
 	bool					copyFrom( const MemoryBuffer& other );
 	bool					copyFrom( const unsigned char* otherBytes, unsigned int numOtherBytes );
+	void					attach( unsigned char* externalBytes, unsigned int sizeInBytes );
+	void					resize( unsigned int sizeInBytes );
+	unsigned int			getCapacityInBytes() const	{ return mCapacityInBytes; }
 
 private:
 	MemoryBuffer& operator=( const MemoryBuffer& other );	// Not implemented on purpose
 
 	unsigned char*			mBytes;
 	unsigned int			mSizeInBytes;
+	unsigned int			mCapacityInBytes;		// Allocated size of owned data
+	bool					mOwnsBytes;
 };
 
+inline void swap( MemoryBuffer& a, MemoryBuffer& b )	{ a.swap( b ); }
+
 }
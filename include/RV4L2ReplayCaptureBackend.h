@@ -0,0 +1,110 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include "RV4L2EmulatedCaptureBackend.h"
+
+namespace RV4L2
+{
+
+/*
+	ReplayCaptureBackend
+
+	An emulated capture device playing back recorded images, so that a processing pipeline 
+	can be tested through the usual Device and Device::Listener interfaces. The device name 
+	is the source, either:
+	- a directory of binary PGM (Grayscale8) or PPM (RGB24) files, played in name order
+	- a recording of the FrameRecorder: one of its segment files, or the directory holding 
+	  them (played in name order)
+
+		Device device( "/data/recording", new ReplayCaptureBackend() );
+
+	The source files are memory-mapped for the whole replay, so that producing an image only 
+	costs a copy into the capture buffer. All the images must share the format of the first 
+	one, the others are skipped.
+
+	Recordings are replayed at their original pace (from their timestamps) multiplied by the 
+	speed, image directories at the image frame rate multiplied by the speed. In free-running 
+	mode, images are replayed as fast as the consumer gives the buffers back. Each start of 
+	the capture replays from the first image.
+*/
+class ReplayCaptureBackend : public EmulatedCaptureBackend
+{
+public:
+	ReplayCaptureBackend();
+	virtual ~ReplayCaptureBackend();
+
+	void						setSpeed( float speed );
+	float						getSpeed() const						{ return mSpeed; }
+	void						setLooping( bool looping )				{ mIsLooping = looping; }
+	bool						isLooping() const						{ return mIsLooping; }
+	void						setImageFrameRate( unsigned int frameRateInHz );		// Before the Device gets created
+	unsigned int				getImageFrameRate() const				{ return mImageFrameRateInHz; }
+
+	std::size_t					getNumFrames() const					{ return mFrames.size(); }
+	bool						isFinished() const						{ return mIsFinished; }		// All the images were replayed (when not looping)
+
+protected:
+	virtual bool				openSource( const std::string& deviceName );
+	virtual void				closeSource();
+	virtual void				generateFrame( unsigned char* data, uint32_t sequenceNumber );
+	virtual bool				hasFrame( uint32_t sequenceNumber ) const;
+	virtual int64_t				getFrameIntervalInNs( uint32_t sequenceNumber ) const;
+
+private:
+	struct Frame
+	{
+		const unsigned char*	data;
+		int64_t					timestampInNs;			// 0 when unknown
+	};
+
+	struct Mapping
+	{
+		void*					address;
+		std::size_t				length;
+	};
+
+	static bool					listFiles( const std::string& directory, std::vector<std::string>& fileNames );
+	static bool					hasExtension( const std::string& fileName, const char* extension );
+	const unsigned char*		mapFile( const std::string& fileName, std::size_t& length );
+	bool						addImageFile( const std::string& fileName );
+	bool						addRecordingFile( const std::string& fileName );
+	bool						addFrame( const ImageFormat& imageFormat, const unsigned char* data, int64_t timestampInNs );
+	std::size_t					getFrameIndex( uint32_t sequenceNumber ) const;
+
+	std::atomic<float>			mSpeed;
+	std::atomic<bool>			mIsLooping;
+	unsigned int				mImageFrameRateInHz;
+	mutable std::atomic<bool>	mIsFinished;
+	std::vector<Mapping>		mMappings;
+	std::vector<Frame>			mFrames;
+	ImageFormat					mSourceImageFormat;
+	std::size_t					mNumSkippedFrames;
+};
+
+}
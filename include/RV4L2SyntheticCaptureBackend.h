@@ -0,0 +1,80 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "RV4L2EmulatedCaptureBackend.h"
+
+namespace RV4L2
+{
+
+/*
+	SyntheticCaptureBackend
+
+	An emulated capture device generating test patterns in every ImageFormat encoding, at the 
+	frame sizes and rates it is configured with, so that throughput and latency can be 
+	measured without a camera:
+
+		Device device( "synthetic0", new SyntheticCaptureBackend() );
+
+	The frame sizes and rates must be configured before the Device gets created, as this is 
+	when the capture settings are enumerated. The pattern and the free-running mode can be 
+	changed at any time.
+*/
+class SyntheticCaptureBackend : public EmulatedCaptureBackend
+{
+public:
+	enum Pattern
+	{
+		MovingBarsPattern,			// Vertical color bars moving by a few pixels each frame
+		NoisePattern,				// Random bytes
+		CounterPattern				// Sequence number as 32 black or white blocks over a gray background, most significant bit first
+	};
+
+	SyntheticCaptureBackend( Pattern pattern=MovingBarsPattern );
+	virtual ~SyntheticCaptureBackend();
+
+	void						setPattern( Pattern pattern )			{ mPattern = pattern; }
+	Pattern						getPattern() const						{ return mPattern; }
+
+	void						clearFrameSizes()						{ mFrameSizes.clear(); }
+	void						addFrameSize( unsigned int width, unsigned int height );
+	void						clearFrameRates()						{ mFrameRates.clear(); }
+	void						addFrameRate( unsigned int frameRateInHz );
+
+protected:
+	virtual bool				openSource( const std::string& deviceName );
+	virtual void				generateFrame( unsigned char* data, uint32_t sequenceNumber );
+
+private:
+	void						renderRows( unsigned char* data, unsigned int y0, unsigned int y1, const unsigned char* rgbRow );
+	void						renderNoise( unsigned char* data, std::size_t size );
+
+	std::atomic<Pattern>		mPattern;
+	uint64_t					mNoiseState;
+	std::vector<unsigned char>	mRGBRow;		// Scratch row used by the generator thread
+};
+
+}
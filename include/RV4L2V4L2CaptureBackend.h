@@ -0,0 +1,56 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#pragma once
+
+#include "RV4L2CaptureBackend.h"
+
+namespace RV4L2
+{
+
+/*
+	V4L2CaptureBackend
+
+	The backend of a V4L2 device node such as /dev/video0, opened in non-blocking mode.
+*/
+class V4L2CaptureBackend : public CaptureBackend
+{
+public:
+	V4L2CaptureBackend();
+	virtual ~V4L2CaptureBackend();
+
+	virtual bool				open( const std::string& deviceName );
+	virtual void				close();
+	virtual int					getHandle() const			{ return mHandle; }
+	virtual int					ioctl( unsigned long request, void* arg );
+	virtual void*				mmap( std::size_t length, off_t offset );
+	virtual int					munmap( void* start, std::size_t length );
+
+private:
+	V4L2CaptureBackend( const V4L2CaptureBackend& other );				// Not implemented on purpose
+	V4L2CaptureBackend& operator=( const V4L2CaptureBackend& other );	// Not implemented on purpose
+
+	int							mHandle;
+};
+
+}
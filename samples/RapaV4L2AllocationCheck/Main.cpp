@@ -0,0 +1,185 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include "RV4L2Device.h"
+#include "RV4L2SyntheticCaptureBackend.h"
+#include "RV4L2ImageConverter.h"
+#include "RV4L2FrameRing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <atomic>
+#include <thread>
+#include <unistd.h>
+
+/*
+	Checks that the per-frame capture path doesn't allocate once warmed up. Heap allocations 
+	are counted by replacing the global operator new, in every thread, while a free-running 
+	SyntheticCaptureBackend delivers images: dequeue, delivery to a synchronous and a queued 
+	listener, lease, FrameRing, conversion to RGB24 and re-queue. Each encoding is run in 
+	both delivery modes. The program fails if any allocation happens after the warm-up.
+
+	Usage: RapaV4L2AllocationCheck [numWarmUpFrames] [numCheckedFrames]
+*/
+
+static std::atomic<bool> gIsCounting(false);
+static std::atomic<unsigned long long> gNumAllocations(0);
+
+void* operator new( std::size_t size )
+{
+	if ( gIsCounting )
+		gNumAllocations++;
+	void* p = malloc( size>0 ? size : 1 );
+	if ( !p )
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[]( std::size_t size )
+{
+	return operator new( size );
+}
+
+void operator delete( void* p ) noexcept
+{
+	free( p );
+}
+
+void operator delete[]( void* p ) noexcept
+{
+	free( p );
+}
+
+class ConvertingListener : public RV4L2::Device::Listener
+{
+public:
+	ConvertingListener( const RV4L2::ImageFormat& imageFormat )
+		: mConverter( RV4L2::ImageFormat( imageFormat.getWidth(), imageFormat.getHeight(), RV4L2::ImageFormat::RGB24 ) ),
+		  mNumFrames(0),
+		  mNumFailures(0)
+	{
+	}
+	
+	virtual void onDeviceCapturedImage( RV4L2::Device* device )
+	{
+		RV4L2::FrameLease* frameLease = device->acquireFrameLease();
+		if ( !frameLease || !mConverter.update( frameLease->getCapturedImage().getImage() ) )
+			mNumFailures++;
+		if ( frameLease )
+			frameLease->release();
+		mNumFrames++;
+	}
+
+	unsigned long long getNumFrames() const		{ return mNumFrames; }
+	unsigned long long getNumFailures() const	{ return mNumFailures; }
+
+private:
+	RV4L2::ImageConverter				mConverter;
+	std::atomic<unsigned long long>		mNumFrames;
+	std::atomic<unsigned long long>		mNumFailures;
+};
+
+static void waitForFrames( const ConvertingListener& listener, unsigned long long numFrames )
+{
+	unsigned long long targetNumFrames = listener.getNumFrames() + numFrames;
+	while ( listener.getNumFrames()<targetNumFrames )
+		usleep( 1000 );
+}
+
+static void ringThreadMain( RV4L2::FrameRing* frameRing )
+{
+	RV4L2::FrameLease* frameLease = NULL;
+	while ( (frameLease = frameRing->pop())!=NULL )
+		frameLease->release();
+}
+
+int main( int argc, char** argv )
+{
+	unsigned long long numWarmUpFrames = 20;
+	unsigned long long numCheckedFrames = 200;
+	if ( argc>1 )
+		numWarmUpFrames = atoi(argv[1]);
+	if ( argc>2 )
+		numCheckedFrames = atoi(argv[2]);
+
+	RV4L2::SyntheticCaptureBackend* backend = new RV4L2::SyntheticCaptureBackend();
+	backend->setFreeRunning( true );
+	backend->clearFrameSizes();
+	backend->addFrameSize( 320, 240 );
+	RV4L2::Device device( "synthetic0", backend );
+	if ( !device.isValid() )
+	{
+		printf("Failed to create device\n");
+		return -1;
+	}
+	device.setUpdateMode( RV4L2::Device::ThreadedUpdate );
+	RV4L2::FrameRing frameRing( 2 );
+	device.setFrameRing( &frameRing );
+
+	bool success = true;
+	const RV4L2::CaptureSettingsList& captureSettingsList = device.getSupportedCaptureSettingsList();
+	for ( int copyDelivery=0; copyDelivery<2; ++copyDelivery )
+	{
+		device.setDeliveryMode( copyDelivery ? RV4L2::Device::CopyDelivery : RV4L2::Device::ZeroCopyDelivery );
+		for ( std::size_t i=0; i<captureSettingsList.size(); ++i )
+		{
+			const RV4L2::ImageFormat& imageFormat = captureSettingsList[i].getImageFormat();
+			ConvertingListener listener( imageFormat );
+			ConvertingListener queuedListener( imageFormat );
+			device.addListener( &listener );
+			device.addListener( &queuedListener, 2 );
+			if ( !device.startCapture( i ) )
+			{
+				printf("%-12s failed to start\n", imageFormat.getEncodingName() );
+				success = false;
+				continue;
+			}
+			std::thread ringThread( ringThreadMain, &frameRing );
+
+			waitForFrames( listener, numWarmUpFrames );
+			gNumAllocations = 0;
+			gIsCounting = true;
+			waitForFrames( listener, numCheckedFrames );
+			gIsCounting = false;
+			
+			device.stopCapture();
+			ringThread.join();
+			device.removeListener( &queuedListener );
+			device.removeListener( &listener );
+
+			unsigned long long numFailures = listener.getNumFailures() + queuedListener.getNumFailures();
+			printf("%-12s %-9s %4llu allocations over %llu frames, %llu failed conversions\n", 
+				imageFormat.getEncodingName(), 
+				copyDelivery ? "copy" : "zero-copy", 
+				gNumAllocations.load(),
+				numCheckedFrames,
+				numFailures );
+			if ( gNumAllocations>0 || numFailures>0 )
+				success = false;
+		}
+	}
+
+	printf("%s\n", success ? "No allocation on the capture path" : "FAILED");
+	return success ? 0 : 1;
+}
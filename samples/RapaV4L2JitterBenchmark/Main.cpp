@@ -0,0 +1,140 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include "RV4L2Device.h"
+#include "RV4L2SyntheticCaptureBackend.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <unistd.h>
+
+/*
+	Compares the stability of the capture path with the default thread settings and in 
+	real-time mode (capture thread pinned to a CPU, SCHED_FIFO priority, locked and prefaulted 
+	buffers). Busy threads can be started to load the host. For each run, the percentiles of 
+	the interval between two dequeued images are printed: the closer p99 stays to p50, the
+	less jitter. The device "synthetic" is a SyntheticCaptureBackend.
+
+	Usage: RapaV4L2JitterBenchmark [device] [settingsIndex] [durationInSec] [cpu] [priority] [numLoadThreads]
+*/
+
+static std::atomic<bool> gIsLoading(false);
+
+static void loadThreadMain()
+{
+	volatile unsigned long long counter = 0;
+	while ( gIsLoading )
+		counter++;
+}
+
+static void printResult( const char* name, const RV4L2::Device* device )
+{
+	const RV4L2::Histogram& histogram = device->getStatistics().getFrameIntervalHistogram();
+	printf("%-10s %6llu frames, interval p50 %7.3f ms p99 %7.3f ms p99.9 %7.3f ms max %7.3f ms, dropped %llu\n", 
+		name,
+		static_cast<unsigned long long>(histogram.getCount()+1),
+		histogram.getValueAtPercentile(50) / 1e6,
+		histogram.getValueAtPercentile(99) / 1e6,
+		histogram.getValueAtPercentile(99.9) / 1e6,
+		histogram.getMax() / 1e6,
+		static_cast<unsigned long long>(device->getNumDroppedFrames()) );
+}
+
+static bool runCapture( const char* name, RV4L2::Device* device, std::size_t settingsIndex, double durationInSec )
+{
+	if ( !device->startCapture( settingsIndex ) )
+	{
+		printf("Failed to start the capture\n");
+		return false;
+	}
+	usleep( static_cast<useconds_t>( durationInSec * 1000000.0 ) );
+	device->stopCapture();
+	printResult( name, device );
+	return true;
+}
+
+int main( int argc, char** argv )
+{
+	std::string deviceName = "/dev/video0";
+	if ( argc>1 )
+		deviceName = argv[1];
+	std::size_t settingsIndex = 0;
+	if ( argc>2 )
+		settingsIndex = atoi(argv[2]);
+	double durationInSec = 5.0;
+	if ( argc>3 )
+		durationInSec = atof(argv[3]);
+	unsigned int cpu = 0;
+	if ( argc>4 )
+		cpu = atoi(argv[4]);
+	int priority = 50;
+	if ( argc>5 )
+		priority = atoi(argv[5]);
+	unsigned int numLoadThreads = 0;
+	if ( argc>6 )
+		numLoadThreads = atoi(argv[6]);
+
+	RV4L2::Device* device = NULL;
+	if ( deviceName=="synthetic" )
+		device = new RV4L2::Device( deviceName.c_str(), new RV4L2::SyntheticCaptureBackend() );
+	else
+		device = new RV4L2::Device( deviceName.c_str() );
+	if ( !device->isValid() )
+	{
+		printf("Failed to create device\n");
+		return -1;
+	}
+	const RV4L2::CaptureSettingsList& captureSettingsList = device->getSupportedCaptureSettingsList();
+	if ( settingsIndex>=captureSettingsList.size() )
+	{
+		printf("Invalid capture settings index %d\n", static_cast<int>(settingsIndex) );
+		return -1;
+	}
+	printf("Capture settings: %s\n", captureSettingsList[settingsIndex].toString().c_str() );
+	device->setUpdateMode( RV4L2::Device::ThreadedUpdate );
+	device->setDeliveryMode( RV4L2::Device::CopyDelivery );
+
+	std::vector<std::thread> loadThreads;
+	gIsLoading = true;
+	for ( unsigned int i=0; i<numLoadThreads; ++i )
+		loadThreads.push_back( std::thread( loadThreadMain ) );
+	printf("%u load threads\n", numLoadThreads );
+
+	if ( runCapture( "default", device, settingsIndex, durationInSec ) )
+	{
+		device->setCaptureThreadCpus( std::vector<unsigned int>( 1, cpu ) );
+		device->setCaptureThreadPriority( priority );
+		device->setMemoryLockingEnabled( true );
+		runCapture( "real-time", device, settingsIndex, durationInSec );
+	}
+
+	gIsLoading = false;
+	for ( std::size_t i=0; i<loadThreads.size(); ++i )
+		loadThreads[i].join();
+	delete device;
+	return 0;
+}
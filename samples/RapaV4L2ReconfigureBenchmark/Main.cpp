@@ -0,0 +1,163 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include "RV4L2Device.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <time.h>
+#include <unistd.h>
+
+/*
+	Compares the time taken to switch a running capture between two capture settings with 
+	stopCapture()/startCapture() and with reconfigure(). Both the duration of the switch 
+	itself and the time until the first image of the new settings is received are measured.
+
+	Usage: RapaV4L2ReconfigureBenchmark [device] [settingsIndexA] [settingsIndexB] [numSwitches]
+*/
+
+static double getTimeInMs()
+{
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return static_cast<double>(now.tv_sec) * 1000.0 + static_cast<double>(now.tv_nsec) / 1000000.0;
+}
+
+// Poll the device until it delivers an image, giving up after a second
+static bool waitForImage( RV4L2::Device* device )
+{
+	double startTime = getTimeInMs();
+	while ( getTimeInMs()-startTime<1000.0 )
+	{
+		if ( device->update()>0 )
+			return true;
+		usleep( 500 );
+	}
+	return false;
+}
+
+struct Timings
+{
+	Timings() : numSwitches(0), totalSwitchTimeInMs(0), maxSwitchTimeInMs(0), totalFirstImageTimeInMs(0), maxFirstImageTimeInMs(0) {}
+	
+	void add( double switchTimeInMs, double firstImageTimeInMs )
+	{
+		numSwitches++;
+		totalSwitchTimeInMs += switchTimeInMs;
+		totalFirstImageTimeInMs += firstImageTimeInMs;
+		if ( switchTimeInMs>maxSwitchTimeInMs )
+			maxSwitchTimeInMs = switchTimeInMs;
+		if ( firstImageTimeInMs>maxFirstImageTimeInMs )
+			maxFirstImageTimeInMs = firstImageTimeInMs;
+	}
+
+	void print( const char* name ) const
+	{
+		if ( numSwitches==0 )
+		{
+			printf("%-24s no successful switch\n", name );
+			return;
+		}
+		printf("%-24s switch: mean %7.2f ms max %7.2f ms | first image: mean %7.2f ms max %7.2f ms\n", name,
+			totalSwitchTimeInMs/numSwitches, maxSwitchTimeInMs, totalFirstImageTimeInMs/numSwitches, maxFirstImageTimeInMs );
+	}
+
+	unsigned int	numSwitches;
+	double			totalSwitchTimeInMs;
+	double			maxSwitchTimeInMs;
+	double			totalFirstImageTimeInMs;
+	double			maxFirstImageTimeInMs;
+};
+
+int main( int argc, char** argv )
+{
+	std::string deviceName = "/dev/video0";
+	if ( argc>1 )
+		deviceName = argv[1];
+	std::size_t settingsIndices[2] = { 0, 1 };
+	if ( argc>2 )
+		settingsIndices[0] = atoi(argv[2]);
+	if ( argc>3 )
+		settingsIndices[1] = atoi(argv[3]);
+	unsigned int numSwitches = 20;
+	if ( argc>4 )
+		numSwitches = atoi(argv[4]);
+
+	RV4L2::Device* device = new RV4L2::Device( deviceName.c_str() );
+	if ( !device->isValid() )
+	{
+		printf("Failed to create device\n");
+		return -1;
+	}
+	const RV4L2::CaptureSettingsList& captureSettingsList = device->getSupportedCaptureSettingsList();
+	for ( int i=0; i<2; ++i )
+	{
+		if ( settingsIndices[i]>=captureSettingsList.size() )
+		{
+			printf("Invalid capture settings index %d\n", static_cast<int>(settingsIndices[i]) );
+			return -1;
+		}
+		printf("Capture settings %c: %s\n", 'A'+i, captureSettingsList[settingsIndices[i]].toString().c_str() );
+	}
+
+	// Stop and start cycle
+	Timings restartTimings;
+	if ( device->startCapture( settingsIndices[0] ) && waitForImage( device ) )
+	{
+		for ( unsigned int i=0; i<numSwitches; ++i )
+		{
+			double startTime = getTimeInMs();
+			if ( !device->stopCapture() || !device->startCapture( settingsIndices[(i+1)%2] ) )
+				break;
+			double switchTime = getTimeInMs();
+			if ( !waitForImage( device ) )
+				break;
+			restartTimings.add( switchTime-startTime, getTimeInMs()-startTime );
+		}
+	}
+	device->stopCapture();
+
+	// Reconfiguration
+	Timings reconfigureTimings;
+	if ( device->startCapture( settingsIndices[0] ) && waitForImage( device ) )
+	{
+		for ( unsigned int i=0; i<numSwitches; ++i )
+		{
+			double startTime = getTimeInMs();
+			if ( !device->reconfigure( settingsIndices[(i+1)%2] ) )
+				break;
+			double switchTime = getTimeInMs();
+			if ( !waitForImage( device ) )
+				break;
+			reconfigureTimings.add( switchTime-startTime, getTimeInMs()-startTime );
+		}
+	}
+	device->stopCapture();
+
+	restartTimings.print( "stopCapture/startCapture" );
+	reconfigureTimings.print( "reconfigure" );
+
+	delete device;
+	return 0;
+}
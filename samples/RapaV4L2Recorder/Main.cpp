@@ -0,0 +1,124 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include "RV4L2Device.h"
+#include "RV4L2SyntheticCaptureBackend.h"
+#include "RV4L2FrameRecorder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <time.h>
+#include <unistd.h>
+
+/*
+	Records the raw images of a device to segment files and reports the throughput reached.
+	The device "synthetic" is a free-running SyntheticCaptureBackend, giving the highest 
+	rate the recorder and the disk can sustain.
+
+	Usage: RapaV4L2Recorder directory [device] [settingsIndex] [durationInSec]
+*/
+
+static double getTimeInSec()
+{
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return static_cast<double>(now.tv_sec) + static_cast<double>(now.tv_nsec) / 1000000000.0;
+}
+
+int main( int argc, char** argv )
+{
+	if ( argc<2 )
+	{
+		printf("Usage: %s directory [device] [settingsIndex] [durationInSec]\n", argv[0] );
+		return -1;
+	}
+	std::string directory = argv[1];
+	std::string deviceName = "/dev/video0";
+	if ( argc>2 )
+		deviceName = argv[2];
+	std::size_t settingsIndex = 0;
+	if ( argc>3 )
+		settingsIndex = atoi(argv[3]);
+	double durationInSec = 5.0;
+	if ( argc>4 )
+		durationInSec = atof(argv[4]);
+
+	RV4L2::Device* device = NULL;
+	if ( deviceName=="synthetic" )
+	{
+		RV4L2::SyntheticCaptureBackend* backend = new RV4L2::SyntheticCaptureBackend();
+		backend->setFreeRunning( true );
+		device = new RV4L2::Device( deviceName.c_str(), backend );
+	}
+	else
+	{
+		device = new RV4L2::Device( deviceName.c_str() );
+	}
+	if ( !device->isValid() )
+	{
+		printf("Failed to create device\n");
+		return -1;
+	}
+	const RV4L2::CaptureSettingsList& captureSettingsList = device->getSupportedCaptureSettingsList();
+	if ( settingsIndex>=captureSettingsList.size() )
+	{
+		printf("Invalid capture settings index %d\n", static_cast<int>(settingsIndex) );
+		return -1;
+	}
+	const RV4L2::CaptureSettings& captureSettings = captureSettingsList[settingsIndex];
+	printf("Capture settings: %s\n", captureSettings.toString().c_str() );
+
+	RV4L2::FrameRecorder recorder( directory.c_str() );
+	if ( !recorder.start( captureSettings.getImageFormat() ) )
+	{
+		printf("Failed to start the recorder\n");
+		return -1;
+	}
+	printf("Recording to %s (%s)\n", recorder.getSegmentFileName(0).c_str(), recorder.isUsingDirectIO() ? "direct I/O" : "buffered I/O" );
+
+	device->setUpdateMode( RV4L2::Device::ThreadedUpdate );
+	device->addListener( &recorder );
+	double startTime = getTimeInSec();
+	if ( !device->startCapture( settingsIndex ) )
+	{
+		printf("Failed to start the capture\n");
+		return -1;
+	}
+	usleep( static_cast<useconds_t>( durationInSec * 1000000.0 ) );
+	device->stopCapture();
+	recorder.stop();
+	double elapsedTimeInSec = getTimeInSec()-startTime;
+
+	printf("Recorded %llu frames (%.1f fps, %.1f MB/s) in %u segments with %s, dropped %llu\n", 
+		static_cast<unsigned long long>(recorder.getNumRecordedFrames()),
+		static_cast<double>(recorder.getNumRecordedFrames()) / elapsedTimeInSec,
+		static_cast<double>(recorder.getNumRecordedBytes()) / elapsedTimeInSec / (1024.0*1024.0),
+		recorder.getNumSegments(),
+		recorder.isUsingDirectIO() ? "direct I/O" : "buffered I/O",
+		static_cast<unsigned long long>(recorder.getNumDroppedFrames()) );
+
+	device->removeListener( &recorder );
+	delete device;
+	return 0;
+}
@@ -32,13 +32,15 @@
 
 #include "RV4L2ImageConverter.h"
 #include "RV4L2ImageWriter.h"
+#include "RV4L2ImagePool.h"
 
 class MyListener : public RV4L2::Device::Listener
 {
 public:
 	MyListener()
 		: mImageFormat(),
-		  mImageIndex(0),
+		  mNumImagesToSave(0),
+		  mImagePool(),
 		  mImages()
 	{
 	}
@@ -48,34 +50,36 @@ public:
 		clearImages();
 	}
 
+	// The kept images go back to the pool
 	void clearImages()
 	{
-		for ( std::size_t i=0; i<mImages.size(); ++i )
-			delete mImages[i];		
 		mImages.clear();
-		mImageIndex = 0;
 	}
 
 	void prepareImages( std::size_t numImagesToSave, RV4L2::ImageFormat format )
 	{
 		clearImages();
 		mImageFormat = format;
-		mImages.resize( numImagesToSave );
-		for ( std::size_t i=0; i<mImages.size(); ++i )
-			mImages[i] = new RV4L2::Image( format );
+		mNumImagesToSave = numImagesToSave;
+		mImages.reserve( numImagesToSave );
 	}
 
 	virtual void onDeviceStarted( RV4L2::Device* device )
 	{
 		printf("%s - capture started\n", device->getDeviceName().c_str() );
-		mImageIndex = 0;
+		clearImages();
 	}
 		
+	virtual void onDeviceDroppedFrames( RV4L2::Device* device, unsigned int numDroppedFrames )
+	{
+		printf("%s - %u frame(s) dropped\n", device->getDeviceName().c_str(), numDroppedFrames );
+	}
+
 	virtual void onDeviceCapturedImage( RV4L2::Device* device ) 
 	{
 		const RV4L2::CapturedImage* capturedImage = device->getCapturedImage();
 		assert( capturedImage );
-		printf("%s - image captured #%d at %f sec\n", device->getDeviceName().c_str(), capturedImage->getSequenceNumber(), capturedImage->getTimestampInSec() );
+		printf("%s - image captured #%u at %f sec\n", device->getDeviceName().c_str(), capturedImage->getSequenceNumber(), capturedImage->getTimestampInSec() );
 
 		/*unsigned int n = capturedImage->getImage().getBuffer().getSizeInBytes();
 		const unsigned char* p = capturedImage->getImage().getBuffer().getBytes();
@@ -89,12 +93,8 @@ public:
 			printf("prout!\n");
 		*/
 		
-		if ( mImageIndex<mImages.size() )
-		{
-			bool ret = mImages[mImageIndex]->getBuffer().copyFrom( capturedImage->getImage().getBuffer() );
-			assert( ret );
-			mImageIndex++;		
-		}
+		if ( mImages.size()<mNumImagesToSave )
+			mImages.push_back( mImagePool.acquireCopy( *capturedImage ) );
 	}
 
 	virtual void onDeviceStopped( RV4L2::Device* device ) 
@@ -110,7 +110,7 @@ public:
 		{
 			std::stringstream stream;
 			stream << devNum << "_" << i << ".ppm";
-			bool ret = converter.update( *mImages[i] );
+			bool ret = converter.update( mImages[i].getImage() );
 			assert( ret );
 			ret = RV4L2::ImageWriter::writeBinaryPPMImage( stream.str().c_str(), converter.getImage() );
 			assert( ret );
@@ -122,8 +122,9 @@ public:
 
 private:
 	RV4L2::ImageFormat mImageFormat;
-	std::size_t mImageIndex;
-	std::vector<RV4L2::Image*> mImages;
+	std::size_t mNumImagesToSave;
+	RV4L2::ImagePool mImagePool;
+	std::vector<RV4L2::ImagePool::Handle> mImages;
 };
 
 int main( int argc, char** argv )
@@ -137,6 +138,10 @@ int main( int argc, char** argv )
     if ( argc>2 )
         captureSettingsIndex = atoi(argv[2]);
 
+    unsigned int bufferCount = RV4L2::Device::DefaultBufferCount;
+    if ( argc>3 )
+        bufferCount = atoi(argv[3]);
+
     std::size_t numImagesToCaptures = 1;
 	
 	printf("Creating device\n");
@@ -146,6 +151,7 @@ int main( int argc, char** argv )
 		printf("Failed to create device\n");
 		return -1;
 	}
+	device->setUpdateMode( RV4L2::Device::ThreadedUpdate );
 	
 	printf("Supported capture settings for devices '%s':\n", device->getDeviceName().c_str());
 	const RV4L2::CaptureSettingsList& captureSettingsList = device->getSupportedCaptureSettingsList();
@@ -153,27 +159,26 @@ int main( int argc, char** argv )
         printf("\t%d - %s\n", static_cast<int>(i), captureSettingsList[i].toString().c_str() );
 	
     printf("Starting capture #%d...\n", static_cast<int>(captureSettingsIndex));
-	device->startCapture( captureSettingsIndex );
+	device->startCapture( captureSettingsIndex, bufferCount );
 	const RV4L2::CaptureSettings& captureSettings = captureSettingsList[captureSettingsIndex];
 	
 	printf("Warming up...\n");
-	for ( int k=0; k<10; ++k ) 
-	{
-		device->update();
-		usleep(15 * 1000);
-	}
+	usleep(150 * 1000);
 	
 	MyListener* listener = new MyListener();
 	listener->prepareImages( numImagesToCaptures, captureSettings.getImageFormat() );
 	device->addListener( listener );
 	
 	printf("Running a bit...\n");
-	for ( int k=0; k<40; ++k ) 
-	{
-		device->update();
-		usleep(15 * 1000);
-	}
+	usleep(600 * 1000);
 	
+	const RV4L2::CaptureStatistics& statistics = device->getStatistics();
+	printf("Delivered %llu frames, dropped %llu, latency p50 %.2f ms p99 %.2f ms\n", 
+		static_cast<unsigned long long>(statistics.getNumDeliveredFrames()),
+		static_cast<unsigned long long>(statistics.getNumDroppedFrames()),
+		statistics.getDeliveryLatencyHistogram().getValueAtPercentile(50) / 1e6,
+		statistics.getDeliveryLatencyHistogram().getValueAtPercentile(99) / 1e6 );
+
 	printf("Stopping capture...\n");
 	device->stopCapture();
 
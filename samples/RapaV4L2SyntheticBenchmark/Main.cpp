@@ -0,0 +1,116 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include "RV4L2Device.h"
+#include "RV4L2SyntheticCaptureBackend.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+	Measures the capture path without any camera: a Device fed by a SyntheticCaptureBackend
+	delivers moving bars in each encoding, first at the frame rate then free-running (as fast 
+	as buffers are given back). The delivery rate, the drops and the latencies are printed, 
+	so that regressions can be spotted on any machine.
+
+	Usage: RapaV4L2SyntheticBenchmark [width] [height] [frameRateInHz] [durationInSec]
+*/
+
+static double getTimeInSec()
+{
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return static_cast<double>(now.tv_sec) + static_cast<double>(now.tv_nsec) / 1000000000.0;
+}
+
+static void printResult( const char* name, const RV4L2::Device* device, double durationInSec )
+{
+	const RV4L2::CaptureStatistics& statistics = device->getStatistics();
+	printf("%-12s %9.1f fps, dropped %6llu, latency p50 %8.3f ms p99 %8.3f ms, hold time p99 %8.3f ms\n", 
+		name, 
+		static_cast<double>(statistics.getNumDeliveredFrames()) / durationInSec,
+		static_cast<unsigned long long>(statistics.getNumDroppedFrames()),
+		statistics.getDeliveryLatencyHistogram().getValueAtPercentile(50) / 1e6,
+		statistics.getDeliveryLatencyHistogram().getValueAtPercentile(99) / 1e6,
+		statistics.getBufferHoldTimeHistogram().getValueAtPercentile(99) / 1e6 );
+}
+
+int main( int argc, char** argv )
+{
+	unsigned int width = 640;
+	unsigned int height = 480;
+	unsigned int frameRateInHz = 60;
+	double durationInSec = 2.0;
+	if ( argc>1 )
+		width = atoi(argv[1]);
+	if ( argc>2 )
+		height = atoi(argv[2]);
+	if ( argc>3 )
+		frameRateInHz = atoi(argv[3]);
+	if ( argc>4 )
+		durationInSec = atof(argv[4]);
+
+	RV4L2::SyntheticCaptureBackend* backend = new RV4L2::SyntheticCaptureBackend();
+	backend->clearFrameSizes();
+	backend->addFrameSize( width, height );
+	backend->clearFrameRates();
+	backend->addFrameRate( frameRateInHz );
+	RV4L2::Device* device = new RV4L2::Device( "synthetic0", backend );
+	if ( !device->isValid() )
+	{
+		printf("Failed to create device\n");
+		return -1;
+	}
+	device->setUpdateMode( RV4L2::Device::ThreadedUpdate );
+
+	// Images nobody takes go straight back to the driver, a listener is needed for them to be delivered
+	RV4L2::Device::Listener listener;
+	device->addListener( &listener );
+
+	const RV4L2::CaptureSettingsList& captureSettingsList = device->getSupportedCaptureSettingsList();
+	for ( int freeRunning=0; freeRunning<2; ++freeRunning )
+	{
+		backend->setFreeRunning( freeRunning!=0 );
+		printf("%s, %dx%d\n", freeRunning ? "Free-running" : "Paced", width, height );
+		for ( std::size_t i=0; i<captureSettingsList.size(); ++i )
+		{
+			const RV4L2::ImageFormat& imageFormat = captureSettingsList[i].getImageFormat();
+			device->resetStatistics();
+			double startTime = getTimeInSec();
+			if ( !device->startCapture( i ) )
+			{
+				printf("%-12s failed to start\n", imageFormat.getEncodingName() );
+				continue;
+			}
+			usleep( static_cast<useconds_t>( durationInSec * 1000000.0 ) );
+			printResult( imageFormat.getEncodingName(), device, getTimeInSec()-startTime );
+			device->stopCapture();
+		}
+	}
+
+	device->removeListener( &listener );
+	delete device;
+	return 0;
+}
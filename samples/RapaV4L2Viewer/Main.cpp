@@ -45,6 +45,9 @@ int main(int argc, char *argv[])
 		deviceName = argv[1];
 
     RV4L2::Device* device = new RV4L2::Device( deviceName.c_str() );
+    // The widget saves the last captured image outside of any notification (F1), which is only
+    // valid when the Device owns a copy of it
+    device->setDeliveryMode( RV4L2::Device::CopyDelivery );
 
     RV4L2::QDeviceUpdater* deviceUpdater = new RV4L2::QDeviceUpdater(device, 2, NULL);
     deviceUpdater->start();
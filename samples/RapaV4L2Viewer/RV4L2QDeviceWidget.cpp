@@ -77,18 +77,17 @@ QDeviceWidget::~QDeviceWidget()
 	mDevice->removeListener( this );
 }
 
+// Starting or stopping a camera can take hundreds of milliseconds, it is done asynchronously
+// and the widget gets updated once the device reports completion
 void QDeviceWidget::startStopButtonPressed()
 {
+	if ( mDevice->isCaptureOperationPending() )
+		return;
+
 	if ( mDevice->isCapturing() )
 	{
-		QApplication::setOverrideCursor(Qt::WaitCursor);
-		QApplication::processEvents();
-		mDevice->stopCapture();
-		QApplication::restoreOverrideCursor();
-		mImageNumberLabel->setText("0");
-		mStartStopButton->setText( "Start" );
-		mCaptureSettingsCombo->setEnabled(true);
-		mImageWidget->setImage( Image() );
+		mStartStopButton->setEnabled(false);
+		mDevice->stopCaptureAsync();
 	}
 	else
 	{
@@ -96,18 +95,53 @@ void QDeviceWidget::startStopButtonPressed()
         const RV4L2::CaptureSettingsList& settingsList = mDevice->getSupportedCaptureSettingsList();
 		if ( index>=0 && index<static_cast<int>(settingsList.size()) )
 		{
-			mStartStopButton->setText( "Stop" );
-			QApplication::setOverrideCursor(Qt::WaitCursor);
-			QApplication::processEvents();
-			if ( mDevice->startCapture( index ) )
-				mCaptureSettingsCombo->setEnabled(false);
-			else
-				mStartStopButton->setText( "Start" );
-			QApplication::restoreOverrideCursor();
+			mStartStopButton->setEnabled(false);
+			mCaptureSettingsCombo->setEnabled(false);
+			if ( !mDevice->startCaptureAsync( index ) )
+				captureStartFailed();
 		}
 	}	
 }
 
+void QDeviceWidget::captureStarted()
+{
+	mStartStopButton->setText( "Stop" );
+	mStartStopButton->setEnabled(true);
+	mCaptureSettingsCombo->setEnabled(false);
+}
+
+void QDeviceWidget::captureStartFailed()
+{
+	mStartStopButton->setText( "Start" );
+	mStartStopButton->setEnabled(true);
+	mCaptureSettingsCombo->setEnabled(true);
+}
+
+void QDeviceWidget::captureStopped()
+{
+	mImageNumberLabel->setText("0");
+	mStartStopButton->setText( "Start" );
+	mStartStopButton->setEnabled(true);
+	mCaptureSettingsCombo->setEnabled(true);
+	mImageWidget->setImage( Image() );
+}
+
+// The following notifications come from the device worker thread, they are forwarded to the GUI thread
+void QDeviceWidget::onDeviceStarted( Device* /*device*/ )
+{
+	QMetaObject::invokeMethod( this, "captureStarted", Qt::QueuedConnection );
+}
+
+void QDeviceWidget::onDeviceStartFailed( Device* /*device*/ )
+{
+	QMetaObject::invokeMethod( this, "captureStartFailed", Qt::QueuedConnection );
+}
+
+void QDeviceWidget::onDeviceStopped( Device* /*device*/ )
+{
+	QMetaObject::invokeMethod( this, "captureStopped", Qt::QueuedConnection );
+}
+
 void QDeviceWidget::onDeviceCapturedImage( Device* device )
 {
 	assert( device==mDevice );
@@ -59,10 +59,16 @@ public:
 	RV4L2::Device*			getDevice() const { return mDevice; }
 
 protected:
+    virtual void			onDeviceStarted( Device* /*device*/ );
+    virtual void			onDeviceStartFailed( Device* /*device*/ );
     virtual void			onDeviceCapturedImage( Device* /*device*/ );
+    virtual void			onDeviceStopped( Device* /*device*/ );
 	
 private slots:
     void					startStopButtonPressed();
+    void					captureStarted();
+    void					captureStartFailed();
+    void					captureStopped();
     virtual void			keyPressEvent( QKeyEvent* event );
 
 private:
@@ -0,0 +1,388 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include "RV4L2CaptureManager.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+
+namespace RV4L2
+{
+
+/*
+	CaptureManager::DeviceStatistics
+*/
+CaptureManager::DeviceStatistics::DeviceStatistics()
+	:	numWakeUps(0),
+		numEmptyWakeUps(0),
+		numDeliveredImages(0)
+{
+}
+
+/*
+	CaptureManager::DeviceEntry
+*/
+CaptureManager::DeviceEntry::DeviceEntry( Device* device )
+	:	device(device),
+		deviceMonitor(NULL),
+		isWatched(false),
+		isBusy(false),
+		isRemoved(false),
+		numWakeUps(0),
+		numEmptyWakeUps(0),
+		numDeliveredImages(0)
+{
+}
+
+CaptureManager::DeviceEntry::DeviceEntry( DeviceMonitor* deviceMonitor )
+	:	device(NULL),
+		deviceMonitor(deviceMonitor),
+		isWatched(false),
+		isBusy(false),
+		isRemoved(false),
+		numWakeUps(0),
+		numEmptyWakeUps(0),
+		numDeliveredImages(0)
+{
+}
+
+int CaptureManager::DeviceEntry::getHandle() const
+{
+	return device ? device->getHandle() : deviceMonitor->getHandle();
+}
+
+/*
+	CaptureManager
+*/
+CaptureManager::CaptureManager()
+	:	mEpollHandle(-1),
+		mWakeUpHandle(-1),
+		mDeviceEntries(),
+		mDeviceMonitorEntries(),
+		mRemovedDeviceEntries(),
+		mDeviceEntriesMutex(),
+		mThreads()
+{
+	mEpollHandle = epoll_create1( EPOLL_CLOEXEC );
+	mWakeUpHandle = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+	if ( mEpollHandle==-1 || mWakeUpHandle==-1 )
+	{
+		fprintf( stderr, "Failed to create the capture manager event handles. %s (%d)\n", strerror(errno), errno );
+		return;
+	}
+
+	// The wake-up handle is the only one registered without a DeviceEntry
+	struct epoll_event event;
+	CLEAR(event);
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	if ( epoll_ctl( mEpollHandle, EPOLL_CTL_ADD, mWakeUpHandle, &event )==-1 )
+		fprintf( stderr, "Failed to watch the capture manager wake-up handle. %s (%d)\n", strerror(errno), errno );
+}
+
+CaptureManager::~CaptureManager()
+{
+	stop();
+
+	while ( !mDeviceEntries.empty() )
+		removeDevice( mDeviceEntries.back()->device );
+	while ( !mDeviceMonitorEntries.empty() )
+		removeDeviceMonitor( mDeviceMonitorEntries.back()->deviceMonitor );
+	for ( std::size_t i=0; i<mRemovedDeviceEntries.size(); ++i )
+		delete mRemovedDeviceEntries[i];
+	mRemovedDeviceEntries.clear();
+
+	if ( mWakeUpHandle!=-1 )
+		close( mWakeUpHandle );
+	if ( mEpollHandle!=-1 )
+		close( mEpollHandle );
+}
+
+// Only devices in ManualUpdate mode can be managed
+bool CaptureManager::addDevice( Device* device )
+{
+	if ( !device || !device->isValid() || device->getUpdateMode()!=Device::ManualUpdate )
+		return false;
+
+	DeviceEntry* deviceEntry = NULL;
+	{
+		std::lock_guard<std::mutex> lock( mDeviceEntriesMutex );
+		if ( findDeviceEntry( device ) )
+			return false;
+		deviceEntry = new DeviceEntry( device );
+		mDeviceEntries.push_back( deviceEntry );
+	}
+
+	// From now on, we're notified when the capture starts or stops
+	device->addListener( this );
+	if ( device->isCapturing() )
+		watchDevice( deviceEntry );
+	return true;
+}
+
+bool CaptureManager::removeDevice( Device* device )
+{
+	DeviceEntry* deviceEntry = NULL;
+	{
+		std::lock_guard<std::mutex> lock( mDeviceEntriesMutex );
+		DeviceEntries::iterator itr = mDeviceEntries.begin();
+		while ( itr!=mDeviceEntries.end() && (*itr)->device!=device )
+			++itr;
+		if ( itr==mDeviceEntries.end() )
+			return false;
+		deviceEntry = *itr;
+		mDeviceEntries.erase( itr );
+		mRemovedDeviceEntries.push_back( deviceEntry );
+	}
+
+	device->removeListener( this );
+	removeDeviceEntry( deviceEntry );
+	return true;
+}
+
+// The monitor is watched right away, whether the manager threads are running or not
+bool CaptureManager::addDeviceMonitor( DeviceMonitor* deviceMonitor )
+{
+	if ( !deviceMonitor || !deviceMonitor->isValid() )
+		return false;
+
+	DeviceEntry* deviceEntry = NULL;
+	{
+		std::lock_guard<std::mutex> lock( mDeviceEntriesMutex );
+		for ( std::size_t i=0; i<mDeviceMonitorEntries.size(); ++i )
+			if ( mDeviceMonitorEntries[i]->deviceMonitor==deviceMonitor )
+				return false;
+		deviceEntry = new DeviceEntry( deviceMonitor );
+		mDeviceMonitorEntries.push_back( deviceEntry );
+	}
+	return watchDevice( deviceEntry );
+}
+
+bool CaptureManager::removeDeviceMonitor( DeviceMonitor* deviceMonitor )
+{
+	DeviceEntry* deviceEntry = NULL;
+	{
+		std::lock_guard<std::mutex> lock( mDeviceEntriesMutex );
+		DeviceEntries::iterator itr = mDeviceMonitorEntries.begin();
+		while ( itr!=mDeviceMonitorEntries.end() && (*itr)->deviceMonitor!=deviceMonitor )
+			++itr;
+		if ( itr==mDeviceMonitorEntries.end() )
+			return false;
+		deviceEntry = *itr;
+		mDeviceMonitorEntries.erase( itr );
+		mRemovedDeviceEntries.push_back( deviceEntry );
+	}
+
+	removeDeviceEntry( deviceEntry );
+	return true;
+}
+
+// The entry must already be in mRemovedDeviceEntries
+void CaptureManager::removeDeviceEntry( DeviceEntry* deviceEntry )
+{
+	unwatchDevice( deviceEntry );
+
+	// A thread may have picked the entry up just before it was unwatched. Either 
+	// it sees the removal flag and leaves it alone, or we wait for it
+	deviceEntry->isRemoved = true;
+	while ( deviceEntry->isBusy )
+		std::this_thread::yield();
+}
+
+std::size_t CaptureManager::getNumDevices() const
+{
+	std::lock_guard<std::mutex> lock( mDeviceEntriesMutex );
+	return mDeviceEntries.size();
+}
+
+// Must be called with mDeviceEntriesMutex locked
+CaptureManager::DeviceEntry* CaptureManager::findDeviceEntry( const Device* device ) const
+{
+	for ( std::size_t i=0; i<mDeviceEntries.size(); ++i )
+		if ( mDeviceEntries[i]->device==device )
+			return mDeviceEntries[i];
+	return NULL;
+}
+
+bool CaptureManager::getDeviceStatistics( const Device* device, DeviceStatistics& statistics ) const
+{
+	std::lock_guard<std::mutex> lock( mDeviceEntriesMutex );
+	const DeviceEntry* deviceEntry = findDeviceEntry( device );
+	if ( !deviceEntry )
+		return false;
+	statistics.numWakeUps = deviceEntry->numWakeUps;
+	statistics.numEmptyWakeUps = deviceEntry->numEmptyWakeUps;
+	statistics.numDeliveredImages = deviceEntry->numDeliveredImages;
+	return true;
+}
+
+// Each device is watched in one-shot mode so that a single thread handles it at a time.
+// The thread re-arms it once done
+bool CaptureManager::watchDevice( DeviceEntry* deviceEntry )
+{
+	if ( deviceEntry->isWatched.exchange( true ) )
+		return true;
+
+	struct epoll_event event;
+	CLEAR(event);
+	event.events = EPOLLIN | EPOLLONESHOT;
+	event.data.ptr = deviceEntry;
+	if ( epoll_ctl( mEpollHandle, EPOLL_CTL_ADD, deviceEntry->getHandle(), &event )==-1 )
+	{
+		if ( deviceEntry->device )
+			fprintf( stderr, "Failed to watch device %s. %s (%d)\n", deviceEntry->device->getDeviceName().c_str(), strerror(errno), errno );
+		else
+			fprintf( stderr, "Failed to watch device monitor of %s. %s (%d)\n", deviceEntry->deviceMonitor->getDirectory().c_str(), strerror(errno), errno );
+		deviceEntry->isWatched = false;
+		return false;
+	}
+	return true;
+}
+
+void CaptureManager::unwatchDevice( DeviceEntry* deviceEntry )
+{
+	if ( !deviceEntry->isWatched.exchange( false ) )
+		return;
+	epoll_ctl( mEpollHandle, EPOLL_CTL_DEL, deviceEntry->getHandle(), NULL );
+}
+
+void CaptureManager::onDeviceStarted( Device* device )
+{
+	DeviceEntry* deviceEntry = NULL;
+	{
+		std::lock_guard<std::mutex> lock( mDeviceEntriesMutex );
+		deviceEntry = findDeviceEntry( device );
+	}
+	if ( deviceEntry )
+		watchDevice( deviceEntry );
+}
+
+void CaptureManager::onDeviceStopped( Device* device )
+{
+	DeviceEntry* deviceEntry = NULL;
+	{
+		std::lock_guard<std::mutex> lock( mDeviceEntriesMutex );
+		deviceEntry = findDeviceEntry( device );
+	}
+	if ( deviceEntry )
+		unwatchDevice( deviceEntry );
+}
+
+bool CaptureManager::start( unsigned int numThreads )
+{
+	if ( isRunning() || mEpollHandle==-1 || mWakeUpHandle==-1 || numThreads==0 )
+		return false;
+	
+	for ( unsigned int i=0; i<numThreads; ++i )
+		mThreads.push_back( std::thread( &CaptureManager::threadMain, this ) );
+	return true;
+}
+
+void CaptureManager::stop()
+{
+	if ( !isRunning() )
+		return;
+
+	// The wake-up handle stays readable until reset, so every thread sees it
+	uint64_t value = 1;
+	if ( write( mWakeUpHandle, &value, sizeof(value) )!=sizeof(value) )
+		fprintf( stderr, "Failed to wake up the capture manager threads\n" );
+	for ( std::size_t i=0; i<mThreads.size(); ++i )
+		mThreads[i].join();
+	mThreads.clear();
+	if ( read( mWakeUpHandle, &value, sizeof(value) )!=sizeof(value) )
+		fprintf( stderr, "Failed to reset the capture manager wake-up handle\n" );
+}
+
+void CaptureManager::threadMain()
+{
+	bool isStopping = false;
+	while ( !isStopping )
+	{
+		struct epoll_event events[mMaxEventsPerWait];
+		int numEvents = epoll_wait( mEpollHandle, events, mMaxEventsPerWait, -1 );
+		if ( numEvents==-1 )
+		{
+			if ( errno==EINTR )
+				continue;
+			fprintf( stderr, "epoll_wait failed for the capture manager. %s (%d)\n", strerror(errno), errno );
+			return;
+		}
+
+		// The other entries of the batch are still serviced after a stop request: one-shot 
+		// entries that aren't re-armed would never be reported again
+		for ( int i=0; i<numEvents; ++i )
+		{
+			DeviceEntry* deviceEntry = static_cast<DeviceEntry*>( events[i].data.ptr );
+			if ( !deviceEntry )
+			{
+				isStopping = true;
+				continue;
+			}
+
+			deviceEntry->isBusy = true;
+			if ( deviceEntry->isRemoved )
+			{
+				deviceEntry->isBusy = false;
+				continue;
+			}
+
+			if ( deviceEntry->deviceMonitor )
+			{
+				deviceEntry->deviceMonitor->update();
+			}
+			else
+			{
+				unsigned int numImages = deviceEntry->device->update();
+				deviceEntry->numWakeUps++;
+				if ( numImages==0 )
+					deviceEntry->numEmptyWakeUps++;
+				deviceEntry->numDeliveredImages += numImages;
+
+				// A disconnected device stays in error, it would wake the threads up forever
+				if ( deviceEntry->device->isDisconnected() )
+					unwatchDevice( deviceEntry );
+			}
+
+			// Re-arm the entry, unless the device stopped capturing in the meantime
+			if ( deviceEntry->isWatched )
+			{
+				struct epoll_event event;
+				CLEAR(event);
+				event.events = EPOLLIN | EPOLLONESHOT;
+				event.data.ptr = deviceEntry;
+				epoll_ctl( mEpollHandle, EPOLL_CTL_MOD, deviceEntry->getHandle(), &event );
+			}
+			deviceEntry->isBusy = false;
+		}
+	}
+}
+
+}
@@ -0,0 +1,55 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include "RV4L2CaptureStatistics.h"
+
+namespace RV4L2
+{
+
+CaptureStatistics::CaptureStatistics()
+	: mNumDeliveredFrames(0),
+	  mNumDroppedFrames(0),
+	  mNumDecimatedFrames(0),
+	  mNumDequeueRetries(0),
+	  mNumQueueUnderruns(0),
+	  mBufferHoldTimeHistogram(),
+	  mListenerTimeHistogram(),
+	  mDeliveryLatencyHistogram(),
+	  mFrameIntervalHistogram()
+{
+}
+
+void CaptureStatistics::reset()
+{
+	mNumDeliveredFrames = 0;
+	mNumDroppedFrames = 0;
+	mNumDecimatedFrames = 0;
+	mNumDequeueRetries = 0;
+	mNumQueueUnderruns = 0;
+	mBufferHoldTimeHistogram.reset();
+	mListenerTimeHistogram.reset();
+	mDeliveryLatencyHistogram.reset();
+	mFrameIntervalHistogram.reset();
+}
+
+}
@@ -26,6 +26,7 @@
 #include <stdio.h>
 #include <cstring>
 #include <assert.h>
+#include <utility>
 
 namespace RV4L2
 {
@@ -33,8 +34,99 @@ namespace RV4L2
 CapturedImage::CapturedImage( ImageFormat imageFormat )
 	: mImage(imageFormat),
 	  mSequenceNumber(0),
-	  mTimestampInSec(0.f)
+	  mNumDroppedFrames(0),
+	  mTimestampInNs(0),
+	  mTimestampClock(UnknownTimestampClock),
+	  mTimestampSource(EndOfFrameTimestamp)
 {
 }
 
+CapturedImage::CapturedImage( ImageFormat imageFormat, unsigned char* externalBytes )
+	: mImage(imageFormat, externalBytes),
+	  mSequenceNumber(0),
+	  mNumDroppedFrames(0),
+	  mTimestampInNs(0),
+	  mTimestampClock(UnknownTimestampClock),
+	  mTimestampSource(EndOfFrameTimestamp)
+{
+}
+
+CapturedImage::CapturedImage( ImageFormat imageFormat, unsigned char* const* externalPlaneBytes, const unsigned int* planeSizesInBytes, unsigned int numPlanes )
+	: mImage(imageFormat, externalPlaneBytes, planeSizesInBytes, numPlanes),
+	  mSequenceNumber(0),
+	  mNumDroppedFrames(0),
+	  mTimestampInNs(0),
+	  mTimestampClock(UnknownTimestampClock),
+	  mTimestampSource(EndOfFrameTimestamp)
+{
+}
+
+// The image data is copied, as with Image
+CapturedImage::CapturedImage( const CapturedImage& other )
+	: mImage(other.mImage),
+	  mSequenceNumber(0),
+	  mNumDroppedFrames(0),
+	  mTimestampInNs(0),
+	  mTimestampClock(UnknownTimestampClock),
+	  mTimestampSource(EndOfFrameTimestamp)
+{
+	copyCaptureInfo( other );
+}
+
+// The image data is taken over without being copied
+CapturedImage::CapturedImage( CapturedImage&& other )
+	: mImage(std::move(other.mImage)),
+	  mSequenceNumber(0),
+	  mNumDroppedFrames(0),
+	  mTimestampInNs(0),
+	  mTimestampClock(UnknownTimestampClock),
+	  mTimestampSource(EndOfFrameTimestamp)
+{
+	copyCaptureInfo( other );
+}
+
+CapturedImage& CapturedImage::operator=( const CapturedImage& other )
+{
+	CapturedImage capturedImage( other );
+	swap( capturedImage );
+	return *this;
+}
+
+CapturedImage& CapturedImage::operator=( CapturedImage&& other )
+{
+	CapturedImage capturedImage( std::move(other) );
+	swap( capturedImage );
+	return *this;
+}
+
+void CapturedImage::swap( CapturedImage& other )
+{
+	mImage.swap( other.mImage );
+	std::swap( mSequenceNumber, other.mSequenceNumber );
+	std::swap( mNumDroppedFrames, other.mNumDroppedFrames );
+	std::swap( mTimestampInNs, other.mTimestampInNs );
+	std::swap( mTimestampClock, other.mTimestampClock );
+	std::swap( mTimestampSource, other.mTimestampSource );
 }
+
+// Copy everything but the image data
+void CapturedImage::copyCaptureInfo( const CapturedImage& other )
+{
+	mSequenceNumber = other.mSequenceNumber;
+	mNumDroppedFrames = other.mNumDroppedFrames;
+	mTimestampInNs = other.mTimestampInNs;
+	mTimestampClock = other.mTimestampClock;
+	mTimestampSource = other.mTimestampSource;
+}
+
+// Back to the capture info of a newly constructed image, the image data is left untouched
+void CapturedImage::resetCaptureInfo()
+{
+	mSequenceNumber = 0;
+	mNumDroppedFrames = 0;
+	mTimestampInNs = 0;
+	mTimestampClock = UnknownTimestampClock;
+	mTimestampSource = EndOfFrameTimestamp;
+}
+
+}
\ No newline at end of file
@@ -22,13 +22,17 @@
    SOFTWARE.
 */
 #include "RV4L2Device.h"
+#include "RV4L2V4L2CaptureBackend.h"
 
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
+#include <time.h>
 
+#include <cmath>
 #include <sstream>
 #include <algorithm>
 
@@ -41,6 +45,10 @@
 #include <sys/time.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include <linux/videodev2.h>
 
@@ -49,7 +57,6 @@
 /*
 	Notes:
 	- check for isValid() everywhere!
-	- NumBuffer should be settable in ctor... Reduce to 2 to reduce latency?
 
 	// PIXEL FORMAT 
 	// http://linuxtv.org/downloads/v4l-dvb-apis/pixfmt.html
@@ -57,6 +64,12 @@
 namespace RV4L2
 {
 
+// First line of the capture settings cache files, to be changed along with the file layout
+static const std::string captureSettingsCacheHeader = "RapaV4L2 capture settings cache 2\n";
+
+// The lease of the image a dispatch thread is notifying its queued listener of
+static thread_local FrameLease* queuedFrameLease = NULL;
+
 /*
 	Device::InternalCaptureSettings
 */
@@ -97,20 +110,94 @@ std::string Device::InternalCaptureSettings::toString() const
 	return stream.str();
 }
 
+/*
+	Device::FrameSizeRange
+*/
+Device::FrameSizeRange::FrameSizeRange()
+	:	pixelFormatName(),
+		pixelFormat(0),
+		minWidth(0),
+		maxWidth(0),
+		stepWidth(0),
+		minHeight(0),
+		maxHeight(0),
+		stepHeight(0)
+{
+}
+
+/*
+	Device::QueuedListener
+*/
+Device::QueuedListener::QueuedListener( Listener* listener, unsigned int queueDepth, FrameRing::OverflowPolicy overflowPolicy )
+	:	listener(listener),
+		queue(queueDepth, overflowPolicy),
+		dispatchThread()
+{
+}
+
 /*
 	Device
 */
-Device::Device( const char* deviceName )
+std::string Device::mCaptureSettingsCacheDirectory;
+
+Device::Device( const char* deviceName, CaptureBackend* backend )
 	:	mDeviceName(deviceName),
+		mBackend(backend),
 		mHandle(-1),
+		mIsMultiPlanar(false),
 		mInternalCaptureSettingsList(),
+		mFrameSizeRanges(),
 		mCaptureSettingsList(),
 		mCaptureSettingsToInternalCaptureSettingsIndices(),
+		mCaptureSettingsIndex(0),
+		mDeliveryMode(ZeroCopyDelivery),
+		mUpdateMode(ManualUpdate),
+		mDmaBufExportEnabled(false),
+		mUserBuffers(),
+		mUserBufferLength(0),
 		mIsCapturing(false),
+		mIsDisconnected(false),
+		mCaptureMutex(),
 		mCapturedImage(NULL),
 		mBuffers(NULL),
 		mNumBuffers(0),
+		mMaxNumBuffers(0),
+		mNumPlanes(0),
+		mPlaneSizesInBytes(),
+		mPlaneBytesPerLine(),
+		mMeasuredBufferHoldTimeInNs(0),
+		mLastSequenceNumber(0),
+		mHasLastSequenceNumber(false),
+		mNumQueuedBuffers(0),
+		mStatistics(),
+		mFrameLeases(),
+		mRetiredFrameLeases(),
+		mBufferGeneration(0),
+		mLeaseMutex(),
+		mDispatchedFrameLease(NULL),
+		mFrameRing(NULL),
+		mCaptureThread(),
+		mCaptureThreadCpus(),
+		mCaptureThreadPriority(0),
+		mMemoryLockingEnabled(false),
+		mLockedMemoryRanges(),
+		mLastDequeueTimeInNs(0),
+		mEpollHandle(-1),
+		mWakeUpHandle(-1),
+		mAsyncThread(),
+		mAsyncMutex(),
+		mAsyncCondition(),
+		mAsyncOperations(),
+		mIsAsyncOperationRunning(false),
+		mIsAsyncThreadExiting(false),
         mListeners(),
+		mListenersMutex(),
+		mQueuedListeners(),
+		mDeliveryDecimator(),
+		mNumUndeliveredDroppedFrames(0),
+		mListenerDecimators(),
+		mDispatchedListeners(),
+		mDispatchMutex(),
         mFallbackFrameSizes()
 {
     mFallbackFrameSizes.push_back( std::make_pair(320, 240) );
@@ -118,6 +205,8 @@ Device::Device( const char* deviceName )
     mFallbackFrameSizes.push_back( std::make_pair(720, 480) );
     mFallbackFrameSizes.push_back( std::make_pair(720, 576) );
 
+	if ( !mBackend )
+		mBackend = new V4L2CaptureBackend();
     if ( !openDevice() )
 		return;
 
@@ -127,38 +216,37 @@ Device::Device( const char* deviceName )
 		return;
 	}
 
-	initializeInternalCaptureSettingsList();
+	if ( !loadInternalCaptureSettingsList() )
+	{
+		initializeInternalCaptureSettingsList();
+		saveInternalCaptureSettingsList();
+	}
 	initializeCaptureSettingsList();
 }
 
 Device::~Device()
 {
+	stopAsyncThread();
+	stopCapture();
 	closeDevice();
+	delete mBackend;
+	for ( QueuedListeners::const_iterator itr=mQueuedListeners.begin(); itr!=mQueuedListeners.end(); ++itr )
+		delete *itr;
+
+	// The leases must all have been released: one released from now on would call into a 
+	// destroyed Device
+	assert( mRetiredFrameLeases.empty() );
+	for ( std::size_t i=0; i<mRetiredFrameLeases.size(); ++i )
+		delete mRetiredFrameLeases[i];
 }
 
 bool Device::openDevice()
 {
 	assert( mHandle==-1 );
 
-	struct stat st;
-	if ( stat(mDeviceName.c_str(), &st)==-1 )
-	{
-		fprintf( stderr, "Cannot identify '%s'. %s (%d)\n", mDeviceName.c_str(), strerror(errno), errno );
+	if ( !mBackend->open( mDeviceName ) )
 		return false;
-	}
-
-	if ( !S_ISCHR(st.st_mode) ) 
-	{
-		fprintf( stderr, "%s is not a device\n", mDeviceName.c_str() );
-		return false;	
-	}
-
-	mHandle = open( mDeviceName.c_str(), O_RDWR | O_NONBLOCK, 0 );
-    if ( mHandle==-1 )
-	{
-		fprintf( stderr, "Cannot open %s. %s (%d)\n", mDeviceName.c_str(), strerror(errno), errno );
-		return false;	
-	}
+	mHandle = mBackend->getHandle();
 	return true;
 }
 
@@ -167,7 +255,7 @@ bool Device::checkDeviceCapabilities()
 	assert( mHandle!=-1 );
 
 	struct v4l2_capability cap;
-    if ( xioctl(mHandle, VIDIOC_QUERYCAP, &cap)==-1 ) 
+    if ( mBackend->ioctl( VIDIOC_QUERYCAP, &cap)==-1 ) 
 	{
 		if ( EINVAL == errno )  
 		{
@@ -181,18 +269,36 @@ bool Device::checkDeviceCapabilities()
 		}
 	}
 
-	if ( !(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) ) 
+	// Many SoC capture devices only expose the multi-planar API
+	unsigned int capabilities = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+	if ( capabilities & V4L2_CAP_VIDEO_CAPTURE )
+	{
+		mIsMultiPlanar = false;
+	}
+	else if ( capabilities & V4L2_CAP_VIDEO_CAPTURE_MPLANE )
+	{
+		mIsMultiPlanar = true;
+	}
+	else
 	{
 		fprintf( stderr, "%s is a V4L2 device but doesn't support capture\n", mDeviceName.c_str() );
 		return false;	
 	}
 
-	if ( !(cap.capabilities & V4L2_CAP_STREAMING) ) 
+	if ( !(capabilities & V4L2_CAP_STREAMING) ) 
 	{
 		fprintf( stderr, "%s is a V4L2 capture device but does not support streaming i/o\n", mDeviceName.c_str() );
 		return false;	
 	}
 
+	std::stringstream stream;
+	stream << "driver " << reinterpret_cast<const char*>(cap.driver) << "\n";
+	stream << "card " << reinterpret_cast<const char*>(cap.card) << "\n";
+	stream << "bus_info " << reinterpret_cast<const char*>(cap.bus_info) << "\n";
+	stream << "version " << cap.version << "\n";
+	stream << "capabilities " << capabilities << "\n";
+	mCapabilitiesKey = stream.str();
+
 	return true;
 }
 
@@ -200,7 +306,7 @@ void Device::closeDevice()
 {
 	if ( mHandle!=-1 )
 	{
-		close( mHandle );
+		mBackend->close();
 		mHandle = -1;
 	}
 }
@@ -208,16 +314,17 @@ void Device::closeDevice()
 void Device::initializeInternalCaptureSettingsList()
 {
 	mInternalCaptureSettingsList.clear();
+	mFrameSizeRanges.clear();
 
 	// Enumerate all the image formats supported
 	struct v4l2_fmtdesc fmtDesc;
 	CLEAR(fmtDesc);
-	fmtDesc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fmtDesc.type = getBufferType();
 	fmtDesc.index = 0;
 	int retFmtDesc = 0;
 	do 
 	{
-		retFmtDesc = xioctl( mHandle, VIDIOC_ENUM_FMT, &fmtDesc );
+		retFmtDesc = mBackend->ioctl( VIDIOC_ENUM_FMT, &fmtDesc );
 //printf("DEBUG: VIDIOC_ENUM_FMT:%d\n", retFmtDesc);
 		if ( retFmtDesc==0 )
 		{
@@ -229,7 +336,7 @@ void Device::initializeInternalCaptureSettingsList()
 			int retFrmSize = 0;
 			do
 			{
-				retFrmSize = xioctl( mHandle, VIDIOC_ENUM_FRAMESIZES, &frmSizeEnum );
+				retFrmSize = mBackend->ioctl( VIDIOC_ENUM_FRAMESIZES, &frmSizeEnum );
 //printf("DEBUG: VIDIOC_ENUM_FRAMESIZES:%d\n", retFmtDesc);
 				if ( retFrmSize==0 )
 				{
@@ -245,7 +352,7 @@ void Device::initializeInternalCaptureSettingsList()
 						int retFrmIval = 0;
 						do
 						{
-							retFrmIval = xioctl( mHandle, VIDIOC_ENUM_FRAMEINTERVALS, &frmIvalEnum );
+							retFrmIval = mBackend->ioctl( VIDIOC_ENUM_FRAMEINTERVALS, &frmIvalEnum );
 //printf("DEBUG: VIDIOC_ENUM_FRAMEINTERVALS:%d\n", retFrmIval);
 							if ( retFrmIval==0 )
 							{
@@ -269,38 +376,30 @@ void Device::initializeInternalCaptureSettingsList()
 						}
 						while ( retFrmIval==0 );
 					}
-					else if ( frmSizeEnum.type==V4L2_FRMSIZE_TYPE_STEPWISE )
+					else if ( frmSizeEnum.type==V4L2_FRMSIZE_TYPE_STEPWISE || frmSizeEnum.type==V4L2_FRMSIZE_TYPE_CONTINUOUS )
 					{
-                        //fprintf( stderr, ">>>>>>>V4L2_FRMSIZE_TYPE_STEPWISE\n");
-                        //fprintf( stderr, ">>>>>>>  min_width=%d\n", frmSizeEnum.stepwise.min_width );
-                        //fprintf( stderr, ">>>>>>>  max_width=%d\n", frmSizeEnum.stepwise.max_width );
-                        //fprintf( stderr, ">>>>>>>  step_width=%d\n", frmSizeEnum.stepwise.step_width );
-                        //fprintf( stderr, ">>>>>>>  min_height=%d\n", frmSizeEnum.stepwise.min_height );
-                        //fprintf( stderr, ">>>>>>>  max_height=%d\n", frmSizeEnum.stepwise.max_height );
-                        //fprintf( stderr, ">>>>>>>  step_height=%d\n", frmSizeEnum.stepwise.step_height );
-
-						// Should check frame interval... but doesn't seem to work :(
+						// Remember the range so that any size of its grid can be requested later 
+						// (see requestCaptureSettings()). Continuous ranges have a step of 1
+						FrameSizeRange frameSizeRange;
+						frameSizeRange.pixelFormatName = reinterpret_cast<char*>(fmtDesc.description);
+						frameSizeRange.pixelFormat = fmtDesc.pixelformat;
+						frameSizeRange.minWidth = frmSizeEnum.stepwise.min_width;
+						frameSizeRange.maxWidth = frmSizeEnum.stepwise.max_width;
+						frameSizeRange.stepWidth = frmSizeEnum.type==V4L2_FRMSIZE_TYPE_STEPWISE ? frmSizeEnum.stepwise.step_width : 1;
+						frameSizeRange.minHeight = frmSizeEnum.stepwise.min_height;
+						frameSizeRange.maxHeight = frmSizeEnum.stepwise.max_height;
+						frameSizeRange.stepHeight = frmSizeEnum.type==V4L2_FRMSIZE_TYPE_STEPWISE ? frmSizeEnum.stepwise.step_height : 1;
+						mFrameSizeRanges.push_back( frameSizeRange );
+
+						// Only the largest size is listed by default
 						InternalCaptureSettings internalCaptureSettings;
-						internalCaptureSettings.pixelFormatName = reinterpret_cast<char*>(fmtDesc.description);
+						internalCaptureSettings.pixelFormatName = frameSizeRange.pixelFormatName;
 						internalCaptureSettings.pixelFormat = fmtDesc.pixelformat;
 						internalCaptureSettings.width = frmSizeEnum.stepwise.max_width;
 						internalCaptureSettings.height = frmSizeEnum.stepwise.max_height;
-						//internalCaptureSettings.width = frmSizeEnum.stepwise.min_width;
-						//internalCaptureSettings.height = frmSizeEnum.stepwise.min_height;
-                        internalCaptureSettings.frameIntervalNumerator = 0;
-                        internalCaptureSettings.frameIntervalDenominator = 0;
+						probeFrameInterval( internalCaptureSettings, 0.f );
 						mInternalCaptureSettingsList.push_back( internalCaptureSettings );
 					}
-					else if ( frmSizeEnum.type==V4L2_FRMSIZE_TYPE_CONTINUOUS  )
-					{
-                        //fprintf( stderr, ">>>>>>>V4L2_FRMSIZE_TYPE_CONTINUOUS\n");
-						// fprintf( stderr, ">>>>>>>  min_width=%d\n", frmSizeEnum.stepwise.min_width );
-						// fprintf( stderr, ">>>>>>>  max_width=%d\n", frmSizeEnum.stepwise.max_width );
-						// fprintf( stderr, ">>>>>>>  step_width=%d\n", frmSizeEnum.stepwise.step_width );
-						// fprintf( stderr, ">>>>>>>  min_height=%d\n", frmSizeEnum.stepwise.min_height );
-						// fprintf( stderr, ">>>>>>>  max_height=%d\n", frmSizeEnum.stepwise.max_height );
-						// fprintf( stderr, ">>>>>>>  step_height=%d\n", frmSizeEnum.stepwise.step_height );
-					}
 					else 
 					{
 						fprintf( stderr, ">>>>>>>UNKNOWN\n");
@@ -308,7 +407,7 @@ void Device::initializeInternalCaptureSettingsList()
 
 					frmSizeEnum.index++;
 				}
-				else
+				else if ( frmSizeEnum.index==0 )
 				{
                     //printf("FAILED to enumerate frame sizes, defaulting to something\n");
                     for ( std::size_t i=0; i<mFallbackFrameSizes.size(); ++i )
@@ -329,29 +428,216 @@ void Device::initializeInternalCaptureSettingsList()
 		}			
 	}
 	while ( retFmtDesc==0 );
+}
+
+void Device::setCaptureSettingsCacheDirectory( const char* directory )
+{
+	mCaptureSettingsCacheDirectory = directory ? directory : "";
+}
+
+// The file name is derived from a hash of the capabilities key. The key itself is stored in
+// the file and compared on load, which protects against hash collisions
+std::string Device::getCaptureSettingsCacheFileName() const
+{
+	if ( mCaptureSettingsCacheDirectory.empty() || mCapabilitiesKey.empty() )
+		return "";
+
+	uint64_t hash = 14695981039346656037ULL;		// FNV-1a
+	for ( std::size_t i=0; i<mCapabilitiesKey.size(); ++i )
+	{
+		hash ^= static_cast<unsigned char>( mCapabilitiesKey[i] );
+		hash *= 1099511628211ULL;
+	}
+	char fileName[64];
+	snprintf( fileName, sizeof(fileName), "/RapaV4L2_%016llx.cache", static_cast<unsigned long long>(hash) );
+	return mCaptureSettingsCacheDirectory + fileName;
+}
+
+// Read the capture settings list from the cache. Any mismatch or inconsistency in the file 
+// makes it ignored, the device then gets enumerated again and the file rewritten
+bool Device::loadInternalCaptureSettingsList()
+{
+	std::string fileName = getCaptureSettingsCacheFileName();
+	if ( fileName.empty() )
+		return false;
+
+	FILE* file = fopen( fileName.c_str(), "r" );
+	if ( !file )
+		return false;
+
+	// Check the header and the capabilities key
+	std::string header;
+	char line[256];
+	while ( header.size()<captureSettingsCacheHeader.size()+mCapabilitiesKey.size() && fgets( line, sizeof(line), file ) )
+		header += line;
+	if ( header!=captureSettingsCacheHeader+mCapabilitiesKey )
+	{
+		fclose(file);
+		return false;
+	}
+
+	// Read one capture settings per line, the pixel format name being last as it can contain spaces
+	unsigned int numSettings = 0;
+	if ( fscanf( file, "settings %u\n", &numSettings )!=1 )
+	{
+		fclose(file);
+		return false;
+	}
+	std::vector<InternalCaptureSettings> settingsList;
+	for ( unsigned int i=0; i<numSettings; ++i )
+	{
+		InternalCaptureSettings settings;
+		int nameOffset = 0;
+		if ( !fgets( line, sizeof(line), file ) ||
+			 sscanf( line, "%x %u %u %u %u %n", &settings.pixelFormat, &settings.width, &settings.height, 
+					&settings.frameIntervalNumerator, &settings.frameIntervalDenominator, &nameOffset )!=5 )
+		{
+			fclose(file);
+			return false;
+		}
+		settings.pixelFormatName = line + nameOffset;
+		if ( !settings.pixelFormatName.empty() && settings.pixelFormatName[settings.pixelFormatName.size()-1]=='\n' )
+			settings.pixelFormatName.erase( settings.pixelFormatName.size()-1 );
+		settingsList.push_back( settings );
+	}
+
+	unsigned int numRanges = 0;
+	if ( fscanf( file, "ranges %u\n", &numRanges )!=1 )
+	{
+		fclose(file);
+		return false;
+	}
+	std::vector<FrameSizeRange> rangeList;
+	for ( unsigned int i=0; i<numRanges; ++i )
+	{
+		FrameSizeRange range;
+		int nameOffset = 0;
+		if ( !fgets( line, sizeof(line), file ) ||
+			 sscanf( line, "%x %u %u %u %u %u %u %n", &range.pixelFormat, &range.minWidth, &range.maxWidth, &range.stepWidth, 
+					&range.minHeight, &range.maxHeight, &range.stepHeight, &nameOffset )!=7 )
+		{
+			fclose(file);
+			return false;
+		}
+		range.pixelFormatName = line + nameOffset;
+		if ( !range.pixelFormatName.empty() && range.pixelFormatName[range.pixelFormatName.size()-1]=='\n' )
+			range.pixelFormatName.erase( range.pixelFormatName.size()-1 );
+		rangeList.push_back( range );
+	}
+	fclose(file);
+
+	mInternalCaptureSettingsList.swap( settingsList );
+	mFrameSizeRanges.swap( rangeList );
+	return true;
+}
+
+// The file is written under a temporary name then renamed, so that another process creating 
+// the same device never reads a partial file
+bool Device::saveInternalCaptureSettingsList() const
+{
+	std::string fileName = getCaptureSettingsCacheFileName();
+	if ( fileName.empty() )
+		return false;
+
+	std::stringstream tempFileNameStream;
+	tempFileNameStream << fileName << "." << getpid() << ".tmp";
+	std::string tempFileName = tempFileNameStream.str();
+	FILE* file = fopen( tempFileName.c_str(), "w" );
+	if ( !file )
+	{
+		fprintf( stderr, "Failed to create capture settings cache file %s for device %s\n", tempFileName.c_str(), mDeviceName.c_str() );
+		return false;
+	}
 
-	// For debug
-    printf("DEBUG: Internal capture settings list: %d\n", static_cast<int>(mInternalCaptureSettingsList.size()) );
+	fprintf( file, "%s%s", captureSettingsCacheHeader.c_str(), mCapabilitiesKey.c_str() );
+	fprintf( file, "settings %u\n", static_cast<unsigned int>(mInternalCaptureSettingsList.size()) );
 	for ( std::size_t i=0; i<mInternalCaptureSettingsList.size(); ++i )
 	{
-		const InternalCaptureSettings& internalCaptureSettings = mInternalCaptureSettingsList[i];
-		printf("DEBUG: %s\n", internalCaptureSettings.toString().c_str() );
+		const InternalCaptureSettings& settings = mInternalCaptureSettingsList[i];
+		fprintf( file, "%x %u %u %u %u %s\n", settings.pixelFormat, settings.width, settings.height, 
+				settings.frameIntervalNumerator, settings.frameIntervalDenominator, settings.pixelFormatName.c_str() );
+	}
+	fprintf( file, "ranges %u\n", static_cast<unsigned int>(mFrameSizeRanges.size()) );
+	for ( std::size_t i=0; i<mFrameSizeRanges.size(); ++i )
+	{
+		const FrameSizeRange& range = mFrameSizeRanges[i];
+		fprintf( file, "%x %u %u %u %u %u %u %s\n", range.pixelFormat, range.minWidth, range.maxWidth, range.stepWidth, 
+				range.minHeight, range.maxHeight, range.stepHeight, range.pixelFormatName.c_str() );
+	}
+	bool ret = ( fflush(file)==0 && !ferror(file) );
+	fclose(file);
+	if ( !ret || rename( tempFileName.c_str(), fileName.c_str() )==-1 )
+	{
+		fprintf( stderr, "Failed to write capture settings cache file %s for device %s\n", fileName.c_str(), mDeviceName.c_str() );
+		unlink( tempFileName.c_str() );
+		return false;
 	}
+	return true;
+}
+
+// Remove the cache file of the device and enumerate its capture settings again. The indices 
+// of the supported capture settings may change
+bool Device::invalidateCachedCaptureSettings()
+{
+	std::lock_guard<std::recursive_mutex> lock( mCaptureMutex );
+	if ( !isValid() || isCapturing() )
+		return false;
+
+	std::string fileName = getCaptureSettingsCacheFileName();
+	if ( !fileName.empty() )
+		unlink( fileName.c_str() );
+
+	initializeInternalCaptureSettingsList();
+	saveInternalCaptureSettingsList();
+	initializeCaptureSettingsList();
+	return true;
 }
 
 bool Device::getImageFormatEncoding( unsigned int v4l2PixelFormat, ImageFormat::Encoding& encoding )
 {
 	switch ( v4l2PixelFormat )
 	{
+		case V4L2_PIX_FMT_GREY:
+			encoding=ImageFormat::Grayscale8;
+			return true;
+
+		case V4L2_PIX_FMT_RGB24:
+			encoding=ImageFormat::RGB24;
+			return true;
+
 		case V4L2_PIX_FMT_YUYV:	
 			encoding=ImageFormat::YUYV;
 			return true;
+
+		case V4L2_PIX_FMT_UYVY:	
+			encoding=ImageFormat::UYVY;
+			return true;
+
+		// The multi-planar variants hold the same planes in separate buffers
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV12M:
+			encoding=ImageFormat::NV12;
+			return true;
+
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YUV420M:
+			encoding=ImageFormat::I420;
+			return true;
 			
 		case V4L2_PIX_FMT_SBGGR8:
+			encoding=ImageFormat::BayerBGGR8;
+			return true;
+
 		case V4L2_PIX_FMT_SGBRG8: 
+			encoding=ImageFormat::BayerGBRG8;
+			return true;
+
 		case V4L2_PIX_FMT_SGRBG8:
+			encoding=ImageFormat::BayerGRBG8;
+			return true;
+
 		case V4L2_PIX_FMT_SRGGB8:
-			encoding=ImageFormat::YUYV;	//_32Bits;
+			encoding=ImageFormat::BayerRGGB8;
 			return true;
 	}
 	return false;	
@@ -373,7 +659,7 @@ void Device::initializeCaptureSettingsList()
 			CaptureSettings captureSettings( format, internalCaptureSettings.getFrameRateInHz() );
 
 			// Remember which InternalCaptureSettings corresponds to this new CaptureSettings
-			mCaptureSettingsToInternalCaptureSettingsIndices.push_back( mCaptureSettingsList.size() );
+			mCaptureSettingsToInternalCaptureSettingsIndices.push_back( i );
 
 			// Add this CaptureSettings to the list
 			mCaptureSettingsList.push_back( captureSettings );
@@ -386,356 +672,1754 @@ void Device::initializeCaptureSettingsList()
 	assert( mCaptureSettingsToInternalCaptureSettingsIndices.size()==mCaptureSettingsList.size() );
 }
 
-bool Device::getSupportedCaptureSettingsIndex( const CaptureSettings& captureSettings, std::size_t& index ) const
+// Find the capture settings closest to the requested resolution and frame rate (a rate of 0 
+// meaning any). Sizes of stepwise or continuous ranges are snapped to the driver grid and their 
+// frame interval probed: if the result isn't listed yet, it is added to the supported capture 
+// settings. The index returned can then be passed to startCapture()
+bool Device::requestCaptureSettings( unsigned int width, unsigned int height, ImageFormat::Encoding encoding, float frameRateInHz, std::size_t& captureSettingsIndex )
 {
-	index = 0;
+	std::lock_guard<std::recursive_mutex> lock( mCaptureMutex );
+	if ( !isValid() )
+		return false;
+
+	// Listed capture settings: closest size first, then closest rate
+	bool found = false;
+	unsigned int bestSizeDistance = 0;
+	float bestRateDistance = 0.f;
 	for ( std::size_t i=0; i<mCaptureSettingsList.size(); ++i )
 	{
-		if ( mCaptureSettingsList[i]==captureSettings )
+		const ImageFormat& format = mCaptureSettingsList[i].getImageFormat();
+		if ( format.getEncoding()!=encoding )
+			continue;
+		unsigned int sizeDistance = getDistance( format.getWidth(), width ) + getDistance( format.getHeight(), height );
+		float rateDistance = frameRateInHz>0.f ? fabsf( mCaptureSettingsList[i].getFrameRate()-frameRateInHz ) : 0.f;
+		if ( !found || sizeDistance<bestSizeDistance || (sizeDistance==bestSizeDistance && rateDistance<bestRateDistance) )
 		{
-			index = i;
-			return true;
+			found = true;
+			bestSizeDistance = sizeDistance;
+			bestRateDistance = rateDistance;
+			captureSettingsIndex = i;
 		}
 	}
-	return false;
-}
-	
-bool Device::startCapture( std::size_t captureSettingsIndex )
-{
-	if ( isCapturing() )
-		return false;
 
-	if ( captureSettingsIndex>=mCaptureSettingsList.size() )
+	// Frame size ranges, only used when they get strictly closer to the requested size
+	const FrameSizeRange* bestFrameSizeRange = NULL;
+	unsigned int bestWidth = 0;
+	unsigned int bestHeight = 0;
+	for ( std::size_t i=0; i<mFrameSizeRanges.size(); ++i )
+	{
+		const FrameSizeRange& frameSizeRange = mFrameSizeRanges[i];
+		ImageFormat::Encoding rangeEncoding;
+		if ( !getImageFormatEncoding( frameSizeRange.pixelFormat, rangeEncoding ) || rangeEncoding!=encoding )
+			continue;
+		unsigned int snappedWidth = snapToStep( width, frameSizeRange.minWidth, frameSizeRange.maxWidth, frameSizeRange.stepWidth );
+		unsigned int snappedHeight = snapToStep( height, frameSizeRange.minHeight, frameSizeRange.maxHeight, frameSizeRange.stepHeight );
+		unsigned int sizeDistance = getDistance( snappedWidth, width ) + getDistance( snappedHeight, height );
+		if ( !found || sizeDistance<bestSizeDistance )
+		{
+			found = true;
+			bestSizeDistance = sizeDistance;
+			bestFrameSizeRange = &frameSizeRange;
+			bestWidth = snappedWidth;
+			bestHeight = snappedHeight;
+		}
+	}
+	if ( !found )
 		return false;
+	if ( !bestFrameSizeRange )
+		return true;
 
-	// Retrieve CaptureSettings
-	const CaptureSettings& captureSettings = mCaptureSettingsList[captureSettingsIndex];
-	
-	// Retrieve corresponding InternalCaptureSettings
-	std::size_t internalCaptureSettingsIndex = mCaptureSettingsToInternalCaptureSettingsIndices[captureSettingsIndex];
-	const InternalCaptureSettings& internalCaptureSettings = mInternalCaptureSettingsList[internalCaptureSettingsIndex];
+	InternalCaptureSettings internalCaptureSettings;
+	internalCaptureSettings.pixelFormatName = bestFrameSizeRange->pixelFormatName;
+	internalCaptureSettings.pixelFormat = bestFrameSizeRange->pixelFormat;
+	internalCaptureSettings.width = bestWidth;
+	internalCaptureSettings.height = bestHeight;
+	probeFrameInterval( internalCaptureSettings, frameRateInHz );
 
-	// Prepare a V4L2 format struct for the capture (we should probably read it from the hardware 
-	// and modify it rather than creating a cleared one)
-	struct v4l2_format fmt;
-	CLEAR(fmt);
-	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	fmt.fmt.pix.width = internalCaptureSettings.width;
-    fmt.fmt.pix.height = internalCaptureSettings.height;
-    fmt.fmt.pix.pixelformat = internalCaptureSettings.pixelFormat;
-    //fmt.fmt.pix.field = ???
-	if ( xioctl( mHandle, VIDIOC_S_FMT, &fmt )==-1 )		
+	// Reuse the capture settings if they are already listed
+	for ( std::size_t i=0; i<mCaptureSettingsList.size(); ++i )
 	{
-		fprintf( stderr, "VIDIOC_S_FMT failed for device %s\n", mDeviceName.c_str() );
-		return false;	
+		const InternalCaptureSettings& other = mInternalCaptureSettingsList[ mCaptureSettingsToInternalCaptureSettingsIndices[i] ];
+		if ( other.pixelFormat==internalCaptureSettings.pixelFormat &&
+			 other.width==internalCaptureSettings.width &&
+			 other.height==internalCaptureSettings.height &&
+			 other.frameIntervalNumerator==internalCaptureSettings.frameIntervalNumerator &&
+			 other.frameIntervalDenominator==internalCaptureSettings.frameIntervalDenominator )
+		{
+			captureSettingsIndex = i;
+			return true;
+		}
 	}
 
-	// Check that we've got what we wanted
-	if ( xioctl( mHandle, VIDIOC_G_FMT, &fmt )==-1 )		
+	ImageFormat format( internalCaptureSettings.width, internalCaptureSettings.height, encoding );
+	mCaptureSettingsToInternalCaptureSettingsIndices.push_back( mInternalCaptureSettingsList.size() );
+	mInternalCaptureSettingsList.push_back( internalCaptureSettings );
+	captureSettingsIndex = mCaptureSettingsList.size();
+	mCaptureSettingsList.push_back( CaptureSettings( format, internalCaptureSettings.getFrameRateInHz() ) );
+	return true;
+}
+
+unsigned int Device::getDistance( unsigned int a, unsigned int b )
+{
+	return a>b ? a-b : b-a;
+}
+
+// Clamp a value to a range and round it to the nearest step
+unsigned int Device::snapToStep( unsigned int value, unsigned int min, unsigned int max, unsigned int step )
+{
+	if ( value<=min )
+		return min;
+	if ( value>=max )
+		return max;
+	if ( step==0 )
+		return value;
+	unsigned int numSteps = ( value - min + step/2 ) / step;
+	unsigned int snappedValue = min + numSteps*step;
+	return snappedValue>max ? snappedValue-step : snappedValue;
+}
+
+// Find the frame interval of a frame size closest to the requested rate (or the fastest one
+// when the rate is 0). The interval is left to 0/0 (driver default) when it can't be enumerated
+bool Device::probeFrameInterval( InternalCaptureSettings& internalCaptureSettings, float frameRateInHz ) const
+{
+	internalCaptureSettings.frameIntervalNumerator = 0;
+	internalCaptureSettings.frameIntervalDenominator = 0;
+
+	v4l2_frmivalenum frmIvalEnum;
+	CLEAR( frmIvalEnum );
+	frmIvalEnum.index = 0;
+	frmIvalEnum.pixel_format = internalCaptureSettings.pixelFormat;
+	frmIvalEnum.width = internalCaptureSettings.width;
+	frmIvalEnum.height = internalCaptureSettings.height;
+	if ( mBackend->ioctl( VIDIOC_ENUM_FRAMEINTERVALS, &frmIvalEnum )==-1 )
+		return false;
+
+	if ( frmIvalEnum.type==V4L2_FRMIVAL_TYPE_DISCRETE )
 	{
-		fprintf( stderr, "VIDIOC_G_FMT failed for device %s\n", mDeviceName.c_str() );
-		return false;	
+		float bestRateDistance = 0.f;
+		do
+		{
+			const v4l2_fract& interval = frmIvalEnum.discrete;
+			if ( interval.numerator!=0 && interval.denominator!=0 )
+			{
+				float rate = static_cast<float>(interval.denominator) / static_cast<float>(interval.numerator);
+				float rateDistance = frameRateInHz>0.f ? fabsf( rate-frameRateInHz ) : -rate;
+				if ( internalCaptureSettings.frameIntervalNumerator==0 || rateDistance<bestRateDistance )
+				{
+					bestRateDistance = rateDistance;
+					internalCaptureSettings.frameIntervalNumerator = interval.numerator;
+					internalCaptureSettings.frameIntervalDenominator = interval.denominator;
+				}
+			}
+			frmIvalEnum.index++;
+		}
+		while ( mBackend->ioctl( VIDIOC_ENUM_FRAMEINTERVALS, &frmIvalEnum )==0 );
+		return internalCaptureSettings.frameIntervalNumerator!=0;
 	}
-	if ( fmt.fmt.pix.width != internalCaptureSettings.width ||
-		 fmt.fmt.pix.height != internalCaptureSettings.height ||
-		 fmt.fmt.pix.pixelformat != internalCaptureSettings.pixelFormat )
+
+	// Stepwise or continuous intervals, from min to max with a given step. The computation is 
+	// done on fractions with a common denominator so that the result lies exactly on the grid
+	const v4l2_fract& min = frmIvalEnum.stepwise.min;
+	const v4l2_fract& max = frmIvalEnum.stepwise.max;
+	v4l2_fract step = frmIvalEnum.stepwise.step;
+	if ( frmIvalEnum.type==V4L2_FRMIVAL_TYPE_CONTINUOUS || step.numerator==0 || step.denominator==0 )
 	{
-		fprintf( stderr, "Failed to set the capture format for device %s\n", mDeviceName.c_str() );
-		return false;	
+		step.numerator = 1;
+		step.denominator = max.denominator;
 	}
-	
-	// Check that the hardware will provide us with images of the expected size
-	if ( fmt.fmt.pix.sizeimage!=captureSettings.getImageFormat().getDataSizeInBytes() )
-	{
-		fprintf( stderr, "The image size that %s provides for the capture (%d) is not the expected one (%d)\n", mDeviceName.c_str(), fmt.fmt.pix.sizeimage, captureSettings.getImageFormat().getDataSizeInBytes());
+	if ( min.denominator==0 || max.denominator==0 || step.denominator==0 )
 		return false;
+
+	uint64_t denominator = static_cast<uint64_t>(min.denominator) * max.denominator * step.denominator;
+	uint64_t minNumerator = static_cast<uint64_t>(min.numerator) * max.denominator * step.denominator;
+	uint64_t maxNumerator = static_cast<uint64_t>(max.numerator) * min.denominator * step.denominator;
+	uint64_t stepNumerator = static_cast<uint64_t>(step.numerator) * min.denominator * max.denominator;
+	uint64_t numerator = minNumerator;		// Shortest interval, fastest rate
+	if ( frameRateInHz>0.f )
+	{
+		uint64_t targetNumerator = static_cast<uint64_t>( static_cast<double>(denominator) / frameRateInHz + 0.5 );
+		if ( targetNumerator>=maxNumerator )
+			numerator = maxNumerator;
+		else if ( targetNumerator>minNumerator && stepNumerator!=0 )
+			numerator = minNumerator + ( (targetNumerator - minNumerator + stepNumerator/2) / stepNumerator ) * stepNumerator;
+		if ( numerator>maxNumerator )
+			numerator = maxNumerator;
 	}
 
-	// Specify the frame interval
-    if ( internalCaptureSettings.frameIntervalNumerator!=0 &&
-         internalCaptureSettings.frameIntervalDenominator!=0 )
+	// Reduce the fraction so that it fits the 32-bit fields of the driver
+	uint64_t a = numerator;
+	uint64_t b = denominator;
+	while ( b!=0 )
 	{
-		struct v4l2_streamparm parm;
-		CLEAR(parm);
-		parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		parm.parm.capture.timeperframe.numerator = internalCaptureSettings.frameIntervalNumerator;
-		parm.parm.capture.timeperframe.denominator = internalCaptureSettings.frameIntervalDenominator;
-		if ( xioctl( mHandle, VIDIOC_S_PARM, &parm )==-1 )		
-		{
-			fprintf( stderr, "VIDIOC_S_PARM failed for device %s\n", mDeviceName.c_str() );
-			return false;	
-		}
-		
-		// Check that we've got what we wanted
-		if ( xioctl( mHandle, VIDIOC_G_PARM, &parm )==-1 )		
-		{
-			fprintf( stderr, "VIDIOC_G_PARM failed for device %s\n", mDeviceName.c_str() );
-			return false;	
-		}
-		if ( parm.parm.capture.timeperframe.numerator != internalCaptureSettings.frameIntervalNumerator ||
-			 parm.parm.capture.timeperframe.denominator != internalCaptureSettings.frameIntervalDenominator )
-		{
-			fprintf( stderr, "Failed to set the frame interval for device %s\n", mDeviceName.c_str() );
-			return false;
-		}
+		uint64_t r = a % b;
+		a = b;
+		b = r;
 	}
-	else
+	if ( a==0 )
+		return false;
+	numerator /= a;
+	denominator /= a;
+	while ( numerator>0xffffffffULL || denominator>0xffffffffULL )
 	{
-		fprintf( stderr, "VIDIOC_S_PARM not specified for device %s\n", mDeviceName.c_str() );
+		numerator = (numerator+1)/2;
+		denominator = (denominator+1)/2;
 	}
-		
-	// Construct CapturedImage to receive image data
-	assert( !mCapturedImage );
-	mCapturedImage = new CapturedImage( captureSettings.getImageFormat() );
-	
-	// Request buffers for MMAP transfer
-	struct v4l2_requestbuffers req;
-	CLEAR(req);
-    req.count = mNumBuffersToUse;
-	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    req.memory = V4L2_MEMORY_MMAP;
-	if ( xioctl( mHandle, VIDIOC_REQBUFS, &req )==-1 ) 
+	if ( numerator==0 )
+		return false;
+	internalCaptureSettings.frameIntervalNumerator = static_cast<unsigned int>(numerator);
+	internalCaptureSettings.frameIntervalDenominator = static_cast<unsigned int>(denominator);
+	return true;
+}
+
+bool Device::getSupportedCaptureSettingsIndex( const CaptureSettings& captureSettings, std::size_t& index ) const
+{
+	index = 0;
+	for ( std::size_t i=0; i<mCaptureSettingsList.size(); ++i )
 	{
-        if ( EINVAL==errno ) 
-		{
-			fprintf( stderr, "Failed to request MMAP buffers for device %s\n", mDeviceName.c_str() );
-			return false; 
-		}
-		else
+		if ( mCaptureSettingsList[i]==captureSettings )
 		{
-			fprintf( stderr, "VIDIOC_REQBUFS failed for device %s\n", mDeviceName.c_str() );
-			return false;
+			index = i;
+			return true;
 		}
 	}
-	
-	
-	// Allocate the list of buffers
-	int numBuffers = req.count;
-	if ( numBuffers<2 ) 
-	{
-		fprintf( stderr, "Insufficient buffer memory for device %s\n", mDeviceName.c_str() );
+	return false;
+}
+
+// The delivery mode can only be changed while the device is not capturing
+bool Device::setDeliveryMode( DeliveryMode deliveryMode )
+{
+	std::lock_guard<std::recursive_mutex> lock( mCaptureMutex );
+	if ( isCapturing() )
 		return false;
-	}
+	mDeliveryMode = deliveryMode;
+	return true;
+}
 	
-	struct buffer* buffers = (buffer*)calloc( numBuffers, sizeof(*buffers) );
-	if ( !buffers )
-	{
-		fprintf( stderr, "Out of memory\n" );
+// The update mode can only be changed while the device is not capturing
+bool Device::setUpdateMode( UpdateMode updateMode )
+{
+	std::lock_guard<std::recursive_mutex> lock( mCaptureMutex );
+	if ( isCapturing() )
 		return false;
-	}
+	mUpdateMode = updateMode;
+	return true;
+}
 
-	// Map memory buffer
-	for ( int bufferIndex=0; bufferIndex<numBuffers; ++bufferIndex ) 
-	{
-		struct v4l2_buffer buf;
-		CLEAR(buf);
-		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        buf.index = bufferIndex;
+bool Device::setUserBuffers( void* const* buffers, unsigned int numBuffers, std::size_t bufferLength )
+{
+	std::lock_guard<std::recursive_mutex> lock( mCaptureMutex );
+	if ( isCapturing() )
+		return false;
 
-		if ( xioctl( mHandle, VIDIOC_QUERYBUF, &buf )==-1 )
-		{
-			fprintf( stderr, "VIDIOC_QUERYBUF failed for device %s\n", mDeviceName.c_str() );
-			// Note: aquired resources should be properly released here!
-			return false;	
-		}
-		buffers[bufferIndex].length = buf.length;
-        buffers[bufferIndex].start = mmap( NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, mHandle, buf.m.offset );
-		if ( buffers[bufferIndex].start==MAP_FAILED )
+	long pageSize = sysconf( _SC_PAGESIZE );
+	for ( unsigned int i=0; i<numBuffers; ++i )
+	{
+		if ( !buffers[i] || reinterpret_cast<uintptr_t>(buffers[i]) % pageSize!=0 )
 		{
-			fprintf( stderr, "MMAP failed for device %s\n", mDeviceName.c_str() );
-			// Note: aquired resources should be properly released here!
-			return false;	
+			fprintf( stderr, "User buffer #%d for device %s is not page-aligned\n", i, mDeviceName.c_str() );
+			return false;
 		}
 	}
 
+	mUserBuffers.assign( buffers, buffers+numBuffers );
+	mUserBufferLength = numBuffers>0 ? bufferLength : 0;
+	return true;
+}
+
+unsigned int Device::getBufferType() const
+{
+	return mIsMultiPlanar ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+}
+
+unsigned int Device::getMemoryType() const
+{
+	return isUsingUserBuffers() ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
+}
+
+// Export each capture buffer as a dmabuf file descriptor (VIDIOC_EXPBUF) when the capture 
+// starts. The descriptors are then available from the FrameLeases. Can only be changed while 
+// the device is not capturing
+bool Device::setDmaBufExportEnabled( bool enabled )
+{
+	std::lock_guard<std::recursive_mutex> lock( mCaptureMutex );
+	if ( isCapturing() )
+		return false;
+	mDmaBufExportEnabled = enabled;
+	return true;
+}
+
+bool Device::setCaptureThreadCpus( const std::vector<unsigned int>& cpus )
+{
+	std::lock_guard<std::recursive_mutex> lock( mCaptureMutex );
+	if ( isCapturing() )
+		return false;
+	for ( std::size_t i=0; i<cpus.size(); ++i )
+	{
+		if ( cpus[i]>=CPU_SETSIZE )
+			return false;
+	}
+	mCaptureThreadCpus = cpus;
+	return true;
+}
+
+bool Device::setCaptureThreadPriority( int priority )
+{
+	std::lock_guard<std::recursive_mutex> lock( mCaptureMutex );
+	if ( isCapturing() )
+		return false;
+	if ( priority<0 || priority>sched_get_priority_max( SCHED_FIFO ) )
+		return false;
+	mCaptureThreadPriority = priority;
+	return true;
+}
+
+bool Device::setMemoryLockingEnabled( bool enabled )
+{
+	std::lock_guard<std::recursive_mutex> lock( mCaptureMutex );
+	if ( isCapturing() )
+		return false;
+	mMemoryLockingEnabled = enabled;
+	return true;
+}
+
+// Can be changed while capturing
+bool Device::setDeliveryDecimation( unsigned int frameDivider, float maxRateInHz )
+{
+	if ( maxRateInHz<0.f )
+		return false;
+	std::lock_guard<std::mutex> lock( mListenersMutex );
+	mDeliveryDecimator.setFrameDivider( frameDivider );
+	mDeliveryDecimator.setMaxRateInHz( maxRateInHz );
+	return true;
+}
+
+unsigned int Device::getDeliveryFrameDivider() const
+{
+	std::lock_guard<std::mutex> lock( mListenersMutex );
+	return mDeliveryDecimator.getFrameDivider();
+}
+
+float Device::getDeliveryMaxRateInHz() const
+{
+	std::lock_guard<std::mutex> lock( mListenersMutex );
+	return mDeliveryDecimator.getMaxRateInHz();
+}
+
+// The decimation schedules start over with each capture
+void Device::resetDecimation()
+{
+	std::lock_guard<std::mutex> lock( mListenersMutex );
+	mDeliveryDecimator.reset();
+	mNumUndeliveredDroppedFrames = 0;
+	for ( ListenerDecimators::iterator itr=mListenerDecimators.begin(); itr!=mListenerDecimators.end(); ++itr )
+		itr->second.reset();
+}
+
+// Publish every captured image into a ring, from which a consumer thread can pop them 
+// at its own pace. The ring is not owned by the Device and is closed when the capture 
+// stops. It can only be changed while the device is not capturing (NULL to detach it)
+bool Device::setFrameRing( FrameRing* frameRing )
+{
+	std::lock_guard<std::recursive_mutex> lock( mCaptureMutex );
+	if ( isCapturing() )
+		return false;
+	mFrameRing = frameRing;
+	return true;
+}
+
+int64_t Device::getMonotonicTimeInNs()
+{
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return static_cast<int64_t>(now.tv_sec) * 1000000000LL + now.tv_nsec;
+}
+
+float Device::getMeasuredBufferHoldTimeInSec() const
+{
+	return static_cast<float>(mMeasuredBufferHoldTimeInNs) / 1e9f;
+}
+
+// Enough buffers for the driver to always have one to fill (plus one being filled) while 
+// the others are held by the consumers for the measured time. Without measurement 
+// (first capture) or known frame interval, we fall back to the balanced count
+unsigned int Device::getAutoBufferCount( float frameIntervalInS ) const
+{
+	float holdTimeInS = getMeasuredBufferHoldTimeInSec();
+	if ( holdTimeInS<=0.f || frameIntervalInS<=0.f )
+		return BalancedBufferCount;
+	
+	unsigned int numHeldBuffers = static_cast<unsigned int>( ceilf( holdTimeInS / frameIntervalInS ) );
+	unsigned int bufferCount = LowLatencyBufferCount + numHeldBuffers;
+	return bufferCount<mMaxAutoBufferCount ? bufferCount : mMaxAutoBufferCount;
+}
+
+bool Device::startCapture( std::size_t captureSettingsIndex, unsigned int bufferCount )
+{
+	bool isStartNotified = false;
+	return startCapture( captureSettingsIndex, bufferCount, isStartNotified );
+}
+
+// isStartNotified tells whether onDeviceStarted() was sent, even though the start failed 
+// afterwards (the capture thread couldn't be launched, the capture is then reported stopped)
+bool Device::startCapture( std::size_t captureSettingsIndex, unsigned int bufferCount, bool& isStartNotified )
+{
+	isStartNotified = false;
+	std::lock_guard<std::recursive_mutex> lock( mCaptureMutex );
+	if ( isCapturing() )
+		return false;
+
+	if ( captureSettingsIndex>=mCaptureSettingsList.size() )
+		return false;
+
+	// Only driver buffers can be exported
+	if ( mDmaBufExportEnabled && isUsingUserBuffers() )
+	{
+		fprintf( stderr, "Buffers of device %s can't be exported when capturing into user buffers\n", mDeviceName.c_str() );
+		return false;
+	}
+
+	if ( !setCaptureFormat( captureSettingsIndex ) )
+		return false;
+
+	mHasLastSequenceNumber = false;
+	mNumQueuedBuffers = 0;
+	mLastDequeueTimeInNs = 0;
+	mStatistics.reset();
+	resetDecimation();
+	if ( !allocateBuffers( bufferCount ) || !startStreaming() )
+	{
+		releaseBuffers( false );
+		return false;
+	}
+	
+	// Capture indicator
+	mIsCapturing = true;
+	if ( mFrameRing )
+		mFrameRing->open();
+	startListenerDispatch();
+	
+	// Notify
+	notifyListeners( &Listener::onDeviceStarted );
+	isStartNotified = true;
+
+	// Images are delivered from now on
+	if ( mUpdateMode==ThreadedUpdate && !startCaptureThread() )
+	{
+		stopCapture();
+		return false;
+	}
+
+	return true;
+}
+
+bool Device::stopCapture()
+{
+	std::lock_guard<std::recursive_mutex> lock( mCaptureMutex );
+	if ( !isCapturing() )
+		return true;
+
+	stopDelivery();
+	if ( !stopStreaming() )
+		return false;
+
+	// Capture indicator
+	mIsCapturing = false;
+	releaseBuffers( false );
+	
+	// Notify
+	notifyListeners( &Listener::onDeviceStopped );
+	return true;
+}
+
+// Switch a running capture to other capture settings, keeping the same number of buffers. 
+// Streaming has to be stopped and the driver buffers reallocated, but the buffer list, the 
+// leases nobody holds and the CapturedImage are kept (along with its memory in CopyDelivery mode when the 
+// new images aren't larger) and the frame interval is only set if it changes. The capture 
+// thread is stopped during the switch and started again, whereas a CaptureManager keeps 
+// watching the device. The listeners are told with onDeviceReconfigured() rather than 
+// being told it stopped. If the device isn't capturing, this simply starts the capture.
+// On failure, the capture is stopped
+bool Device::reconfigure( std::size_t captureSettingsIndex )
+{
+	std::lock_guard<std::recursive_mutex> lock( mCaptureMutex );
+	if ( !isCapturing() )
+		return startCapture( captureSettingsIndex );
+	
+	if ( captureSettingsIndex>=mCaptureSettingsList.size() )
+		return false;
+	if ( captureSettingsIndex==mCaptureSettingsIndex )
+		return true;
+
+	unsigned int bufferCount = mNumBuffers;
+	stopDelivery();
+	bool ret = stopStreaming();
+	if ( ret )
+	{
+		releaseBuffers( true );
+		mHasLastSequenceNumber = false;		// The driver restarts counting on STREAMON
+		mLastDequeueTimeInNs = 0;
+		resetDecimation();
+		ret = setCaptureFormat( captureSettingsIndex ) && allocateBuffers( bufferCount ) && startStreaming();
+	}
+	if ( !ret )
+	{
+		fprintf( stderr, "Failed to reconfigure the capture of device %s, stopping it\n", mDeviceName.c_str() );
+		releaseBuffers( false );
+		mIsCapturing = false;
+		notifyListeners( &Listener::onDeviceStopped );
+		return false;
+	}
+
+	if ( mFrameRing )
+		mFrameRing->open();
+	startListenerDispatch();
+	notifyListeners( &Listener::onDeviceReconfigured );
+	if ( mUpdateMode==ThreadedUpdate && !startCaptureThread() )
+	{
+		stopCapture();
+		return false;
+	}
+	return true;
+}
+
+bool Device::startCaptureAsync( std::size_t captureSettingsIndex, unsigned int bufferCount )
+{
+	if ( !isValid() || captureSettingsIndex>=mCaptureSettingsList.size() )
+		return false;
+
+	AsyncOperation operation;
+	operation.isStart = true;
+	operation.captureSettingsIndex = captureSettingsIndex;
+	operation.bufferCount = bufferCount;
+	std::lock_guard<std::mutex> lock( mAsyncMutex );
+	if ( !mAsyncThread.joinable() )
+		mAsyncThread = std::thread( &Device::asyncThreadMain, this );
+	mAsyncOperations.push_back( operation );
+	mAsyncCondition.notify_one();
+	return true;
+}
+
+bool Device::stopCaptureAsync()
+{
+	AsyncOperation operation;
+	operation.isStart = false;
+	operation.captureSettingsIndex = 0;
+	operation.bufferCount = 0;
+	std::lock_guard<std::mutex> lock( mAsyncMutex );
+	if ( !mAsyncThread.joinable() )
+		mAsyncThread = std::thread( &Device::asyncThreadMain, this );
+	mAsyncOperations.push_back( operation );
+	mAsyncCondition.notify_one();
+	return true;
+}
+
+bool Device::isCaptureOperationPending() const
+{
+	std::lock_guard<std::mutex> lock( mAsyncMutex );
+	return mIsAsyncOperationRunning || !mAsyncOperations.empty();
+}
+
+// Operations not started yet are dropped, the one running is waited for
+void Device::stopAsyncThread()
+{
+	{
+		std::lock_guard<std::mutex> lock( mAsyncMutex );
+		if ( !mAsyncThread.joinable() )
+			return;
+		mIsAsyncThreadExiting = true;
+		mAsyncOperations.clear();
+		mAsyncCondition.notify_one();
+	}
+	mAsyncThread.join();
+	mIsAsyncThreadExiting = false;
+}
+
+void Device::asyncThreadMain()
+{
+	std::unique_lock<std::mutex> lock( mAsyncMutex );
+	for ( ;; )
+	{
+		while ( mAsyncOperations.empty() && !mIsAsyncThreadExiting )
+			mAsyncCondition.wait( lock );
+		if ( mIsAsyncThreadExiting )
+			return;
+
+		AsyncOperation operation = mAsyncOperations.front();
+		mAsyncOperations.pop_front();
+		mIsAsyncOperationRunning = true;
+		lock.unlock();
+
+		// Each request gets exactly one answer. Starting an already running capture (or stopping
+		// a stopped one) isn't a failure, the listeners are told it's done
+		std::unique_lock<std::recursive_mutex> captureLock( mCaptureMutex );
+		if ( operation.isStart )
+		{
+			bool isStartNotified = false;
+			if ( isCapturing() )
+				notifyListeners( &Listener::onDeviceStarted );
+			else if ( !startCapture( operation.captureSettingsIndex, operation.bufferCount, isStartNotified ) && !isStartNotified )
+				notifyListeners( &Listener::onDeviceStartFailed );
+		}
+		else if ( isCapturing() )
+		{
+			stopCapture();
+		}
+		else
+		{
+			notifyListeners( &Listener::onDeviceStopped );
+		}
+		captureLock.unlock();
+
+		lock.lock();
+		mIsAsyncOperationRunning = false;
+	}
+}
+
+// Set the image format and frame interval of the capture settings on the driver, and retrieve
+// the memory layout of the images
+bool Device::setCaptureFormat( std::size_t captureSettingsIndex )
+{
+	// Retrieve CaptureSettings
+	const CaptureSettings& captureSettings = mCaptureSettingsList[captureSettingsIndex];
+	
+	// Retrieve corresponding InternalCaptureSettings
+	std::size_t internalCaptureSettingsIndex = mCaptureSettingsToInternalCaptureSettingsIndices[captureSettingsIndex];
+	const InternalCaptureSettings& internalCaptureSettings = mInternalCaptureSettingsList[internalCaptureSettingsIndex];
+
+	// Prepare a V4L2 format struct for the capture (we should probably read it from the hardware 
+	// and modify it rather than creating a cleared one)
+	struct v4l2_format fmt;
+	CLEAR(fmt);
+	fmt.type = getBufferType();
+	if ( mIsMultiPlanar )
+	{
+		fmt.fmt.pix_mp.width = internalCaptureSettings.width;
+		fmt.fmt.pix_mp.height = internalCaptureSettings.height;
+		fmt.fmt.pix_mp.pixelformat = internalCaptureSettings.pixelFormat;
+	}
+	else
+	{
+		fmt.fmt.pix.width = internalCaptureSettings.width;
+		fmt.fmt.pix.height = internalCaptureSettings.height;
+		fmt.fmt.pix.pixelformat = internalCaptureSettings.pixelFormat;
+	}
+    //fmt.fmt.pix.field = ???
+	if ( mBackend->ioctl( VIDIOC_S_FMT, &fmt )==-1 )		
+	{
+		fprintf( stderr, "VIDIOC_S_FMT failed for device %s\n", mDeviceName.c_str() );
+		return false;	
+	}
+
+	// Check that we've got what we wanted
+	if ( mBackend->ioctl( VIDIOC_G_FMT, &fmt )==-1 )		
+	{
+		fprintf( stderr, "VIDIOC_G_FMT failed for device %s\n", mDeviceName.c_str() );
+		return false;	
+	}
+	unsigned int width = mIsMultiPlanar ? fmt.fmt.pix_mp.width : fmt.fmt.pix.width;
+	unsigned int height = mIsMultiPlanar ? fmt.fmt.pix_mp.height : fmt.fmt.pix.height;
+	unsigned int pixelFormat = mIsMultiPlanar ? fmt.fmt.pix_mp.pixelformat : fmt.fmt.pix.pixelformat;
+	if ( width != internalCaptureSettings.width ||
+		 height != internalCaptureSettings.height ||
+		 pixelFormat != internalCaptureSettings.pixelFormat )
+	{
+		fprintf( stderr, "Failed to set the capture format for device %s\n", mDeviceName.c_str() );
+		return false;	
+	}
+
+	// Retrieve the memory layout of the buffers, one or several planes
+	unsigned int numPlanes = mIsMultiPlanar ? fmt.fmt.pix_mp.num_planes : 1;
+	if ( numPlanes==0 || numPlanes>Image::MaxNumPlanes )
+	{
+		fprintf( stderr, "The capture format of device %s uses %d planes which is unsupported by the implementation\n", mDeviceName.c_str(), numPlanes );
+		return false;
+	}
+	unsigned int imageSize = 0;
+	for ( unsigned int planeIndex=0; planeIndex<numPlanes; ++planeIndex )
+	{
+		mPlaneSizesInBytes[planeIndex] = mIsMultiPlanar ? fmt.fmt.pix_mp.plane_fmt[planeIndex].sizeimage : fmt.fmt.pix.sizeimage;
+		mPlaneBytesPerLine[planeIndex] = mIsMultiPlanar ? fmt.fmt.pix_mp.plane_fmt[planeIndex].bytesperline : fmt.fmt.pix.bytesperline;
+		imageSize += mPlaneSizesInBytes[planeIndex];
+	}
+	
+	// Check that the hardware will provide us with images of the expected size
+	if ( imageSize!=captureSettings.getImageFormat().getDataSizeInBytes() )
+	{
+		fprintf( stderr, "The image size that %s provides for the capture (%d) is not the expected one (%d)\n", mDeviceName.c_str(), imageSize, captureSettings.getImageFormat().getDataSizeInBytes());
+		return false;
+	}
+	mNumPlanes = numPlanes;
+
+	// Specify the frame interval
+    if ( internalCaptureSettings.frameIntervalNumerator!=0 &&
+         internalCaptureSettings.frameIntervalDenominator!=0 )
+	{
+		struct v4l2_streamparm parm;
+		CLEAR(parm);
+		parm.type = getBufferType();
+
+		// Setting the interval can be slow (a USB control transfer for UVC devices), so it
+		// is skipped when the driver already uses the right one
+		if ( mBackend->ioctl( VIDIOC_G_PARM, &parm )==-1 ||
+			 parm.parm.capture.timeperframe.numerator != internalCaptureSettings.frameIntervalNumerator ||
+			 parm.parm.capture.timeperframe.denominator != internalCaptureSettings.frameIntervalDenominator )
+		{
+			CLEAR(parm);
+			parm.type = getBufferType();
+			parm.parm.capture.timeperframe.numerator = internalCaptureSettings.frameIntervalNumerator;
+			parm.parm.capture.timeperframe.denominator = internalCaptureSettings.frameIntervalDenominator;
+			if ( mBackend->ioctl( VIDIOC_S_PARM, &parm )==-1 )		
+			{
+				fprintf( stderr, "VIDIOC_S_PARM failed for device %s\n", mDeviceName.c_str() );
+				return false;	
+			}
+			
+			// Check that we've got what we wanted
+			if ( mBackend->ioctl( VIDIOC_G_PARM, &parm )==-1 )		
+			{
+				fprintf( stderr, "VIDIOC_G_PARM failed for device %s\n", mDeviceName.c_str() );
+				return false;	
+			}
+			if ( parm.parm.capture.timeperframe.numerator != internalCaptureSettings.frameIntervalNumerator ||
+				 parm.parm.capture.timeperframe.denominator != internalCaptureSettings.frameIntervalDenominator )
+			{
+				fprintf( stderr, "Failed to set the frame interval for device %s\n", mDeviceName.c_str() );
+				return false;
+			}
+		}
+	}
+	else
+	{
+		fprintf( stderr, "VIDIOC_S_PARM not specified for device %s\n", mDeviceName.c_str() );
+	}
+
+	mCaptureSettingsIndex = captureSettingsIndex;
+	return true;
+}
+
+// Request the driver buffers for the current capture settings and make them accessible. The 
+// buffer list, the leases and the CapturedImage left by releaseBuffers( true ) are reused
+bool Device::allocateBuffers( unsigned int bufferCount )
+{
+	const CaptureSettings& captureSettings = mCaptureSettingsList[mCaptureSettingsIndex];
+	std::size_t internalCaptureSettingsIndex = mCaptureSettingsToInternalCaptureSettingsIndices[mCaptureSettingsIndex];
+	const InternalCaptureSettings& internalCaptureSettings = mInternalCaptureSettingsList[internalCaptureSettingsIndex];
+
+	// Request buffers for MMAP or USERPTR transfer
+	struct v4l2_requestbuffers req;
+	CLEAR(req);
+	if ( isUsingUserBuffers() )
+		bufferCount = static_cast<unsigned int>( mUserBuffers.size() );
+	else if ( bufferCount==AutoBufferCount )
+		bufferCount = getAutoBufferCount( internalCaptureSettings.getFrameIntervalInS() );
+    req.count = bufferCount;
+	req.type = getBufferType();
+    req.memory = getMemoryType();
+	if ( mBackend->ioctl( VIDIOC_REQBUFS, &req )==-1 ) 
+	{
+        if ( EINVAL==errno ) 
+		{
+			fprintf( stderr, "Failed to request %s buffers for device %s\n", isUsingUserBuffers() ? "USERPTR" : "MMAP", mDeviceName.c_str() );
+			return false; 
+		}
+		else
+		{
+			fprintf( stderr, "VIDIOC_REQBUFS failed for device %s\n", mDeviceName.c_str() );
+			return false;
+		}
+	}
+	
+	
+	// Allocate the list of buffers (unless the previous one is large enough)
+	unsigned int numBuffers = std::min( req.count, bufferCount );
+	if ( numBuffers<2 ) 
+	{
+		fprintf( stderr, "Insufficient buffer memory for device %s\n", mDeviceName.c_str() );
+		return false;
+	}
+	
+	assert( mNumBuffers==0 );
+	if ( numBuffers>mMaxNumBuffers )
+	{
+		free( mBuffers );
+		mBuffers = (buffer*)calloc( numBuffers, sizeof(*mBuffers) );
+		if ( !mBuffers )
+		{
+			fprintf( stderr, "Out of memory\n" );
+			mMaxNumBuffers = 0;
+			return false;
+		}
+		mMaxNumBuffers = numBuffers;
+	}
+	for ( unsigned int bufferIndex=0; bufferIndex<numBuffers; ++bufferIndex ) 
+	{
+		for ( unsigned int planeIndex=0; planeIndex<Image::MaxNumPlanes; ++planeIndex )
+		{
+			bufferPlane& plane = mBuffers[bufferIndex].planes[planeIndex];
+			plane.start = NULL;
+			plane.length = 0;
+			plane.dmaBufFd = -1;
+		}
+		mBuffers[bufferIndex].dequeueTimeInNs = 0;
+	}
+	mNumBuffers = numBuffers;
+
+	// Map memory buffer, or use the ones the application provided
+	bool buffersReady = isUsingUserBuffers() ? useUserBuffers( mBuffers, mNumBuffers ) : mapBuffers( mBuffers, mNumBuffers );
+	if ( !buffersReady )
+		return false;	
+
+	// Create one lease per buffer, each of them viewing the buffer memory directly. The leases 
+	// of a previous configuration are reused, except the ones client code still held (retired
+	// by releaseBuffers())
+	const ImageFormat& imageFormat = captureSettings.getImageFormat();
+	for ( std::size_t i=mNumBuffers; i<mFrameLeases.size(); ++i )
+		delete mFrameLeases[i];
+	mFrameLeases.resize( mNumBuffers, NULL );
+	unsigned char* planeBytes[Image::MaxNumPlanes];
+	for ( unsigned int bufferIndex=0; bufferIndex<mNumBuffers; ++bufferIndex ) 
+	{
+		for ( unsigned int planeIndex=0; planeIndex<mNumPlanes; ++planeIndex )
+			planeBytes[planeIndex] = static_cast<unsigned char*>(mBuffers[bufferIndex].planes[planeIndex].start);
+		FrameLease* frameLease = mFrameLeases[bufferIndex];
+		if ( frameLease )
+		{
+			frameLease->mCapturedImage.getImage().setFormat( imageFormat );
+			frameLease->mCapturedImage.getImage().attachPlanes( planeBytes, mPlaneSizesInBytes, mNumPlanes );
+		}
+		else
+		{
+			frameLease = new FrameLease( this, bufferIndex, imageFormat, planeBytes, mPlaneSizesInBytes, mNumPlanes );
+			mFrameLeases[bufferIndex] = frameLease;
+		}
+		frameLease->mGeneration = mBufferGeneration;
+		frameLease->mNumReferences = 0;
+		frameLease->mPixelFormat = internalCaptureSettings.pixelFormat;
+		for ( unsigned int planeIndex=0; planeIndex<Image::MaxNumPlanes; ++planeIndex )
+		{
+			frameLease->mDmaBufFds[planeIndex] = -1;
+			frameLease->mBytesPerLine[planeIndex] = planeIndex<mNumPlanes ? mPlaneBytesPerLine[planeIndex] : 0;
+			frameLease->mBytesUsed[planeIndex] = 0;
+		}
+	}
+
+	// Export the buffers for zero-copy sharing if requested
+	if ( mDmaBufExportEnabled && !exportBuffers() )
+		return false;
+
+	// Construct CapturedImage to receive image data. In zero-copy mode, it gets attached 
+	// to the buffer just dequeued on each capture (and initially points to the first one)
+	for ( unsigned int planeIndex=0; planeIndex<mNumPlanes; ++planeIndex )
+		planeBytes[planeIndex] = static_cast<unsigned char*>(mBuffers[0].planes[planeIndex].start);
+	if ( mCapturedImage )
+	{
+		mCapturedImage->getImage().setFormat( imageFormat );
+		if ( mDeliveryMode==ZeroCopyDelivery )
+			mCapturedImage->getImage().attachPlanes( planeBytes, mPlaneSizesInBytes, mNumPlanes );
+	}
+	else if ( mDeliveryMode==CopyDelivery )
+	{
+		mCapturedImage = new CapturedImage( imageFormat );
+	}
+	else
+	{
+		mCapturedImage = new CapturedImage( imageFormat, planeBytes, mPlaneSizesInBytes, mNumPlanes );
+	}
+
+	if ( mMemoryLockingEnabled )
+		lockBuffers();
+	return true;
+}
+
+// Lock the driver buffers and the memory of the CapturedImage in RAM, and fault their pages in
+// now rather than on the first images. User buffers are only prefaulted, locking them is up to 
+// the application. A failure (typically the RLIMIT_MEMLOCK limit) only costs the guarantee
+void Device::lockBuffers()
+{
+	assert( mLockedMemoryRanges.empty() );
+	std::vector<std::pair<void*, std::size_t> > ranges;
+	if ( !isUsingUserBuffers() )
+	{
+		for ( unsigned int i=0; i<mNumBuffers; ++i )
+		{
+			for ( unsigned int j=0; j<mNumPlanes; ++j )
+				ranges.push_back( std::make_pair( mBuffers[i].planes[j].start, mBuffers[i].planes[j].length ) );
+		}
+	}
+	if ( mDeliveryMode==CopyDelivery )
+	{
+		MemoryBuffer& buffer = mCapturedImage->getImage().getBuffer();
+		ranges.push_back( std::make_pair( static_cast<void*>(buffer.getBytes()), buffer.getSizeInBytes() ) );
+	}
+	for ( std::size_t i=0; i<ranges.size(); ++i )
+	{
+		if ( mlock( ranges[i].first, ranges[i].second )==-1 )
+		{
+			fprintf( stderr, "Failed to lock the capture memory of device %s in RAM. %s (%d)\n", mDeviceName.c_str(), strerror(errno), errno );
+			break;
+		}
+		mLockedMemoryRanges.push_back( ranges[i] );
+	}
+
+	// mlock() already populates regular mappings, but not necessarily driver ones. The driver 
+	// memory is only read by the CPU, the CapturedImage is written into
+	long pageSize = sysconf( _SC_PAGESIZE );
+	for ( unsigned int i=0; i<mNumBuffers; ++i )
+	{
+		for ( unsigned int j=0; j<mNumPlanes; ++j )
+		{
+			const volatile unsigned char* bytes = static_cast<const volatile unsigned char*>(mBuffers[i].planes[j].start);
+			for ( std::size_t offset=0; offset<mBuffers[i].planes[j].length; offset+=pageSize )
+				(void)bytes[offset];
+		}
+	}
+	if ( mDeliveryMode==CopyDelivery )
+	{
+		MemoryBuffer& buffer = mCapturedImage->getImage().getBuffer();
+		memset( buffer.getBytes(), 0, buffer.getSizeInBytes() );
+	}
+}
+
+void Device::unlockBuffers()
+{
+	for ( std::size_t i=0; i<mLockedMemoryRanges.size(); ++i )
+		munlock( mLockedMemoryRanges[i].first, mLockedMemoryRanges[i].second );
+	mLockedMemoryRanges.clear();
+}
+
+// Release the driver buffers. With keepAllocations, the buffer list, the leases and the 
+// CapturedImage are kept for the next allocateBuffers() call
+void Device::releaseBuffers( bool keepAllocations )
+{
+	// From now on, releasing a lease doesn't give its buffer back anymore. The leases client 
+	// code still holds are retired, they get destroyed with their last reference
+	{
+		std::lock_guard<std::mutex> lock( mLeaseMutex );
+		mBufferGeneration++;
+		for ( std::size_t i=0; i<mFrameLeases.size(); ++i )
+		{
+			if ( mFrameLeases[i] && mFrameLeases[i]->mNumReferences>0 )
+			{
+				mRetiredFrameLeases.push_back( mFrameLeases[i] );
+				mFrameLeases[i] = NULL;
+			}
+		}
+	}
+
+	unlockBuffers();
+
+	// Unmap buffers (user buffers belong to the application)
+	for ( unsigned int i=0; i<mNumBuffers; ++i )				
+	{
+		for ( unsigned int j=0; j<mNumPlanes; ++j )
+		{
+			bufferPlane& plane = mBuffers[i].planes[j];
+			if ( plane.dmaBufFd!=-1 )
+				close( plane.dmaBufFd );
+			plane.dmaBufFd = -1;
+
+			if ( !isUsingUserBuffers() && plane.start && mBackend->munmap( plane.start, plane.length )==-1 )
+				fprintf( stderr, "MUNMAP failed for device %s\n", mDeviceName.c_str() );
+			plane.start = NULL;
+		}
+	}
+
+	// Let the driver release its buffers (or unpin the user ones)
+	struct v4l2_requestbuffers req;
+	CLEAR(req);
+	req.count = 0;
+	req.type = getBufferType();
+	req.memory = getMemoryType();
+	if ( mBackend->ioctl( VIDIOC_REQBUFS, &req )==-1 ) 
+		fprintf( stderr, "VIDIOC_REQBUFS failed to release the buffers of device %s\n", mDeviceName.c_str() );
+	mNumBuffers = 0;
+	mDispatchedFrameLease = NULL;
+	if ( keepAllocations )
+		return;
+
+	// Destroy the leases nobody holds
+	for ( std::size_t i=0; i<mFrameLeases.size(); ++i )
+		delete mFrameLeases[i];
+	mFrameLeases.clear();
+
+	// Free the list of buffers
+	free( mBuffers );
+	mBuffers = NULL;
+	mMaxNumBuffers = 0;
+	mNumPlanes = 0;
+
+	// Free the CapturedImage object
+	delete mCapturedImage;
+	mCapturedImage = NULL;
+}
+
+bool Device::startStreaming()
+{
 	// Initiate memory mapping with previous buffers
-    for ( int bufferIndex=0; bufferIndex<numBuffers; ++bufferIndex ) 
+    for ( unsigned int bufferIndex=0; bufferIndex<mNumBuffers; ++bufferIndex ) 
+	{
+		if ( !queueBuffer( bufferIndex ) )
+			return false;	
+	}
+	
+	// Start streaming/capture
+    enum v4l2_buf_type type;
+	type = static_cast<v4l2_buf_type>( getBufferType() );
+	if ( mBackend->ioctl( VIDIOC_STREAMON, &type)==-1 )
+	{
+		fprintf( stderr, "VIDIOC_STREAMON failed for device %s\n", mDeviceName.c_str() );
+		return false;			
+	}
+	return true;
+}
+
+bool Device::stopStreaming()
+{
+	enum v4l2_buf_type type;
+	type = static_cast<v4l2_buf_type>( getBufferType() );
+	if ( mBackend->ioctl( VIDIOC_STREAMOFF, &type )==-1 )
+	{
+		// An unplugged device refuses to stop, but it won't use the buffers anymore: they 
+		// can be released all the same
+		if ( !mIsDisconnected && errno!=ENODEV )
+		{
+			fprintf( stderr, "VIDIOC_STREAMOFF failed for device %s\n", mDeviceName.c_str() );
+			return false;
+		}
+	}
+	mNumQueuedBuffers = 0;		// STREAMOFF returned all the buffers
+	return true;
+}
+
+// No image must be delivered while the buffers get released. Closing the rings first 
+// unblocks the capture thread if it waits for a consumer
+void Device::stopDelivery()
+{
+	if ( mFrameRing )
+		mFrameRing->close();
+	{
+		std::lock_guard<std::mutex> lock( mListenersMutex );
+		for ( QueuedListeners::const_iterator itr=mQueuedListeners.begin(); itr!=mQueuedListeners.end(); ++itr )
+			(*itr)->queue.close();
+	}
+	stopCaptureThread();
+	stopListenerDispatch();
+	if ( mFrameRing )
+		mFrameRing->clear();
+}
+
+bool Device::mapBuffers( struct buffer* buffers, unsigned int numBuffers )
+{
+	for ( unsigned int bufferIndex=0; bufferIndex<numBuffers; ++bufferIndex ) 
 	{
+		struct v4l2_plane planes[VIDEO_MAX_PLANES];
 		struct v4l2_buffer buf;
+		CLEAR(planes);
 		CLEAR(buf);
-		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		buf.memory = V4L2_MEMORY_MMAP;
-		buf.index = bufferIndex;
-		if ( xioctl( mHandle, VIDIOC_QBUF, &buf )==-1 )
+		buf.type = getBufferType();
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = bufferIndex;
+		if ( mIsMultiPlanar )
 		{
-			fprintf( stderr, "VIDIOC_QBUF failed for device %s\n", mDeviceName.c_str() );
-			// Note: aquired resources should be properly released here!
-			return false;	
+			buf.m.planes = planes;
+			buf.length = VIDEO_MAX_PLANES;
 		}
-	}
-	
-	// Start streaming/capture
-    enum v4l2_buf_type type;
-	type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	if ( xioctl( mHandle, VIDIOC_STREAMON, &type)==-1 )
-	{
-		fprintf( stderr, "VIDIOC_STREAMON failed for device %s\n", mDeviceName.c_str() );
-		// Note: aquired resources should be properly released here!
-		return false;			
-	}
-	
-	// Capture indicator
-	mIsCapturing = true;
 
-	// Update buffer members from local variables
-	assert( mNumBuffers==0);
-	assert( !mBuffers );
-	mNumBuffers = numBuffers;
-	mBuffers = buffers;
-	
-	// Notify
-	for ( Listeners::const_iterator itr=mListeners.begin(); itr!=mListeners.end(); ++itr )
-		(*itr)->onDeviceStarted( this );
+		if ( mBackend->ioctl( VIDIOC_QUERYBUF, &buf )==-1 )
+		{
+			fprintf( stderr, "VIDIOC_QUERYBUF failed for device %s\n", mDeviceName.c_str() );
+			return false;	
+		}
 
+		for ( unsigned int planeIndex=0; planeIndex<mNumPlanes; ++planeIndex )
+		{
+			bufferPlane& plane = buffers[bufferIndex].planes[planeIndex];
+			plane.length = mIsMultiPlanar ? planes[planeIndex].length : buf.length;
+			plane.dmaBufFd = -1;
+			off_t offset = mIsMultiPlanar ? planes[planeIndex].m.mem_offset : buf.m.offset;
+			plane.start = mBackend->mmap( plane.length, offset );
+			if ( plane.start==MAP_FAILED )
+			{
+				plane.start = NULL;
+				fprintf( stderr, "MMAP failed for device %s\n", mDeviceName.c_str() );
+				return false;	
+			}
+		}
+	}
 	return true;
 }
 
-bool Device::stopCapture()
+// Each user buffer is split into page-aligned planes when the format uses several of them
+bool Device::useUserBuffers( struct buffer* buffers, unsigned int numBuffers )
 {
-	if ( !isCapturing() )
-		return true;
-
-	// Stop streaming/capture
-	enum v4l2_buf_type type;
-	type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	if ( xioctl( mHandle, VIDIOC_STREAMOFF, &type )==-1 )
+	std::size_t pageSize = static_cast<std::size_t>( sysconf( _SC_PAGESIZE ) );
+	std::size_t planeOffsets[Image::MaxNumPlanes];
+	std::size_t offset = 0;
+	for ( unsigned int planeIndex=0; planeIndex<mNumPlanes; ++planeIndex )
+	{
+		planeOffsets[planeIndex] = offset;
+		offset += ( (mPlaneSizesInBytes[planeIndex] + pageSize - 1) / pageSize ) * pageSize;
+	}
+	std::size_t lastPlaneSize = mPlaneSizesInBytes[mNumPlanes-1];
+	if ( planeOffsets[mNumPlanes-1] + lastPlaneSize > mUserBufferLength )
 	{
-		fprintf( stderr, "VIDIOC_STREAMOFF failed for device %s\n", mDeviceName.c_str() );
+		fprintf( stderr, "User buffers of %d bytes are too small for the images of device %s (%d bytes)\n", static_cast<int>(mUserBufferLength), mDeviceName.c_str(), static_cast<int>(planeOffsets[mNumPlanes-1] + lastPlaneSize) );
 		return false;
 	}
 
-	// Unmap buffers
-	for ( int i=0; i<mNumBuffers; ++i )				
+	assert( numBuffers<=mUserBuffers.size() );
+	for ( unsigned int bufferIndex=0; bufferIndex<numBuffers; ++bufferIndex ) 
 	{
-		if ( munmap(mBuffers[i].start, mBuffers[i].length)==-1 )
+		for ( unsigned int planeIndex=0; planeIndex<mNumPlanes; ++planeIndex )
 		{
-			fprintf( stderr, "MUNMAP failed for device %s\n", mDeviceName.c_str() );
-			// Note: aquired resources should be properly released here!
-			return false;
+			bufferPlane& plane = buffers[bufferIndex].planes[planeIndex];
+			plane.start = static_cast<unsigned char*>(mUserBuffers[bufferIndex]) + planeOffsets[planeIndex];
+			plane.length = planeIndex+1<mNumPlanes ? planeOffsets[planeIndex+1] - planeOffsets[planeIndex] : mUserBufferLength - planeOffsets[planeIndex];
+			plane.dmaBufFd = -1;
 		}
 	}
+	return true;
+}
 
-	// Free the list of buffers
-	free( mBuffers );
-	mBuffers = NULL;
-	mNumBuffers = 0;
-
-	// Free the CapturedImage object
-	delete mCapturedImage;
-	mCapturedImage = NULL;
+bool Device::exportBuffers()
+{
+	for ( unsigned int bufferIndex=0; bufferIndex<mNumBuffers; ++bufferIndex ) 
+	{
+		for ( unsigned int planeIndex=0; planeIndex<mNumPlanes; ++planeIndex )
+		{
+			struct v4l2_exportbuffer expbuf;
+			CLEAR(expbuf);
+			expbuf.type = getBufferType();
+			expbuf.index = bufferIndex;
+			expbuf.plane = planeIndex;
+			expbuf.flags = O_RDONLY | O_CLOEXEC;
+			if ( mBackend->ioctl( VIDIOC_EXPBUF, &expbuf )==-1 )
+			{
+				fprintf( stderr, "VIDIOC_EXPBUF failed for device %s. %s (%d)\n", mDeviceName.c_str(), strerror(errno), errno );
+				return false;
+			}
+			mBuffers[bufferIndex].planes[planeIndex].dmaBufFd = expbuf.fd;
+			mFrameLeases[bufferIndex]->mDmaBufFds[planeIndex] = expbuf.fd;
+		}
+	}
+	return true;
+}
 
-	// Capture indicator
-	mIsCapturing = false;
-	
-	// Notify
-	for ( Listeners::const_iterator itr=mListeners.begin(); itr!=mListeners.end(); ++itr )
-		(*itr)->onDeviceStopped( this );
+bool Device::queueBuffer( unsigned int bufferIndex )
+{
+	assert( bufferIndex<mNumBuffers );
 
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	struct v4l2_buffer buf;
+	CLEAR(planes);
+	CLEAR(buf);
+	buf.type = getBufferType();
+	buf.memory = getMemoryType();
+	buf.index = bufferIndex;
+	if ( mIsMultiPlanar )
+	{
+		buf.m.planes = planes;
+		buf.length = mNumPlanes;
+	}
+	if ( buf.memory==V4L2_MEMORY_USERPTR )
+	{
+		const bufferPlane* bufferPlanes = mBuffers[bufferIndex].planes;
+		if ( mIsMultiPlanar )
+		{
+			for ( unsigned int planeIndex=0; planeIndex<mNumPlanes; ++planeIndex )
+			{
+				planes[planeIndex].m.userptr = reinterpret_cast<unsigned long>( bufferPlanes[planeIndex].start );
+				planes[planeIndex].length = bufferPlanes[planeIndex].length;
+			}
+		}
+		else
+		{
+			buf.m.userptr = reinterpret_cast<unsigned long>( bufferPlanes[0].start );
+			buf.length = bufferPlanes[0].length;
+		}
+	}
+	if ( mBackend->ioctl( VIDIOC_QBUF, &buf )==-1 )
+	{
+		fprintf( stderr, "VIDIOC_QBUF failed for device %s\n", mDeviceName.c_str() );
+		return false;	
+	}
+	mNumQueuedBuffers++;
 	return true;
 }
 
-// If an image was read into the CapturedImage, notifies client code and return true.
-// Returns false if either no image was ready or an error occured
-bool Device::updateCapturedImage()
+// Dequeue the next captured image, if any, and deliver it. Returns false once there are no 
+// more images to dequeue. imageDelivered tells decimated frames apart
+bool Device::updateCapturedImage( bool& imageDelivered )
 {
+	imageDelivered = false;
 	assert( mCapturedImage );
 
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
 	struct v4l2_buffer buf;
-    unsigned int i;
+	CLEAR(planes);
     CLEAR(buf);
-	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = V4L2_MEMORY_MMAP;
-	if ( xioctl( mHandle, VIDIOC_DQBUF, &buf )==-1 ) 
+	buf.type = getBufferType();
+    buf.memory = getMemoryType();
+	if ( mIsMultiPlanar )
+	{
+		buf.m.planes = planes;
+		buf.length = mNumPlanes;
+	}
+	if ( mBackend->ioctl( VIDIOC_DQBUF, &buf )==-1 ) 
 	{
 		if ( errno==EAGAIN )
+		{
+			mStatistics.addDequeueRetry();
 			return false;		// No image is ready yet, this is a normal situation
+		}
 		//else if ( errno!=EIO ) 
 		//	return true;		// This might be an ignorable error (?)
+		if ( errno==ENODEV )
+		{
+			// The device is gone for good: report it once rather than failing on every wake-up
+			if ( !mIsDisconnected.exchange( true ) )
+			{
+				fprintf( stderr, "Device %s was disconnected\n", mDeviceName.c_str() );
+				notifyListeners( &Listener::onDeviceDisconnected );
+			}
+			return false;
+		}
 		fprintf( stderr, "VIDIOC_DQBUF failed for device %s\n", mDeviceName.c_str() );
 		return false; 
 	}
 	assert( buf.index<mNumBuffers );
+	int64_t dequeueTimeInNs = getMonotonicTimeInNs();
+	mBuffers[buf.index].dequeueTimeInNs = dequeueTimeInNs;
+	if ( mLastDequeueTimeInNs!=0 )
+		mStatistics.getFrameIntervalHistogram().record( static_cast<uint64_t>(dequeueTimeInNs - mLastDequeueTimeInNs) );
+	mLastDequeueTimeInNs = dequeueTimeInNs;
+	if ( mNumQueuedBuffers.fetch_sub( 1 )==1 )
+		mStatistics.addQueueUnderrun();
 	
-	unsigned char* sourceBytes = static_cast<unsigned char*>(mBuffers[buf.index].start);		// SHOULD BE unsignd char* directly
-	unsigned int numBytes = buf.bytesused;
-	MemoryBuffer& destBuffer = mCapturedImage->getImage().getBuffer();
-	bool ret = destBuffer.copyFrom( sourceBytes, numBytes );
-	if ( !ret )
+	// Update sequence number. The driver increments it for every frame it captures, 
+	// including the ones it had to drop. The step is compared in serial number arithmetic 
+	// so that the wrap-around still moves forward. A sequence that doesn't advance (a 
+	// driver that doesn't count, or restarted counting) tells nothing about drops
+	unsigned int numDroppedFrames = 0;
+	if ( mHasLastSequenceNumber )
 	{
-		fprintf( stderr, "Failed to copy image data from MMAP buffer to captured image for device %s\n", mDeviceName.c_str() );		
+		unsigned int sequenceStep = buf.sequence - mLastSequenceNumber;
+		if ( sequenceStep>1 && sequenceStep<0x80000000u )
+			numDroppedFrames = sequenceStep-1<mMaxSequenceGap ? sequenceStep-1 : mMaxSequenceGap;
+	}
+	mLastSequenceNumber = buf.sequence;
+	mHasLastSequenceNumber = true;
+	mStatistics.addDroppedFrames( numDroppedFrames );
+	int64_t timestampInNs = static_cast<int64_t>(buf.timestamp.tv_sec) * 1000000000LL + static_cast<int64_t>(buf.timestamp.tv_usec) * 1000LL;
+	int64_t decimationTimestampInNs = timestampInNs!=0 ? timestampInNs : mBuffers[buf.index].dequeueTimeInNs;
+
+	// The listeners are notified from a snapshot, without holding mListenersMutex
+	std::lock_guard<std::recursive_mutex> dispatchLock( mDispatchMutex );
+	bool hasConsumer = mFrameRing!=NULL;
+	{
+		std::lock_guard<std::mutex> lock( mListenersMutex );
 
-		// Re-queue the buffer we've just dequeued
-		if ( xioctl( mHandle, VIDIOC_QBUF, &buf )==-1 )
+		// Decimated frames go straight back to the driver, their data is never touched. The 
+		// frames dropped by the driver meanwhile are reported with the next delivered image
+		numDroppedFrames += mNumUndeliveredDroppedFrames;
+		mNumUndeliveredDroppedFrames = 0;
+		if ( !mDeliveryDecimator.keepFrame( decimationTimestampInNs ) )
 		{
-			fprintf( stderr, "VIDIOC_QBUF failed for device %s\n", mDeviceName.c_str() );
-			return false;	
-		}	
+			mNumUndeliveredDroppedFrames = numDroppedFrames;
+			mStatistics.addDecimatedFrame();
+			queueBuffer( buf.index );
+			imageDelivered = false;
+			return true;
+		}
 
-		return false;
+		// Find out who gets the image
+		mDispatchedListeners.clear();
+		for ( std::size_t i=0; i<mListeners.size(); ++i )
+		{
+			DispatchedListener dispatchedListener;
+			dispatchedListener.listener = mListeners[i];
+			dispatchedListener.queuedListener = findQueuedListener( mListeners[i] );
+			ListenerDecimators::iterator itr = mListenerDecimators.find( mListeners[i] );
+			dispatchedListener.isDelivered = mListeners[i]->consumesImages() && ( itr==mListenerDecimators.end() || itr->second.keepFrame( decimationTimestampInNs ) );
+			hasConsumer |= dispatchedListener.isDelivered;
+			mDispatchedListeners.push_back( dispatchedListener );
+		}
+	}
+	if ( numDroppedFrames>0 )
+	{
+		for ( std::size_t i=0; i<mDispatchedListeners.size(); ++i )
+			mDispatchedListeners[i].listener->onDeviceDroppedFrames( this, numDroppedFrames );
 	}
 
-	// Update sequence number
-    //mCapturedImage->setSequenceNumber( buf.sequence );
-    mCapturedImage->setSequenceNumber( mCapturedImage->getSequenceNumber()+1 );
+	// If nobody gets the image, the frame is decimated all the same
+	if ( !hasConsumer )
+	{
+		mStatistics.addDecimatedFrame();
+		queueBuffer( buf.index );
+		imageDelivered = false;
+		return true;
+	}
+
+	// Locate the image data in each plane. The lease views it from the same offset as the
+	// delivered image, which the driver may change from one buffer to the next
+	FrameLease* frameLease = mFrameLeases[buf.index];
+	unsigned char* sourcePlaneBytes[Image::MaxNumPlanes];
+	unsigned int numSourceBytes = 0;
+	for ( unsigned int planeIndex=0; planeIndex<mNumPlanes; ++planeIndex )
+	{
+		unsigned int dataOffset = mIsMultiPlanar ? planes[planeIndex].data_offset : 0;
+		unsigned int bytesUsed = mIsMultiPlanar ? planes[planeIndex].bytesused : buf.bytesused;
+		sourcePlaneBytes[planeIndex] = static_cast<unsigned char*>(mBuffers[buf.index].planes[planeIndex].start) + dataOffset;
+		frameLease->mBytesUsed[planeIndex] = bytesUsed>dataOffset ? bytesUsed-dataOffset : 0;
+		numSourceBytes += frameLease->mBytesUsed[planeIndex];
+		unsigned int planeSizeInBytes = mPlaneSizesInBytes[planeIndex];
+		frameLease->mCapturedImage.getImage().getPlaneBuffer(planeIndex).attach( sourcePlaneBytes[planeIndex], planeSizeInBytes>dataOffset ? planeSizeInBytes-dataOffset : 0 );
+	}
+
+	// Copy the planes one after the other into the CapturedImage, or make it refer to them
+	bool ret = false;
+	Image& destImage = mCapturedImage->getImage();
+	if ( numSourceBytes==destImage.getFormat().getDataSizeInBytes() )
+	{
+		if ( mDeliveryMode==CopyDelivery )
+		{
+			unsigned char* destBytes = destImage.getBuffer().getBytes();
+			for ( unsigned int planeIndex=0; planeIndex<mNumPlanes; ++planeIndex )
+			{
+				memcpy( destBytes, sourcePlaneBytes[planeIndex], frameLease->mBytesUsed[planeIndex] );
+				destBytes += frameLease->mBytesUsed[planeIndex];
+			}
+		}
+		else
+		{
+			for ( unsigned int planeIndex=0; planeIndex<mNumPlanes; ++planeIndex )
+				destImage.getPlaneBuffer(planeIndex).attach( sourcePlaneBytes[planeIndex], frameLease->mBytesUsed[planeIndex] );
+		}
+		ret = true;
+	}
+	if ( !ret )
+	{
+		fprintf( stderr, "Failed to deliver image data from MMAP buffer to captured image for device %s\n", mDeviceName.c_str() );		
+
+		// Re-queue the buffer we've just dequeued
+		queueBuffer( buf.index );
+		return false;
+	}
 
-	// Update timestamp 
-	struct timeval timestampVal = buf.timestamp;
-	unsigned int timestampInMs = timestampVal.tv_sec * 1000 + ( timestampVal.tv_usec / 1000 );
-	float timestampInSec = static_cast<float>(timestampInMs) / 1000.f;
-	mCapturedImage->setTimestampInSec( timestampInSec );
+	// Update capture info
+	mCapturedImage->setSequenceNumber( buf.sequence );
+	mCapturedImage->setNumDroppedFrames( numDroppedFrames );
+	mCapturedImage->setTimestampInNs( timestampInNs );
+	mCapturedImage->setTimestampClock( getTimestampClock( buf.flags ) );
+	mCapturedImage->setTimestampSource( (buf.flags & V4L2_BUF_FLAG_TSTAMP_SRC_MASK)==V4L2_BUF_FLAG_TSTAMP_SRC_SOE ? CapturedImage::StartOfExposureTimestamp : CapturedImage::EndOfFrameTimestamp );
+
+	// The buffer stays dequeued as long as its lease is referenced. The notification 
+	// holds one reference, listeners can add more by calling acquireFrameLease()
+	assert( frameLease->mNumReferences==0 );
+	frameLease->mNumReferences = 1;
+	frameLease->mCapturedImage.copyCaptureInfo( *mCapturedImage );
+
+	// Hand a reference over to the ring consumer
+	if ( mFrameRing )
+	{
+		frameLease->mNumReferences++;
+		mFrameRing->push( frameLease );
+	}
 	
 	// Notify
-	for ( Listeners::const_iterator itr=mListeners.begin(); itr!=mListeners.end(); ++itr )
-		(*itr)->onDeviceCapturedImage( this );
+	int64_t notificationTimeInNs = getMonotonicTimeInNs();
+	if ( mCapturedImage->getTimestampClock()==CapturedImage::MonotonicTimestampClock && notificationTimeInNs>=timestampInNs )
+		mStatistics.getDeliveryLatencyHistogram().record( static_cast<uint64_t>(notificationTimeInNs - timestampInNs) );
 
-	// Re-queue the buffer we've just dequeued
-	if ( xioctl( mHandle, VIDIOC_QBUF, &buf )==-1 )
+	// The queued listeners get their reference first, so that they run alongside the others
+	for ( std::size_t i=0; i<mDispatchedListeners.size(); ++i )
 	{
-		fprintf( stderr, "VIDIOC_QBUF failed for device %s\n", mDeviceName.c_str() );
-		return false;	
-	}	
+		if ( mDispatchedListeners[i].queuedListener && mDispatchedListeners[i].isDelivered )
+		{
+			frameLease->mNumReferences++;
+			mDispatchedListeners[i].queuedListener->queue.push( frameLease );
+		}
+	}
+
+	mDispatchedFrameLease = frameLease;
+	for ( std::size_t i=0; i<mDispatchedListeners.size(); ++i )
+	{
+		if ( mDispatchedListeners[i].isDelivered && !mDispatchedListeners[i].queuedListener )
+			mDispatchedListeners[i].listener->onDeviceCapturedImage( this );
+	}
+	mDispatchedFrameLease = NULL;
+	mStatistics.getListenerTimeHistogram().record( static_cast<uint64_t>(getMonotonicTimeInNs() - notificationTimeInNs) );
+	mStatistics.addDeliveredFrame();
 
+	// Release the notification reference, re-queuing the buffer if no listener leased it
+	releaseFrameLease( frameLease );
+	imageDelivered = true;
 	return true;
 }
 
-void Device::update()
+CapturedImage::TimestampClock Device::getTimestampClock( unsigned int v4l2BufferFlags )
 {
-	if ( !isCapturing() )
+	switch ( v4l2BufferFlags & V4L2_BUF_FLAG_TIMESTAMP_MASK )
+	{
+		case V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC:	return CapturedImage::MonotonicTimestampClock;
+		case V4L2_BUF_FLAG_TIMESTAMP_COPY:		return CapturedImage::CopyTimestampClock;
+		default:								return CapturedImage::UnknownTimestampClock;
+	}
+}
+
+// The image of a queued listener when called from its dispatch thread
+const CapturedImage* Device::getCapturedImage() const
+{
+	if ( queuedFrameLease && queuedFrameLease->getDevice()==this )
+		return &queuedFrameLease->getCapturedImage();
+	return mCapturedImage;
+}
+
+// Take a reference onto the buffer of the image being notified. This is only possible from
+// within Listener::onDeviceCapturedImage(), NULL is returned otherwise. The lease must be 
+// released with FrameLease::release(), its image can't be read once the capture is stopped
+FrameLease* Device::acquireFrameLease()
+{
+	if ( queuedFrameLease && queuedFrameLease->getDevice()==this )
+	{
+		queuedFrameLease->mNumReferences++;
+		return queuedFrameLease;
+	}
+	if ( !mDispatchedFrameLease )
+		return NULL;
+	mDispatchedFrameLease->mNumReferences++;
+	return mDispatchedFrameLease;
+}
+
+void Device::releaseFrameLease( FrameLease* frameLease )
+{
+	assert( frameLease );
+	std::lock_guard<std::mutex> lock( mLeaseMutex );
+	unsigned int numReferences = frameLease->mNumReferences.fetch_sub( 1 );
+	assert( numReferences>0 );
+	if ( numReferences>1 )
 		return;
-	
-	bool cont = false; 
-	do 
+
+	// The buffers of a retired lease were released meanwhile, there's nothing to give back
+	if ( frameLease->mGeneration!=mBufferGeneration )
 	{
-		cont = updateCapturedImage();
+		FrameLeases::iterator itr = std::find( mRetiredFrameLeases.begin(), mRetiredFrameLeases.end(), frameLease );
+		assert( itr!=mRetiredFrameLeases.end() );
+		mRetiredFrameLeases.erase( itr );
+		delete frameLease;
+		return;
 	}
-	while ( cont );
+
+	// Keep track of how long buffers are held by the consumers, with a slowly decaying peak
+	int64_t holdTimeInNs = getMonotonicTimeInNs() - mBuffers[frameLease->getBufferIndex()].dequeueTimeInNs;
+	int64_t measuredHoldTimeInNs = mMeasuredBufferHoldTimeInNs;
+	measuredHoldTimeInNs -= measuredHoldTimeInNs / 16;
+	mMeasuredBufferHoldTimeInNs = std::max( holdTimeInNs, measuredHoldTimeInNs );
+	mStatistics.getBufferHoldTimeHistogram().record( static_cast<uint64_t>( std::max( holdTimeInNs, static_cast<int64_t>(0) ) ) );
+
+	queueBuffer( frameLease->getBufferIndex() );
 }
 
-int Device::xioctl(int fh, int request, void *arg)
+bool Device::startCaptureThread()
 {
-	int r;
-	do 
+	assert( mEpollHandle==-1 );
+	assert( mWakeUpHandle==-1 );
+
+	mEpollHandle = epoll_create1( EPOLL_CLOEXEC );
+	mWakeUpHandle = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+	if ( mEpollHandle==-1 || mWakeUpHandle==-1 )
+	{
+		fprintf( stderr, "Failed to create the capture thread event handles for device %s. %s (%d)\n", mDeviceName.c_str(), strerror(errno), errno );
+		stopCaptureThread();
+		return false;
+	}
+
+	struct epoll_event event;
+	CLEAR(event);
+	event.events = EPOLLIN;
+	event.data.fd = mHandle;
+	if ( epoll_ctl( mEpollHandle, EPOLL_CTL_ADD, mHandle, &event )==-1 )
+	{
+		fprintf( stderr, "Failed to watch device %s for capture. %s (%d)\n", mDeviceName.c_str(), strerror(errno), errno );
+		stopCaptureThread();
+		return false;
+	}
+	event.data.fd = mWakeUpHandle;
+	if ( epoll_ctl( mEpollHandle, EPOLL_CTL_ADD, mWakeUpHandle, &event )==-1 )
+	{
+		fprintf( stderr, "Failed to watch the capture thread wake-up handle for device %s. %s (%d)\n", mDeviceName.c_str(), strerror(errno), errno );
+		stopCaptureThread();
+		return false;
+	}
+
+	mCaptureThread = std::thread( &Device::captureThreadMain, this );
+	applyCaptureThreadSettings();
+	return true;
+}
+
+// Pin the capture thread and give it a real-time priority, as configured
+void Device::applyCaptureThreadSettings()
+{
+	pthread_t thread = mCaptureThread.native_handle();
+	if ( !mCaptureThreadCpus.empty() )
+	{
+		cpu_set_t cpuSet;
+		CPU_ZERO( &cpuSet );
+		for ( std::size_t i=0; i<mCaptureThreadCpus.size(); ++i )
+			CPU_SET( mCaptureThreadCpus[i], &cpuSet );
+		int ret = pthread_setaffinity_np( thread, sizeof(cpuSet), &cpuSet );
+		if ( ret!=0 )
+			fprintf( stderr, "Failed to set the CPU affinity of the capture thread of device %s. %s (%d)\n", mDeviceName.c_str(), strerror(ret), ret );
+	}
+	if ( mCaptureThreadPriority>0 )
+	{
+		struct sched_param param;
+		CLEAR(param);
+		param.sched_priority = mCaptureThreadPriority;
+		int ret = pthread_setschedparam( thread, SCHED_FIFO, &param );
+		if ( ret!=0 )
+			fprintf( stderr, "Failed to give the capture thread of device %s the real-time priority %d. %s (%d)\n", mDeviceName.c_str(), mCaptureThreadPriority, strerror(ret), ret );
+	}
+}
+
+// Must not be called from the capture thread itself (from a listener for instance)
+void Device::stopCaptureThread()
+{
+	if ( mCaptureThread.joinable() )
+	{
+		assert( mCaptureThread.get_id()!=std::this_thread::get_id() );
+		uint64_t value = 1;
+		if ( write( mWakeUpHandle, &value, sizeof(value) )!=sizeof(value) )
+			fprintf( stderr, "Failed to wake up the capture thread of device %s\n", mDeviceName.c_str() );
+		mCaptureThread.join();
+	}
+
+	if ( mWakeUpHandle!=-1 )
+	{
+		close( mWakeUpHandle );
+		mWakeUpHandle = -1;
+	}
+	if ( mEpollHandle!=-1 )
+	{
+		close( mEpollHandle );
+		mEpollHandle = -1;
+	}
+}
+
+// Block until the driver signals that a buffer is ready (or until asked to stop) then 
+// deliver every image available
+void Device::captureThreadMain()
+{
+	for ( ;; )
+	{
+		struct epoll_event events[2];
+		int numEvents = epoll_wait( mEpollHandle, events, 2, mCaptureThreadTimeoutInMs );
+		if ( numEvents==-1 )
+		{
+			if ( errno==EINTR )
+				continue;
+			fprintf( stderr, "epoll_wait failed for device %s. %s (%d)\n", mDeviceName.c_str(), strerror(errno), errno );
+			return;
+		}
+
+		bool imageReady = false;
+		for ( int i=0; i<numEvents; ++i )
+		{
+			if ( events[i].data.fd==mWakeUpHandle )
+				return;
+			imageReady = true;
+		}
+
+		// At most one image per buffer between two waits, so that a stop request is seen even 
+		// when the driver never runs out of images (epoll_wait() then returns right away)
+		if ( imageReady )
+		{
+			bool imageDelivered = false;
+			for ( unsigned int i=0; i<mNumBuffers && updateCapturedImage( imageDelivered ); ++i )
+			{
+			}
+		}
+
+		// A disconnected device keeps its handle in error: the thread would spin on it
+		if ( mIsDisconnected )
+			return;
+	}
+}
+
+// Deliver the images captured since the last call and return how many were. Only needed 
+// in ManualUpdate mode. It can be called from another thread than the one starting and 
+// stopping the capture. At most one image per buffer is delivered, so that the call 
+// returns even if the driver never runs out of images
+// The capture mutex is only tried: while an asynchronous start or stop is in progress, 
+// update() returns immediately rather than blocking the caller (typically a GUI thread)
+unsigned int Device::update()
+{
+	std::unique_lock<std::recursive_mutex> lock( mCaptureMutex, std::try_to_lock );
+	if ( !lock.owns_lock() || !isCapturing() || mUpdateMode!=ManualUpdate )
+		return 0;
+	
+	unsigned int numImages = 0;
+	bool imageDelivered = false;
+	for ( unsigned int i=0; i<mNumBuffers && updateCapturedImage( imageDelivered ); ++i )
 	{
-		r = ioctl( fh, request, arg );
-	} 
-	while ( r==-1 && errno==EINTR );
-	return r;
+		if ( imageDelivered )
+			numImages++;
+	}
+	return numImages;
 }
 
+// Listeners can be added or removed from any thread, but not from within a notification
 void Device::addListener( Listener* listener )
 {
 	assert(listener);
+	std::lock_guard<std::mutex> lock( mListenersMutex );
 	mListeners.push_back(listener);
 }
 
+// The listener is only called from its dispatch thread for the captured images. If the 
+// device is capturing, the thread starts right away
+void Device::addListener( Listener* listener, unsigned int queueDepth, FrameRing::OverflowPolicy overflowPolicy )
+{
+	assert(listener);
+	QueuedListener* queuedListener = new QueuedListener( listener, queueDepth, overflowPolicy );
+	std::lock_guard<std::mutex> lock( mListenersMutex );
+	mListeners.push_back(listener);
+	mQueuedListeners.push_back(queuedListener);
+	if ( isCapturing() )
+		startDispatchThread( queuedListener );
+}
+
+// A queued listener sees the images still in its queue before being removed. Listeners 
+// can't be removed from within their notifications, nor from those of a queued listener
 bool Device::removeListener( Listener* listener )
 {
-	Listeners::iterator itr = std::find( mListeners.begin(), mListeners.end(), listener );
-	if ( itr==mListeners.end() )
+	QueuedListener* queuedListener = NULL;
+	{
+		std::lock_guard<std::mutex> lock( mListenersMutex );
+		Listeners::iterator itr = std::find( mListeners.begin(), mListeners.end(), listener );
+		if ( itr==mListeners.end() )
+			return false;
+		mListeners.erase( itr );
+		mListenerDecimators.erase( listener );
+
+		// Closing the queue unblocks the delivering thread if it waits for this listener
+		queuedListener = findQueuedListener( listener );
+		if ( queuedListener )
+		{
+			queuedListener->queue.close();
+			mQueuedListeners.erase( std::find( mQueuedListeners.begin(), mQueuedListeners.end(), queuedListener ) );
+		}
+	}
+
+	// A notification in progress may still be using the listener, wait for it to be over
+	std::lock_guard<std::recursive_mutex> dispatchLock( mDispatchMutex );
+	if ( queuedListener )
+	{
+		stopDispatchThread( queuedListener );
+		delete queuedListener;
+	}
+	return true;
+}
+
+// Gives access to the queue counters (overwritten frames, blocked pushes...) of a listener
+const FrameRing* Device::getListenerQueue( const Listener* listener ) const
+{
+	std::lock_guard<std::mutex> lock( mListenersMutex );
+	QueuedListener* queuedListener = findQueuedListener( listener );
+	return queuedListener ? &queuedListener->queue : NULL;
+}
+
+// The listener must have been added. Passing 1 and 0 gives it every image again
+bool Device::setListenerDecimation( Listener* listener, unsigned int frameDivider, float maxRateInHz )
+{
+	if ( maxRateInHz<0.f )
 		return false;
-	mListeners.erase( itr );
+	std::lock_guard<std::mutex> lock( mListenersMutex );
+	if ( std::find( mListeners.begin(), mListeners.end(), listener )==mListeners.end() )
+		return false;
+	FrameDecimator decimator( frameDivider, maxRateInHz );
+	if ( decimator.isEnabled() )
+		mListenerDecimators[listener] = decimator;
+	else
+		mListenerDecimators.erase( listener );
 	return true;
 }
 
+// The listeners are called from a copy of the list, so that they can use the Device from
+// their notification. The dispatch mutex lets removeListener() wait for it to be over
+void Device::notifyListeners( void (Listener::*notification)( Device* ) )
+{
+	std::lock_guard<std::recursive_mutex> dispatchLock( mDispatchMutex );
+	Listeners listeners;
+	{
+		std::lock_guard<std::mutex> lock( mListenersMutex );
+		listeners = mListeners;
+	}
+	for ( Listeners::const_iterator itr=listeners.begin(); itr!=listeners.end(); ++itr )
+		((*itr)->*notification)( this );
+}
+
+Device::QueuedListener* Device::findQueuedListener( const Listener* listener ) const
+{
+	for ( QueuedListeners::const_iterator itr=mQueuedListeners.begin(); itr!=mQueuedListeners.end(); ++itr )
+	{
+		if ( (*itr)->listener==listener )
+			return *itr;
+	}
+	return NULL;
+}
+
+void Device::startListenerDispatch()
+{
+	std::lock_guard<std::mutex> lock( mListenersMutex );
+	for ( QueuedListeners::const_iterator itr=mQueuedListeners.begin(); itr!=mQueuedListeners.end(); ++itr )
+		startDispatchThread( *itr );
+}
+
+// The queues must have been closed, so that the dispatch threads exit once they're empty. 
+// They're joined without mListenersMutex, which their listeners may need until then
+void Device::stopListenerDispatch()
+{
+	std::lock_guard<std::recursive_mutex> dispatchLock( mDispatchMutex );
+	QueuedListeners queuedListeners;
+	{
+		std::lock_guard<std::mutex> lock( mListenersMutex );
+		queuedListeners = mQueuedListeners;
+	}
+	for ( QueuedListeners::const_iterator itr=queuedListeners.begin(); itr!=queuedListeners.end(); ++itr )
+		stopDispatchThread( *itr );
+}
+
+// Already running for a listener added while the capture was being reconfigured
+void Device::startDispatchThread( QueuedListener* queuedListener )
+{
+	if ( queuedListener->dispatchThread.joinable() )
+		return;
+	queuedListener->queue.open();
+	queuedListener->dispatchThread = std::thread( &Device::dispatchThreadMain, this, queuedListener );
+}
+
+void Device::stopDispatchThread( QueuedListener* queuedListener )
+{
+	if ( queuedListener->dispatchThread.joinable() )
+	{
+		assert( queuedListener->dispatchThread.get_id()!=std::this_thread::get_id() );
+		queuedListener->dispatchThread.join();
+	}
+	queuedListener->queue.clear();
+}
+
+// Notify the listener of each queued image, releasing the reference of the queue afterwards
+void Device::dispatchThreadMain( QueuedListener* queuedListener )
+{
+	FrameLease* frameLease = NULL;
+	while ( (frameLease = queuedListener->queue.pop())!=NULL )
+	{
+		queuedFrameLease = frameLease;
+		queuedListener->listener->onDeviceCapturedImage( this );
+		queuedFrameLease = NULL;
+		frameLease->release();
+	}
+}
+
 }
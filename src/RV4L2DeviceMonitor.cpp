@@ -0,0 +1,254 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include "RV4L2DeviceMonitor.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <algorithm>
+
+namespace RV4L2
+{
+
+DeviceMonitor::DeviceMonitor( const char* directory, const char* namePrefix )
+	:	mDirectory(directory),
+		mNamePrefix(namePrefix),
+		mHandle(-1),
+		mDeviceNames(),
+		mDeviceNamesMutex(),
+		mListeners(),
+		mListenersMutex(),
+		mDispatchMutex()
+{
+	mHandle = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+	if ( mHandle==-1 )
+	{
+		fprintf( stderr, "Failed to create the device monitor handle. %s (%d)\n", strerror(errno), errno );
+		return;
+	}
+
+	uint32_t mask = IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO;
+	if ( inotify_add_watch( mHandle, mDirectory.c_str(), mask )==-1 )
+	{
+		fprintf( stderr, "Failed to monitor directory %s. %s (%d)\n", mDirectory.c_str(), strerror(errno), errno );
+		close( mHandle );
+		mHandle = -1;
+		return;
+	}
+
+	// The devices present at this point are known without notification
+	scanDirectory( mDeviceNames );
+}
+
+DeviceMonitor::~DeviceMonitor()
+{
+	if ( mHandle!=-1 )
+		close( mHandle );
+	mHandle = -1;
+}
+
+std::vector<std::string> DeviceMonitor::getDeviceNames() const
+{
+	std::lock_guard<std::mutex> lock( mDeviceNamesMutex );
+	return mDeviceNames;
+}
+
+bool DeviceMonitor::isMonitoredName( const char* name ) const
+{
+	return strncmp( name, mNamePrefix.c_str(), mNamePrefix.size() )==0;
+}
+
+bool DeviceMonitor::isAccessible( const std::string& deviceName ) const
+{
+	return access( deviceName.c_str(), R_OK | W_OK )==0;
+}
+
+void DeviceMonitor::scanDirectory( std::vector<std::string>& deviceNames ) const
+{
+	deviceNames.clear();
+	DIR* dir = opendir( mDirectory.c_str() );
+	if ( !dir )
+		return;
+	struct dirent* entry = NULL;
+	while ( (entry=readdir(dir))!=NULL )
+	{
+		if ( !isMonitoredName( entry->d_name ) )
+			continue;
+		std::string deviceName = mDirectory + "/" + entry->d_name;
+		if ( isAccessible( deviceName ) )
+			deviceNames.push_back( deviceName );
+	}
+	closedir( dir );
+	std::sort( deviceNames.begin(), deviceNames.end() );
+}
+
+// Used when the kernel event queue overflowed: the directory content is compared 
+// with the known devices
+unsigned int DeviceMonitor::rescan()
+{
+	std::vector<std::string> deviceNames;
+	scanDirectory( deviceNames );
+	std::vector<std::string> previousDeviceNames = getDeviceNames();
+
+	unsigned int numEvents = 0;
+	for ( std::size_t i=0; i<previousDeviceNames.size(); ++i )
+		if ( std::find( deviceNames.begin(), deviceNames.end(), previousDeviceNames[i] )==deviceNames.end() && removeDeviceName( previousDeviceNames[i] ) )
+			numEvents++;
+	for ( std::size_t i=0; i<deviceNames.size(); ++i )
+		if ( addDeviceName( deviceNames[i] ) )
+			numEvents++;
+	return numEvents;
+}
+
+bool DeviceMonitor::addDeviceName( const std::string& deviceName )
+{
+	{
+		std::lock_guard<std::mutex> lock( mDeviceNamesMutex );
+		if ( std::find( mDeviceNames.begin(), mDeviceNames.end(), deviceName )!=mDeviceNames.end() )
+			return false;
+		mDeviceNames.push_back( deviceName );
+	}
+
+	notifyListeners( &Listener::onDeviceAdded, deviceName );
+	return true;
+}
+
+bool DeviceMonitor::removeDeviceName( const std::string& deviceName )
+{
+	{
+		std::lock_guard<std::mutex> lock( mDeviceNamesMutex );
+		std::vector<std::string>::iterator itr = std::find( mDeviceNames.begin(), mDeviceNames.end(), deviceName );
+		if ( itr==mDeviceNames.end() )
+			return false;
+		mDeviceNames.erase( itr );
+	}
+
+	notifyListeners( &Listener::onDeviceRemoved, deviceName );
+	return true;
+}
+
+// The listeners are called from a copy of the list. The dispatch mutex lets removeListener() 
+// wait for the notification to be over
+void DeviceMonitor::notifyListeners( void (Listener::*notification)( DeviceMonitor*, const std::string& ), const std::string& deviceName )
+{
+	std::lock_guard<std::recursive_mutex> dispatchLock( mDispatchMutex );
+	Listeners listeners;
+	{
+		std::lock_guard<std::mutex> lock( mListenersMutex );
+		listeners = mListeners;
+	}
+	for ( Listeners::const_iterator itr=listeners.begin(); itr!=listeners.end(); ++itr )
+		((*itr)->*notification)( this, deviceName );
+}
+
+// Read the pending inotify events without blocking and notify the listeners. Returns the 
+// number of devices added or removed. Must not be called by several threads at once
+unsigned int DeviceMonitor::update()
+{
+	if ( !isValid() )
+		return 0;
+
+	unsigned int numEvents = 0;
+	char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	for ( ;; )
+	{
+		ssize_t numBytes = read( mHandle, buffer, sizeof(buffer) );
+		if ( numBytes<=0 )
+		{
+			if ( numBytes==-1 && errno!=EAGAIN && errno!=EINTR )
+				fprintf( stderr, "Failed to read the events of the device monitor. %s (%d)\n", strerror(errno), errno );
+			break;
+		}
+
+		for ( char* ptr=buffer; ptr<buffer+numBytes; )
+		{
+			const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>( ptr );
+			ptr += sizeof(struct inotify_event) + event->len;
+
+			if ( event->mask & IN_Q_OVERFLOW )
+			{
+				numEvents += rescan();
+				continue;
+			}
+			if ( event->len==0 || !isMonitoredName( event->name ) )
+				continue;
+
+			std::string deviceName = mDirectory + "/" + event->name;
+			if ( event->mask & (IN_DELETE | IN_MOVED_FROM) )
+			{
+				if ( removeDeviceName( deviceName ) )
+					numEvents++;
+			}
+			else if ( event->mask & (IN_CREATE | IN_ATTRIB | IN_MOVED_TO) )
+			{
+				if ( isAccessible( deviceName ) && addDeviceName( deviceName ) )
+					numEvents++;
+			}
+		}
+	}
+	return numEvents;
+}
+
+// Wait for the monitor handle to become readable, a negative timeout waiting indefinitely.
+// For programs that don't have an event loop of their own
+bool DeviceMonitor::waitForEvents( int timeoutInMs )
+{
+	if ( !isValid() )
+		return false;
+	struct pollfd pollHandle;
+	pollHandle.fd = mHandle;
+	pollHandle.events = POLLIN;
+	pollHandle.revents = 0;
+	int ret = poll( &pollHandle, 1, timeoutInMs );
+	return ret>0 && (pollHandle.revents & POLLIN);
+}
+
+void DeviceMonitor::addListener( Listener* listener )
+{
+	assert( listener );
+	std::lock_guard<std::mutex> lock( mListenersMutex );
+	mListeners.push_back(listener);
+}
+
+bool DeviceMonitor::removeListener( Listener* listener )
+{
+	{
+		std::lock_guard<std::mutex> lock( mListenersMutex );
+		Listeners::iterator itr = std::find( mListeners.begin(), mListeners.end(), listener );
+		if ( itr==mListeners.end() )
+			return false;
+		mListeners.erase( itr );
+	}
+
+	// A notification in progress on another thread may still be calling the listener
+	std::lock_guard<std::recursive_mutex> dispatchLock( mDispatchMutex );
+	return true;
+}
+
+}
@@ -0,0 +1,772 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include "RV4L2EmulatedCaptureBackend.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <linux/videodev2.h>
+#include <algorithm>
+#include <chrono>
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+
+namespace RV4L2
+{
+
+/*
+	EmulatedCaptureBackend::Buffer
+*/
+EmulatedCaptureBackend::Buffer::Buffer()
+	:	memory(NULL),
+		length(0),
+		isQueued(false),
+		isDone(false),
+		sequenceNumber(0),
+		timestampInNs(0)
+{
+}
+
+/*
+	EmulatedCaptureBackend
+*/
+const EmulatedCaptureBackend::PixelFormat EmulatedCaptureBackend::mPixelFormats[] = 
+{
+	{ ImageFormat::YUYV, V4L2_PIX_FMT_YUYV, "YUYV 4:2:2" },
+	{ ImageFormat::UYVY, V4L2_PIX_FMT_UYVY, "UYVY 4:2:2" },
+	{ ImageFormat::NV12, V4L2_PIX_FMT_NV12, "Y/CbCr 4:2:0" },
+	{ ImageFormat::I420, V4L2_PIX_FMT_YUV420, "Planar YUV 4:2:0" },
+	{ ImageFormat::RGB24, V4L2_PIX_FMT_RGB24, "24-bit RGB 8-8-8" },
+	{ ImageFormat::Grayscale8, V4L2_PIX_FMT_GREY, "8-bit Greyscale" },
+	{ ImageFormat::BayerBGGR8, V4L2_PIX_FMT_SBGGR8, "8-bit Bayer BGBG/GRGR" },
+	{ ImageFormat::BayerGBRG8, V4L2_PIX_FMT_SGBRG8, "8-bit Bayer GBGB/RGRG" },
+	{ ImageFormat::BayerGRBG8, V4L2_PIX_FMT_SGRBG8, "8-bit Bayer GRGR/BGBG" },
+	{ ImageFormat::BayerRGGB8, V4L2_PIX_FMT_SRGGB8, "8-bit Bayer RGRG/GBGB" }
+};
+const unsigned int EmulatedCaptureBackend::mNumPixelFormats = sizeof(mPixelFormats)/sizeof(mPixelFormats[0]);
+
+EmulatedCaptureBackend::EmulatedCaptureBackend( const char* driverName, const char* cardName, const char* busInfoPrefix )
+	:	mEncodings(),
+		mFrameSizes(),
+		mFrameRates(),
+		mDriverName(driverName),
+		mCardName(cardName),
+		mBusInfoPrefix(busInfoPrefix),
+		mIsFreeRunning(false),
+		mDeviceName(),
+		mHandle(-1),
+		mImageFormat(),
+		mV4L2PixelFormat(0),
+		mFrameRateInHz(0),
+		mBuffers(),
+		mMemoryType(V4L2_MEMORY_MMAP),
+		mBufferStride(0),
+		mQueuedBuffers(),
+		mDoneBuffers(),
+		mIsStreaming(false),
+		mIsDisconnected(false),
+		mSequenceNumber(0),
+		mMutex(),
+		mCondition(),
+		mGeneratorThread(),
+		mIsGeneratorThreadExiting(false)
+{
+}
+
+// The derived classes must call close() in their own destructor, while they can still 
+// be called by the generator thread
+EmulatedCaptureBackend::~EmulatedCaptureBackend()
+{
+	close();
+}
+
+void EmulatedCaptureBackend::setFreeRunning( bool freeRunning )
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	mIsFreeRunning = freeRunning;
+	mCondition.notify_all();
+}
+
+void EmulatedCaptureBackend::simulateDisconnection()
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	if ( mIsDisconnected || mHandle==-1 )
+		return;
+	mIsDisconnected = true;
+
+	// Wake up whoever polls the handle, it then stays readable
+	uint64_t value = 1;
+	if ( write( mHandle, &value, sizeof(value) )!=sizeof(value) )
+		fprintf( stderr, "Failed to signal the disconnection of %s\n", mDeviceName.c_str() );
+	mCondition.notify_all();
+}
+
+bool EmulatedCaptureBackend::open( const std::string& deviceName )
+{
+	if ( mHandle!=-1 )
+		return false;
+	if ( !openSource( deviceName ) )
+		return false;
+	bool hasSupportedEncodings = !mEncodings.empty();
+	for ( std::size_t i=0; i<mEncodings.size(); ++i )
+		hasSupportedEncodings = hasSupportedEncodings && isSupportedEncoding( mEncodings[i] );
+	if ( !hasSupportedEncodings || mFrameSizes.empty() || mFrameRates.empty() )
+	{
+		fprintf( stderr, "Emulated device %s has no format, frame size or frame rate\n", deviceName.c_str() );
+		closeSource();
+		return false;
+	}
+
+	mHandle = eventfd( 0, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC );
+	if ( mHandle==-1 )
+	{
+		fprintf( stderr, "Cannot create the handle of emulated device %s. %s (%d)\n", deviceName.c_str(), strerror(errno), errno );
+		closeSource();
+		return false;
+	}
+	mDeviceName = deviceName;
+	mImageFormat = ImageFormat( mFrameSizes[0].first, mFrameSizes[0].second, mEncodings[0] );
+	mV4L2PixelFormat = findPixelFormat( mEncodings[0] )->v4l2PixelFormat;
+	mFrameRateInHz = mFrameRates[0];
+	mIsDisconnected = false;
+	mSequenceNumber = 0;
+	return true;
+}
+
+void EmulatedCaptureBackend::close()
+{
+	if ( mHandle==-1 )
+		return;
+	stopStreaming( NULL );
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		freeBuffers();
+	}
+	::close( mHandle );
+	mHandle = -1;
+	closeSource();
+}
+
+int EmulatedCaptureBackend::ioctl( unsigned long request, void* arg )
+{
+	if ( mHandle==-1 )
+	{
+		errno = EBADF;
+		return -1;
+	}
+
+	switch ( request )
+	{
+		case VIDIOC_QUERYCAP:				return queryCapabilities( arg );
+		case VIDIOC_ENUM_FMT:				return enumerateFormat( arg );
+		case VIDIOC_ENUM_FRAMESIZES:		return enumerateFrameSize( arg );
+		case VIDIOC_ENUM_FRAMEINTERVALS:	return enumerateFrameInterval( arg );
+		case VIDIOC_G_FMT:					return getFormat( arg );
+		case VIDIOC_S_FMT:					return setFormat( arg, false );
+		case VIDIOC_TRY_FMT:				return setFormat( arg, true );
+		case VIDIOC_G_PARM:					return getStreamParameters( arg );
+		case VIDIOC_S_PARM:					return setStreamParameters( arg );
+		case VIDIOC_REQBUFS:				return requestBuffers( arg );
+		case VIDIOC_QUERYBUF:				return queryBuffer( arg );
+		case VIDIOC_QBUF:					return queueBuffer( arg );
+		case VIDIOC_DQBUF:					return dequeueBuffer( arg );
+		case VIDIOC_STREAMON:				return startStreaming( arg );
+		case VIDIOC_STREAMOFF:				return stopStreaming( arg );
+	}
+
+	// Among others VIDIOC_EXPBUF: there is no DMABUF to export the memory as
+	errno = ENOTTY;
+	return -1;
+}
+
+// The MMAP buffers are identified by their offset, a multiple of the buffer stride
+void* EmulatedCaptureBackend::mmap( std::size_t length, off_t offset )
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	std::size_t bufferIndex = mBufferStride>0 ? static_cast<std::size_t>(offset) / mBufferStride : 0;
+	if ( mMemoryType!=V4L2_MEMORY_MMAP || mBufferStride==0 || (static_cast<std::size_t>(offset) % mBufferStride)!=0 || 
+		 bufferIndex>=mBuffers.size() || length>mBufferStride )
+	{
+		errno = EINVAL;
+		return MAP_FAILED;
+	}
+	return mBuffers[bufferIndex].memory;
+}
+
+// The memory stays allocated until the buffers are released with VIDIOC_REQBUFS
+int EmulatedCaptureBackend::munmap( void* /*start*/, std::size_t /*length*/ )
+{
+	return 0;
+}
+
+const EmulatedCaptureBackend::PixelFormat* EmulatedCaptureBackend::findPixelFormat( unsigned int v4l2PixelFormat )
+{
+	for ( unsigned int i=0; i<mNumPixelFormats; ++i )
+		if ( mPixelFormats[i].v4l2PixelFormat==v4l2PixelFormat )
+			return &mPixelFormats[i];
+	return NULL;
+}
+
+const EmulatedCaptureBackend::PixelFormat* EmulatedCaptureBackend::findPixelFormat( ImageFormat::Encoding encoding )
+{
+	for ( unsigned int i=0; i<mNumPixelFormats; ++i )
+		if ( mPixelFormats[i].encoding==encoding )
+			return &mPixelFormats[i];
+	return NULL;
+}
+
+bool EmulatedCaptureBackend::isSupportedEncoding( ImageFormat::Encoding encoding )
+{
+	return findPixelFormat( encoding )!=NULL;
+}
+
+std::vector<ImageFormat::Encoding> EmulatedCaptureBackend::getSupportedEncodings()
+{
+	std::vector<ImageFormat::Encoding> encodings;
+	for ( unsigned int i=0; i<mNumPixelFormats; ++i )
+		encodings.push_back( mPixelFormats[i].encoding );
+	return encodings;
+}
+
+const EmulatedCaptureBackend::PixelFormat* EmulatedCaptureBackend::findSupportedPixelFormat( unsigned int v4l2PixelFormat ) const
+{
+	const PixelFormat* pixelFormat = findPixelFormat( v4l2PixelFormat );
+	if ( !pixelFormat || std::find( mEncodings.begin(), mEncodings.end(), pixelFormat->encoding )==mEncodings.end() )
+		return NULL;
+	return pixelFormat;
+}
+
+bool EmulatedCaptureBackend::hasFrameSize( unsigned int width, unsigned int height ) const
+{
+	for ( std::size_t i=0; i<mFrameSizes.size(); ++i )
+		if ( mFrameSizes[i].first==width && mFrameSizes[i].second==height )
+			return true;
+	return false;
+}
+
+// Reported as the driver version, so that the capture settings cached by a Device 
+// aren't reused once the device is configured differently
+unsigned int EmulatedCaptureBackend::getConfigurationChecksum() const
+{
+	uint32_t hash = 2166136261u;
+	for ( std::size_t i=0; i<mEncodings.size(); ++i )
+		hash = (hash ^ static_cast<uint32_t>(mEncodings[i])) * 16777619u;
+	for ( std::size_t i=0; i<mFrameSizes.size(); ++i )
+	{
+		hash = (hash ^ mFrameSizes[i].first) * 16777619u;
+		hash = (hash ^ mFrameSizes[i].second) * 16777619u;
+	}
+	for ( std::size_t i=0; i<mFrameRates.size(); ++i )
+		hash = (hash ^ mFrameRates[i]) * 16777619u;
+	return hash;
+}
+
+int EmulatedCaptureBackend::queryCapabilities( void* arg )
+{
+	struct v4l2_capability* cap = static_cast<struct v4l2_capability*>( arg );
+	CLEAR(*cap);
+	std::string busInfo = mBusInfoPrefix + mDeviceName;
+	strncpy( reinterpret_cast<char*>(cap->driver), mDriverName.c_str(), sizeof(cap->driver)-1 );
+	strncpy( reinterpret_cast<char*>(cap->card), mCardName.c_str(), sizeof(cap->card)-1 );
+	strncpy( reinterpret_cast<char*>(cap->bus_info), busInfo.c_str(), sizeof(cap->bus_info)-1 );
+	cap->version = getConfigurationChecksum();
+	cap->device_caps = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+	cap->capabilities = cap->device_caps | V4L2_CAP_DEVICE_CAPS;
+	return 0;
+}
+
+int EmulatedCaptureBackend::enumerateFormat( void* arg )
+{
+	struct v4l2_fmtdesc* fmtDesc = static_cast<struct v4l2_fmtdesc*>( arg );
+	if ( fmtDesc->type!=V4L2_BUF_TYPE_VIDEO_CAPTURE || fmtDesc->index>=mEncodings.size() )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	const PixelFormat& pixelFormat = *findPixelFormat( mEncodings[fmtDesc->index] );
+	fmtDesc->flags = 0;
+	fmtDesc->pixelformat = pixelFormat.v4l2PixelFormat;
+	CLEAR(fmtDesc->description);
+	strncpy( reinterpret_cast<char*>(fmtDesc->description), pixelFormat.description, sizeof(fmtDesc->description)-1 );
+	return 0;
+}
+
+int EmulatedCaptureBackend::enumerateFrameSize( void* arg )
+{
+	struct v4l2_frmsizeenum* frmSizeEnum = static_cast<struct v4l2_frmsizeenum*>( arg );
+	if ( !findSupportedPixelFormat( frmSizeEnum->pixel_format ) || frmSizeEnum->index>=mFrameSizes.size() )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	frmSizeEnum->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+	frmSizeEnum->discrete.width = mFrameSizes[frmSizeEnum->index].first;
+	frmSizeEnum->discrete.height = mFrameSizes[frmSizeEnum->index].second;
+	return 0;
+}
+
+int EmulatedCaptureBackend::enumerateFrameInterval( void* arg )
+{
+	struct v4l2_frmivalenum* frmIvalEnum = static_cast<struct v4l2_frmivalenum*>( arg );
+	if ( !findSupportedPixelFormat( frmIvalEnum->pixel_format ) || !hasFrameSize( frmIvalEnum->width, frmIvalEnum->height ) || 
+		 frmIvalEnum->index>=mFrameRates.size() )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	frmIvalEnum->type = V4L2_FRMIVAL_TYPE_DISCRETE;
+	frmIvalEnum->discrete.numerator = 1;
+	frmIvalEnum->discrete.denominator = mFrameRates[frmIvalEnum->index];
+	return 0;
+}
+
+int EmulatedCaptureBackend::getFormat( void* arg )
+{
+	struct v4l2_format* fmt = static_cast<struct v4l2_format*>( arg );
+	if ( fmt->type!=V4L2_BUF_TYPE_VIDEO_CAPTURE )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	std::lock_guard<std::mutex> lock( mMutex );
+	CLEAR(fmt->fmt.pix);
+	fmt->fmt.pix.width = mImageFormat.getWidth();
+	fmt->fmt.pix.height = mImageFormat.getHeight();
+	fmt->fmt.pix.pixelformat = mV4L2PixelFormat;
+	fmt->fmt.pix.field = V4L2_FIELD_NONE;
+	fmt->fmt.pix.bytesperline = mImageFormat.getNumBytesPerLine();
+	fmt->fmt.pix.sizeimage = mImageFormat.getDataSizeInBytes();
+	fmt->fmt.pix.colorspace = V4L2_COLORSPACE_SRGB;
+	return 0;
+}
+
+// Like drivers do, an unsupported format is replaced by the closest supported one
+int EmulatedCaptureBackend::setFormat( void* arg, bool tryOnly )
+{
+	struct v4l2_format* fmt = static_cast<struct v4l2_format*>( arg );
+	if ( fmt->type!=V4L2_BUF_TYPE_VIDEO_CAPTURE )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	const PixelFormat* pixelFormat = findSupportedPixelFormat( fmt->fmt.pix.pixelformat );
+	if ( !pixelFormat )
+		pixelFormat = findPixelFormat( mEncodings[0] );
+	std::size_t bestIndex = 0;
+	unsigned int bestDistance = 0;
+	for ( std::size_t i=0; i<mFrameSizes.size(); ++i )
+	{
+		unsigned int dx = mFrameSizes[i].first>fmt->fmt.pix.width ? mFrameSizes[i].first-fmt->fmt.pix.width : fmt->fmt.pix.width-mFrameSizes[i].first;
+		unsigned int dy = mFrameSizes[i].second>fmt->fmt.pix.height ? mFrameSizes[i].second-fmt->fmt.pix.height : fmt->fmt.pix.height-mFrameSizes[i].second;
+		if ( i==0 || dx+dy<bestDistance )
+		{
+			bestIndex = i;
+			bestDistance = dx+dy;
+		}
+	}
+	ImageFormat imageFormat( mFrameSizes[bestIndex].first, mFrameSizes[bestIndex].second, pixelFormat->encoding );
+
+	if ( !tryOnly )
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		if ( !mBuffers.empty() )
+		{
+			errno = EBUSY;
+			return -1;
+		}
+		mImageFormat = imageFormat;
+		mV4L2PixelFormat = pixelFormat->v4l2PixelFormat;
+	}
+
+	CLEAR(fmt->fmt.pix);
+	fmt->fmt.pix.width = imageFormat.getWidth();
+	fmt->fmt.pix.height = imageFormat.getHeight();
+	fmt->fmt.pix.pixelformat = pixelFormat->v4l2PixelFormat;
+	fmt->fmt.pix.field = V4L2_FIELD_NONE;
+	fmt->fmt.pix.bytesperline = imageFormat.getNumBytesPerLine();
+	fmt->fmt.pix.sizeimage = imageFormat.getDataSizeInBytes();
+	fmt->fmt.pix.colorspace = V4L2_COLORSPACE_SRGB;
+	return 0;
+}
+
+int EmulatedCaptureBackend::getStreamParameters( void* arg )
+{
+	struct v4l2_streamparm* parm = static_cast<struct v4l2_streamparm*>( arg );
+	if ( parm->type!=V4L2_BUF_TYPE_VIDEO_CAPTURE )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	std::lock_guard<std::mutex> lock( mMutex );
+	CLEAR(parm->parm.capture);
+	parm->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+	parm->parm.capture.timeperframe.numerator = 1;
+	parm->parm.capture.timeperframe.denominator = mFrameRateInHz;
+	return 0;
+}
+
+// The frame rate can change while streaming, it applies from the next frame
+int EmulatedCaptureBackend::setStreamParameters( void* arg )
+{
+	struct v4l2_streamparm* parm = static_cast<struct v4l2_streamparm*>( arg );
+	if ( parm->type!=V4L2_BUF_TYPE_VIDEO_CAPTURE )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	const struct v4l2_fract& timePerFrame = parm->parm.capture.timeperframe;
+	float requestedFrameRateInHz = timePerFrame.numerator>0 ? static_cast<float>(timePerFrame.denominator) / static_cast<float>(timePerFrame.numerator) : 0.f;
+	unsigned int frameRateInHz = mFrameRates[0];
+	for ( std::size_t i=1; i<mFrameRates.size(); ++i )
+	{
+		float distance = static_cast<float>(mFrameRates[i]) - requestedFrameRateInHz;
+		float bestDistance = static_cast<float>(frameRateInHz) - requestedFrameRateInHz;
+		if ( distance*distance<bestDistance*bestDistance )
+			frameRateInHz = mFrameRates[i];
+	}
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		mFrameRateInHz = frameRateInHz;
+	}
+	return getStreamParameters( arg );
+}
+
+int EmulatedCaptureBackend::requestBuffers( void* arg )
+{
+	struct v4l2_requestbuffers* req = static_cast<struct v4l2_requestbuffers*>( arg );
+	if ( req->type!=V4L2_BUF_TYPE_VIDEO_CAPTURE || (req->memory!=V4L2_MEMORY_MMAP && req->memory!=V4L2_MEMORY_USERPTR) )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	std::lock_guard<std::mutex> lock( mMutex );
+	if ( mIsStreaming )
+	{
+		errno = EBUSY;
+		return -1;
+	}
+	freeBuffers();
+	if ( req->count==0 )
+		return 0;
+
+	const unsigned int maxNumBuffers = 32;
+	if ( req->count>maxNumBuffers )
+		req->count = maxNumBuffers;
+	std::size_t pageSize = static_cast<std::size_t>( sysconf( _SC_PAGESIZE ) );
+	std::size_t length = mImageFormat.getDataSizeInBytes();
+	mBufferStride = ( (length + pageSize - 1) / pageSize ) * pageSize;
+	mMemoryType = req->memory;
+	mBuffers.resize( req->count );
+	mQueuedBuffers.reserve( req->count );
+	mDoneBuffers.reserve( req->count );
+	for ( std::size_t i=0; i<mBuffers.size(); ++i )
+	{
+		mBuffers[i].length = length;
+		if ( mMemoryType!=V4L2_MEMORY_MMAP )
+			continue;
+		void* memory = NULL;
+		if ( posix_memalign( &memory, pageSize, mBufferStride )!=0 )
+		{
+			freeBuffers();
+			errno = ENOMEM;
+			return -1;
+		}
+		mBuffers[i].memory = static_cast<unsigned char*>( memory );
+	}
+	return 0;
+}
+
+// Must be called with mMutex locked, while not streaming
+void EmulatedCaptureBackend::freeBuffers()
+{
+	if ( mMemoryType==V4L2_MEMORY_MMAP )
+	{
+		for ( std::size_t i=0; i<mBuffers.size(); ++i )
+			free( mBuffers[i].memory );
+	}
+	mBuffers.clear();
+	mQueuedBuffers.clear();
+	mDoneBuffers.clear();
+	mBufferStride = 0;
+}
+
+int EmulatedCaptureBackend::queryBuffer( void* arg )
+{
+	struct v4l2_buffer* buf = static_cast<struct v4l2_buffer*>( arg );
+	std::lock_guard<std::mutex> lock( mMutex );
+	if ( buf->type!=V4L2_BUF_TYPE_VIDEO_CAPTURE || buf->index>=mBuffers.size() )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	const Buffer& buffer = mBuffers[buf->index];
+	buf->memory = mMemoryType;
+	buf->length = static_cast<unsigned int>( buffer.length );
+	if ( mMemoryType==V4L2_MEMORY_MMAP )
+		buf->m.offset = static_cast<unsigned int>( buf->index * mBufferStride );
+	buf->flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC | V4L2_BUF_FLAG_TSTAMP_SRC_EOF;
+	if ( buffer.isQueued )
+		buf->flags |= V4L2_BUF_FLAG_QUEUED;
+	if ( buffer.isDone )
+		buf->flags |= V4L2_BUF_FLAG_DONE;
+	return 0;
+}
+
+int EmulatedCaptureBackend::queueBuffer( void* arg )
+{
+	struct v4l2_buffer* buf = static_cast<struct v4l2_buffer*>( arg );
+	std::lock_guard<std::mutex> lock( mMutex );
+	if ( mIsDisconnected )
+	{
+		errno = ENODEV;
+		return -1;
+	}
+	if ( buf->type!=V4L2_BUF_TYPE_VIDEO_CAPTURE || buf->memory!=mMemoryType || buf->index>=mBuffers.size() )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	Buffer& buffer = mBuffers[buf->index];
+	if ( buffer.isQueued || buffer.isDone )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if ( mMemoryType==V4L2_MEMORY_USERPTR )
+	{
+		if ( buf->m.userptr==0 || buf->length<buffer.length )
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		buffer.memory = reinterpret_cast<unsigned char*>( buf->m.userptr );
+	}
+	buffer.isQueued = true;
+	mQueuedBuffers.push_back( buf->index );
+	mCondition.notify_all();
+	return 0;
+}
+
+int EmulatedCaptureBackend::dequeueBuffer( void* arg )
+{
+	struct v4l2_buffer* buf = static_cast<struct v4l2_buffer*>( arg );
+	std::lock_guard<std::mutex> lock( mMutex );
+	if ( mIsDisconnected )
+	{
+		errno = ENODEV;
+		return -1;
+	}
+	if ( buf->type!=V4L2_BUF_TYPE_VIDEO_CAPTURE || buf->memory!=mMemoryType )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if ( mDoneBuffers.empty() )
+	{
+		errno = mIsStreaming ? EAGAIN : EINVAL;
+		return -1;
+	}
+
+	unsigned int bufferIndex = mDoneBuffers.front();
+	mDoneBuffers.erase( mDoneBuffers.begin() );
+	uint64_t value = 0;
+	if ( read( mHandle, &value, sizeof(value) )!=sizeof(value) )
+		fprintf( stderr, "Failed to consume the ready event of emulated device %s\n", mDeviceName.c_str() );
+
+	Buffer& buffer = mBuffers[bufferIndex];
+	buffer.isDone = false;
+	buf->index = bufferIndex;
+	buf->bytesused = static_cast<unsigned int>( buffer.length );
+	buf->flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC | V4L2_BUF_FLAG_TSTAMP_SRC_EOF;
+	buf->field = V4L2_FIELD_NONE;
+	buf->sequence = buffer.sequenceNumber;
+	buf->timestamp.tv_sec = static_cast<time_t>( buffer.timestampInNs / 1000000000LL );
+	buf->timestamp.tv_usec = static_cast<suseconds_t>( (buffer.timestampInNs % 1000000000LL) / 1000 );
+	buf->length = static_cast<unsigned int>( buffer.length );
+	if ( mMemoryType==V4L2_MEMORY_USERPTR )
+		buf->m.userptr = reinterpret_cast<unsigned long>( buffer.memory );
+	else
+		buf->m.offset = static_cast<unsigned int>( bufferIndex * mBufferStride );
+	return 0;
+}
+
+int EmulatedCaptureBackend::startStreaming( void* arg )
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	if ( *static_cast<int*>(arg)!=V4L2_BUF_TYPE_VIDEO_CAPTURE || mBuffers.empty() )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if ( mIsStreaming )
+		return 0;
+	mIsStreaming = true;
+	mIsGeneratorThreadExiting = false;
+	mSequenceNumber = 0;
+	mGeneratorThread = std::thread( &EmulatedCaptureBackend::generatorThreadMain, this );
+	return 0;
+}
+
+// Stopping returns all the buffers to the application, queued or done. Also called 
+// internally with a NULL argument. Like a real driver, an unplugged device fails with 
+// ENODEV, although its buffers are returned all the same
+int EmulatedCaptureBackend::stopStreaming( void* arg )
+{
+	if ( arg && *static_cast<int*>(arg)!=V4L2_BUF_TYPE_VIDEO_CAPTURE )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		if ( !mIsStreaming )
+		{
+			if ( mIsDisconnected )
+			{
+				errno = ENODEV;
+				return -1;
+			}
+			return 0;
+		}
+		mIsGeneratorThreadExiting = true;
+		mCondition.notify_all();
+	}
+	mGeneratorThread.join();
+
+	std::lock_guard<std::mutex> lock( mMutex );
+	mIsStreaming = false;
+	mIsGeneratorThreadExiting = false;
+	mQueuedBuffers.clear();
+	mDoneBuffers.clear();
+	for ( std::size_t i=0; i<mBuffers.size(); ++i )
+	{
+		mBuffers[i].isQueued = false;
+		mBuffers[i].isDone = false;
+	}
+	if ( mIsDisconnected )
+	{
+		errno = ENODEV;
+		return -1;
+	}
+	resetHandle();
+	return 0;
+}
+
+// Consume the ready events left, one at a time in semaphore mode
+void EmulatedCaptureBackend::resetHandle()
+{
+	uint64_t value = 0;
+	while ( read( mHandle, &value, sizeof(value) )==sizeof(value) )
+	{
+	}
+}
+
+int64_t EmulatedCaptureBackend::getMonotonicTimeInNs()
+{
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return static_cast<int64_t>(now.tv_sec) * 1000000000LL + now.tv_nsec;
+}
+
+int64_t EmulatedCaptureBackend::getFrameIntervalInNs( uint32_t /*sequenceNumber*/ ) const
+{
+	return 1000000000LL / mFrameRateInHz;
+}
+
+// Produce a frame at each frame interval in a queued buffer, or as soon as one is queued in 
+// free-running mode. The frame is generated without holding the mutex
+void EmulatedCaptureBackend::generatorThreadMain()
+{
+	std::unique_lock<std::mutex> lock( mMutex );
+	std::chrono::steady_clock::time_point nextFrameTime = std::chrono::steady_clock::now();
+	while ( !mIsGeneratorThreadExiting )
+	{
+		if ( mIsDisconnected || !hasFrame( mSequenceNumber ) )
+		{
+			mCondition.wait( lock );
+			continue;
+		}
+
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if ( mIsFreeRunning )
+		{
+			if ( mQueuedBuffers.empty() )
+			{
+				mCondition.wait( lock );
+				continue;
+			}
+			nextFrameTime = now;
+		}
+		else
+		{
+			if ( now<nextFrameTime )
+			{
+				mCondition.wait_until( lock, nextFrameTime );
+				continue;
+			}
+
+			// After a stall, resume at the frame rate rather than catching up with a burst
+			std::chrono::nanoseconds frameInterval( getFrameIntervalInNs( mSequenceNumber ) );
+			nextFrameTime += frameInterval;
+			if ( nextFrameTime<now )
+				nextFrameTime = now + frameInterval;
+
+			// No buffer to capture into: the frame is lost
+			if ( mQueuedBuffers.empty() )
+			{
+				mSequenceNumber++;
+				continue;
+			}
+		}
+
+		unsigned int bufferIndex = mQueuedBuffers.front();
+		mQueuedBuffers.erase( mQueuedBuffers.begin() );
+		uint32_t sequenceNumber = mSequenceNumber++;
+		unsigned char* memory = mBuffers[bufferIndex].memory;
+		lock.unlock();
+		generateFrame( memory, sequenceNumber );
+		int64_t timestampInNs = getMonotonicTimeInNs();
+		lock.lock();
+
+		Buffer& buffer = mBuffers[bufferIndex];
+		buffer.isQueued = false;
+		buffer.isDone = true;
+		buffer.sequenceNumber = sequenceNumber;
+		buffer.timestampInNs = timestampInNs;
+		mDoneBuffers.push_back( bufferIndex );
+		uint64_t value = 1;
+		if ( write( mHandle, &value, sizeof(value) )!=sizeof(value) )
+			fprintf( stderr, "Failed to signal a frame of emulated device %s\n", mDeviceName.c_str() );
+	}
+}
+
+}
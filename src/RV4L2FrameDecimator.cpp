@@ -0,0 +1,101 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include "RV4L2FrameDecimator.h"
+
+namespace RV4L2
+{
+
+FrameDecimator::FrameDecimator( unsigned int frameDivider, float maxRateInHz )
+	: mFrameDivider(1),
+	  mMaxRateInHz(0.f),
+	  mMinIntervalInNs(0),
+	  mNumFramesSinceKept(0),
+	  mHasKeptFrame(false),
+	  mNextTimestampInNs(0),
+	  mHasLastTimestamp(false),
+	  mLastTimestampInNs(0),
+	  mNumKeptFrames(0),
+	  mNumSkippedFrames(0)
+{
+	setFrameDivider( frameDivider );
+	setMaxRateInHz( maxRateInHz );
+}
+
+void FrameDecimator::setFrameDivider( unsigned int frameDivider )
+{
+	mFrameDivider = frameDivider>0 ? frameDivider : 1;
+	reset();
+}
+
+void FrameDecimator::setMaxRateInHz( float maxRateInHz )
+{
+	mMaxRateInHz = maxRateInHz>0.f ? maxRateInHz : 0.f;
+	mMinIntervalInNs = mMaxRateInHz>0.f ? static_cast<int64_t>( 1e9 / mMaxRateInHz ) : 0;
+	reset();
+}
+
+// Forget the frames seen so far, the next one is kept. Called when a new capture starts
+void FrameDecimator::reset()
+{
+	mNumFramesSinceKept = 0;
+	mHasKeptFrame = false;
+	mNextTimestampInNs = 0;
+	mHasLastTimestamp = false;
+	mLastTimestampInNs = 0;
+}
+
+bool FrameDecimator::keepFrame( int64_t timestampInNs )
+{
+	int64_t frameIntervalInNs = mHasLastTimestamp ? timestampInNs - mLastTimestampInNs : 0;
+	mHasLastTimestamp = true;
+	mLastTimestampInNs = timestampInNs;
+
+	bool keep = !mHasKeptFrame;
+	if ( mHasKeptFrame )
+	{
+		keep = mNumFramesSinceKept+1>=mFrameDivider;
+		if ( keep && mMinIntervalInNs>0 )
+		{
+			if ( frameIntervalInNs<0 || timestampInNs-mNextTimestampInNs>=mMinIntervalInNs )
+				mHasKeptFrame = false;		// Restart the schedule from this frame
+			else
+				keep = timestampInNs >= mNextTimestampInNs - frameIntervalInNs/2;
+		}
+	}
+
+	if ( !keep )
+	{
+		mNumFramesSinceKept++;
+		mNumSkippedFrames++;
+		return false;
+	}
+
+	mNextTimestampInNs = mHasKeptFrame ? mNextTimestampInNs + mMinIntervalInNs : timestampInNs + mMinIntervalInNs;
+	mHasKeptFrame = true;
+	mNumFramesSinceKept = 0;
+	mNumKeptFrames++;
+	return true;
+}
+
+}
@@ -0,0 +1,76 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include "RV4L2FrameLease.h"
+
+#include <stddef.h>		// For NULL
+#include <assert.h>
+
+#include "RV4L2Device.h"
+
+namespace RV4L2
+{
+
+FrameLease::FrameLease( Device* device, unsigned int bufferIndex, const ImageFormat& imageFormat, unsigned char* const* planeBytes, const unsigned int* planeSizesInBytes, unsigned int numPlanes )
+	: mDevice(device),
+	  mBufferIndex(bufferIndex),
+	  mGeneration(0),
+	  mCapturedImage(imageFormat, planeBytes, planeSizesInBytes, numPlanes),
+	  mPixelFormat(0),
+	  mNumReferences(0)
+{
+	assert( mDevice );
+	for ( unsigned int i=0; i<Image::MaxNumPlanes; ++i )
+	{
+		mDmaBufFds[i] = -1;
+		mBytesPerLine[i] = 0;
+		mBytesUsed[i] = 0;
+	}
+}
+
+int FrameLease::getDmaBufFd( unsigned int planeIndex ) const
+{
+	assert( planeIndex<getNumPlanes() );
+	return mDmaBufFds[planeIndex];
+}
+
+unsigned int FrameLease::getBytesPerLine( unsigned int planeIndex ) const
+{
+	assert( planeIndex<getNumPlanes() );
+	return mBytesPerLine[planeIndex];
+}
+
+unsigned int FrameLease::getBytesUsed( unsigned int planeIndex ) const
+{
+	assert( planeIndex<getNumPlanes() );
+	return mBytesUsed[planeIndex];
+}
+
+// Give up this reference onto the buffer. The buffer is re-queued to the driver once 
+// the last reference is released
+void FrameLease::release()
+{
+	mDevice->releaseFrameLease( this );
+}
+
+}
@@ -0,0 +1,376 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include "RV4L2FrameRecorder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <algorithm>
+
+namespace RV4L2
+{
+
+const unsigned int FrameRecorder::RecordAlignment;
+const uint32_t FrameRecorder::FrameHeaderMagic;
+const unsigned int FrameRecorder::mMaxSlotsPerWrite;
+
+static_assert( sizeof(FrameRecorder::FrameHeader)==64, "The frame header layout must not change" );
+
+FrameRecorder::FrameRecorder( const char* directory, const char* baseName, uint64_t segmentSizeInBytes, unsigned int numSlots )
+	:	mDirectory(directory),
+		mBaseName(baseName),
+		mSegmentSizeInBytes(segmentSizeInBytes),
+		mNumSlots(std::max(numSlots, 2u)),
+		mBackpressurePolicy(DropFrames),
+		mIsRecording(false),
+		mSlotMemory(NULL),
+		mSlotSizeInBytes(0),
+		mFreeSlots(),
+		mFilledSlots(),
+		mNumSlotsBeingFilled(0),
+		mNumPendingDroppedFrames(0),
+		mIsStopping(false),
+		mSlotsMutex(),
+		mSlotFreedCondition(),
+		mSlotFilledCondition(),
+		mWriterThread(),
+		mSegmentHandle(-1),
+		mSegmentOffset(0),
+		mNumSegments(0),
+		mIsUsingDirectIO(true),
+		mNumRecordedFrames(0),
+		mNumDroppedFrames(0),
+		mNumRecordedBytes(0)
+{
+}
+
+FrameRecorder::~FrameRecorder()
+{
+	stop();
+}
+
+bool FrameRecorder::setBackpressurePolicy( BackpressurePolicy policy )
+{
+	if ( isRecording() )
+		return false;
+	mBackpressurePolicy = policy;
+	return true;
+}
+
+std::string FrameRecorder::getSegmentFileName( unsigned int segmentIndex ) const
+{
+	char suffix[32];
+	snprintf( suffix, sizeof(suffix), "-%06u.rv4l2raw", segmentIndex );
+	return mDirectory + "/" + mBaseName + suffix;
+}
+
+uint32_t FrameRecorder::getRecordSizeInBytes( uint32_t dataSizeInBytes )
+{
+	uint32_t size = static_cast<uint32_t>( sizeof(FrameHeader) ) + dataSizeInBytes;
+	return ( (size + RecordAlignment - 1) / RecordAlignment ) * RecordAlignment;
+}
+
+// The slots are sized for the largest image to be recorded, larger images get dropped
+bool FrameRecorder::start( const ImageFormat& largestImageFormat )
+{
+	if ( isRecording() )
+		return false;
+
+	mSlotSizeInBytes = getRecordSizeInBytes( largestImageFormat.getDataSizeInBytes() );
+	if ( mSegmentSizeInBytes<mSlotSizeInBytes )
+		mSegmentSizeInBytes = mSlotSizeInBytes;
+	void* memory = NULL;
+	if ( posix_memalign( &memory, RecordAlignment, mSlotSizeInBytes * mNumSlots )!=0 )
+	{
+		fprintf( stderr, "Out of memory\n" );
+		return false;
+	}
+	mSlotMemory = static_cast<unsigned char*>( memory );
+
+	mNumSegments = 0;
+	mIsUsingDirectIO = true;
+	if ( !openSegment( false ) )
+	{
+		free( mSlotMemory );
+		mSlotMemory = NULL;
+		return false;
+	}
+
+	mFreeSlots.clear();
+	mFilledSlots.clear();
+	mNumSlotsBeingFilled = 0;
+	for ( unsigned int i=0; i<mNumSlots; ++i )
+		mFreeSlots.push_back( i );
+	mNumPendingDroppedFrames = 0;
+	mIsStopping = false;
+	mNumRecordedFrames = 0;
+	mNumDroppedFrames = 0;
+	mNumRecordedBytes = 0;
+	mIsRecording = true;
+	mWriterThread = std::thread( &FrameRecorder::writerThreadMain, this );
+	return true;
+}
+
+// The images already copied to the slots are written before returning
+void FrameRecorder::stop()
+{
+	if ( !isRecording() )
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock( mSlotsMutex );
+		mIsStopping = true;
+		mSlotFilledCondition.notify_all();
+		mSlotFreedCondition.notify_all();
+	}
+	mWriterThread.join();
+	closeSegment();
+	mIsRecording = false;
+
+	free( mSlotMemory );
+	mSlotMemory = NULL;
+	mFreeSlots.clear();
+}
+
+// Copy the image into a free slot for the writer thread. Returns false if the image was dropped
+bool FrameRecorder::record( const CapturedImage& capturedImage )
+{
+	if ( !isRecording() )
+		return false;
+
+	const Image& image = capturedImage.getImage();
+	const ImageFormat& imageFormat = image.getFormat();
+	uint32_t dataSizeInBytes = imageFormat.getDataSizeInBytes();
+	uint32_t recordSizeInBytes = getRecordSizeInBytes( dataSizeInBytes );
+	
+	unsigned int slotIndex = 0;
+	uint32_t numDroppedFrames = 0;
+	{
+		std::unique_lock<std::mutex> lock( mSlotsMutex );
+		bool canRecord = recordSizeInBytes<=mSlotSizeInBytes;
+		while ( canRecord && mFreeSlots.empty() )
+		{
+			if ( mBackpressurePolicy==DropFrames || mIsStopping )
+				canRecord = false;
+			else
+				mSlotFreedCondition.wait( lock );
+		}
+		if ( !canRecord || mIsStopping )
+		{
+			mNumPendingDroppedFrames++;
+			mNumDroppedFrames++;
+			return false;
+		}
+		slotIndex = mFreeSlots.front();
+		mFreeSlots.pop_front();
+		mNumSlotsBeingFilled++;
+		numDroppedFrames = mNumPendingDroppedFrames;
+		mNumPendingDroppedFrames = 0;
+	}
+
+	unsigned char* slot = getSlot( slotIndex );
+	FrameHeader* header = reinterpret_cast<FrameHeader*>( slot );
+	memset( header, 0, sizeof(FrameHeader) );
+	header->magic = FrameHeaderMagic;
+	header->headerSizeInBytes = sizeof(FrameHeader);
+	header->recordSizeInBytes = recordSizeInBytes;
+	header->encoding = static_cast<uint32_t>( imageFormat.getEncoding() );
+	header->width = imageFormat.getWidth();
+	header->height = imageFormat.getHeight();
+	header->dataSizeInBytes = dataSizeInBytes;
+	header->sequenceNumber = capturedImage.getSequenceNumber();
+	header->timestampInNs = capturedImage.getTimestampInNs();
+	header->timestampClock = static_cast<uint32_t>( capturedImage.getTimestampClock() );
+	header->numDroppedFrames = numDroppedFrames;
+
+	// The planes of a multi-planar image are stored one after the other
+	unsigned char* data = slot + sizeof(FrameHeader);
+	if ( image.getNumPlanes()>1 )
+	{
+		for ( unsigned int planeIndex=0; planeIndex<image.getNumPlanes(); ++planeIndex )
+		{
+			unsigned int planeSizeInBytes = imageFormat.getPlaneSizeInBytes( planeIndex );
+			memcpy( data + imageFormat.getPlaneOffsetInBytes( planeIndex ), image.getPlaneBuffer( planeIndex ).getBytes(), planeSizeInBytes );
+		}
+	}
+	else
+	{
+		memcpy( data, image.getBuffer().getBytes(), dataSizeInBytes );
+	}
+	memset( data + dataSizeInBytes, 0, recordSizeInBytes - sizeof(FrameHeader) - dataSizeInBytes );
+
+	std::lock_guard<std::mutex> lock( mSlotsMutex );
+	mNumSlotsBeingFilled--;
+	mFilledSlots.push_back( slotIndex );
+	mSlotFilledCondition.notify_one();
+	return true;
+}
+
+void FrameRecorder::onDeviceCapturedImage( Device* device )
+{
+	record( *device->getCapturedImage() );
+}
+
+// Open the next segment file, or with reopen, the current one again without O_DIRECT
+bool FrameRecorder::openSegment( bool reopen )
+{
+	std::string fileName = getSegmentFileName( reopen ? mNumSegments-1 : mNumSegments.load() );
+	int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (reopen ? 0 : O_TRUNC);
+	int handle = -1;
+	if ( mIsUsingDirectIO )
+	{
+		handle = open( fileName.c_str(), flags | O_DIRECT, 0644 );
+		if ( handle==-1 && errno==EINVAL )
+			mIsUsingDirectIO = false;		// The file system doesn't support it
+	}
+	if ( !mIsUsingDirectIO )
+		handle = open( fileName.c_str(), flags, 0644 );
+	if ( handle==-1 )
+	{
+		fprintf( stderr, "Cannot open %s. %s (%d)\n", fileName.c_str(), strerror(errno), errno );
+		return false;
+	}
+
+	if ( !reopen )
+	{
+		// Not all the file systems can preallocate, the segment then grows as it's written
+		if ( fallocate( handle, 0, 0, static_cast<off_t>(mSegmentSizeInBytes) )==-1 && errno==ENOSPC )
+		{
+			fprintf( stderr, "Not enough space for segment %s\n", fileName.c_str() );
+			close( handle );
+			return false;
+		}
+		mSegmentOffset = 0;
+		mNumSegments++;
+	}
+	else
+	{
+		close( mSegmentHandle );
+	}
+	mSegmentHandle = handle;
+	return true;
+}
+
+// Trim the preallocated space left
+void FrameRecorder::closeSegment()
+{
+	if ( mSegmentHandle==-1 )
+		return;
+	if ( ftruncate( mSegmentHandle, static_cast<off_t>(mSegmentOffset) )==-1 )
+		fprintf( stderr, "Failed to trim segment %s\n", getSegmentFileName( mNumSegments-1 ).c_str() );
+	close( mSegmentHandle );
+	mSegmentHandle = -1;
+}
+
+// Write consecutive slots with as few calls as possible, starting a new segment when the 
+// current one is full. The images that can't be written are counted as dropped
+bool FrameRecorder::writeSlots( const unsigned int* slotIndices, unsigned int numSlots )
+{
+	unsigned int i = 0;
+	while ( i<numSlots )
+	{
+		struct iovec iovecs[mMaxSlotsPerWrite];
+		unsigned int numIovecs = 0;
+		uint64_t numBytes = 0;
+		while ( i+numIovecs<numSlots && numIovecs<mMaxSlotsPerWrite )
+		{
+			const FrameHeader* header = reinterpret_cast<const FrameHeader*>( getSlot( slotIndices[i+numIovecs] ) );
+			if ( mSegmentOffset + numBytes + header->recordSizeInBytes > mSegmentSizeInBytes )
+				break;
+			iovecs[numIovecs].iov_base = getSlot( slotIndices[i+numIovecs] );
+			iovecs[numIovecs].iov_len = header->recordSizeInBytes;
+			numBytes += header->recordSizeInBytes;
+			numIovecs++;
+		}
+		if ( numIovecs==0 )
+		{
+			closeSegment();
+			if ( !openSegment( false ) )
+				break;
+			continue;
+		}
+
+		ssize_t ret = pwritev( mSegmentHandle, iovecs, static_cast<int>(numIovecs), static_cast<off_t>(mSegmentOffset) );
+		if ( ret==-1 && errno==EINVAL && mIsUsingDirectIO )
+		{
+			// Some file systems accept O_DIRECT at open time but not the writes
+			mIsUsingDirectIO = false;
+			if ( !openSegment( true ) )
+				break;
+			continue;
+		}
+		if ( ret!=static_cast<ssize_t>(numBytes) )
+		{
+			fprintf( stderr, "Failed to write to segment %s. %s (%d)\n", getSegmentFileName( mNumSegments-1 ).c_str(), ret==-1 ? strerror(errno) : "Short write", ret==-1 ? errno : 0 );
+			break;
+		}
+		mSegmentOffset += numBytes;
+		mNumRecordedBytes += numBytes;
+		mNumRecordedFrames += numIovecs;
+		i += numIovecs;
+	}
+
+	if ( i<numSlots )
+	{
+		mNumDroppedFrames += numSlots - i;
+		return false;
+	}
+	return true;
+}
+
+void FrameRecorder::writerThreadMain()
+{
+	unsigned int slotIndices[mMaxSlotsPerWrite];
+	std::unique_lock<std::mutex> lock( mSlotsMutex );
+	for ( ;; )
+	{
+		// When stopping, the slots being filled are still waited for
+		while ( mFilledSlots.empty() && (!mIsStopping || mNumSlotsBeingFilled>0) )
+			mSlotFilledCondition.wait( lock );
+		if ( mFilledSlots.empty() )
+			return;
+
+		unsigned int numSlots = 0;
+		while ( !mFilledSlots.empty() && numSlots<mMaxSlotsPerWrite )
+		{
+			slotIndices[numSlots++] = mFilledSlots.front();
+			mFilledSlots.pop_front();
+		}
+
+		lock.unlock();
+		writeSlots( slotIndices, numSlots );
+		lock.lock();
+
+		for ( unsigned int i=0; i<numSlots; ++i )
+			mFreeSlots.push_back( slotIndices[i] );
+		mSlotFreedCondition.notify_all();
+	}
+}
+
+}
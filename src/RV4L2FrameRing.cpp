@@ -0,0 +1,245 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include "RV4L2FrameRing.h"
+
+#include <stddef.h>		// For NULL
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+
+namespace RV4L2
+{
+
+FrameRing::FrameRing( unsigned int capacity, OverflowPolicy overflowPolicy )
+	: mCapacity( capacity>0 ? capacity : 1 ),
+	  mOverflowPolicy(overflowPolicy),
+	  mSlots(NULL),
+	  mHead(0),
+	  mTail(0),
+	  mIsClosed(false),
+	  mNumPendingFrames(),
+	  mNumFreeSlots(),
+	  mNumPushedFrames(0),
+	  mNumPoppedFrames(0),
+	  mNumOverwrittenFrames(0),
+	  mNumBlockedPushes(0),
+	  mNumRejectedFrames(0)
+{
+	mSlots = new std::atomic<FrameLease*>[mCapacity];
+	for ( unsigned int i=0; i<mCapacity; ++i )
+		mSlots[i] = NULL;
+	sem_init( &mNumPendingFrames, 0, 0 );
+	sem_init( &mNumFreeSlots, 0, mCapacity );
+}
+
+FrameRing::~FrameRing()
+{
+	clear();
+	sem_destroy( &mNumFreeSlots );
+	sem_destroy( &mNumPendingFrames );
+	delete[] mSlots;
+	mSlots = NULL;
+}
+
+unsigned int FrameRing::getSize() const
+{
+	uint64_t tail = mTail.load( std::memory_order_acquire );
+	uint64_t head = mHead.load( std::memory_order_acquire );
+	return head>tail ? static_cast<unsigned int>(head-tail) : 0;
+}
+
+// Publish a lease into the ring, which takes over the reference. If the lease can't 
+// be stored (the ring is closed), it is released and false is returned
+bool FrameRing::push( FrameLease* frameLease )
+{
+	assert( frameLease );
+	
+	if ( mOverflowPolicy==BlockProducer && sem_trywait( &mNumFreeSlots )==-1 )
+	{
+		mNumBlockedPushes++;
+		while ( !mIsClosed && !waitSemaphore( &mNumFreeSlots, -1 ) )
+		{
+		}
+	}
+
+	if ( mIsClosed )
+	{
+		mNumRejectedFrames++;
+		frameLease->release();
+		return false;
+	}
+
+	uint64_t head = mHead.load( std::memory_order_relaxed );
+	bool overwritten = false;
+	for ( ;; )
+	{
+		uint64_t tail = mTail.load( std::memory_order_acquire );
+		if ( head-tail<mCapacity )
+			break;
+
+		// Only reachable with the OverwriteOldest policy: take the oldest slot over, 
+		// unless the consumer has just popped it
+		assert( mOverflowPolicy==OverwriteOldest );
+		FrameLease* oldestFrameLease = mSlots[tail % mCapacity].load( std::memory_order_acquire );
+		if ( mTail.compare_exchange_strong( tail, tail+1, std::memory_order_acq_rel ) )
+		{
+			oldestFrameLease->release();
+			mNumOverwrittenFrames++;
+			overwritten = true;
+			break;
+		}
+	}
+
+	mSlots[head % mCapacity].store( frameLease, std::memory_order_release );
+	mHead.store( head+1, std::memory_order_release );
+	mNumPushedFrames++;
+
+	// An overwritten frame was already accounted for by the consumer-side semaphore
+	if ( !overwritten )
+		sem_post( &mNumPendingFrames );
+	return true;
+}
+
+// Returns the oldest lease, handing its reference to the caller who must release it.
+// Returns NULL on timeout or when the ring is closed and empty
+FrameLease* FrameRing::pop( int timeoutInMs )
+{
+	for ( ;; )
+	{
+		// Once closed, the pending frames are handed out without waiting
+		bool isClosed = mIsClosed;
+		if ( !isClosed && !waitSemaphore( &mNumPendingFrames, timeoutInMs ) )
+		{
+			if ( mIsClosed )
+				continue;
+			return NULL;
+		}
+		
+		FrameLease* frameLease = popOldest();
+		if ( frameLease )
+		{
+			mNumPoppedFrames++;
+			if ( mOverflowPolicy==BlockProducer )
+				sem_post( &mNumFreeSlots );
+			return frameLease;
+		}
+		
+		// Either the ring is closed and empty, or the frame we were woken up for
+		// has been overwritten in the meantime
+		if ( isClosed )
+			return NULL;
+	}
+}
+
+FrameLease* FrameRing::popOldest()
+{
+	for ( ;; )
+	{
+		uint64_t tail = mTail.load( std::memory_order_acquire );
+		uint64_t head = mHead.load( std::memory_order_acquire );
+		if ( tail==head )
+			return NULL;
+
+		// The slot may be overwritten concurrently by the producer, in which case the
+		// tail has moved on and the exchange fails
+		FrameLease* frameLease = mSlots[tail % mCapacity].load( std::memory_order_acquire );
+		if ( mTail.compare_exchange_strong( tail, tail+1, std::memory_order_acq_rel ) )
+			return frameLease;
+	}
+}
+
+// Accept frames again after a close(). Must not be called while the producer or the 
+// consumer is using the ring
+void FrameRing::open()
+{
+	clear();
+	while ( sem_trywait( &mNumPendingFrames )==0 )
+	{
+	}
+	while ( sem_trywait( &mNumFreeSlots )==0 )
+	{
+	}
+	for ( unsigned int i=0; i<mCapacity; ++i )
+		sem_post( &mNumFreeSlots );
+	mIsClosed = false;
+}
+
+// Reject any further frame and wake up the producer and the consumer if they are waiting
+void FrameRing::close()
+{
+	mIsClosed = true;
+	sem_post( &mNumFreeSlots );
+	sem_post( &mNumPendingFrames );
+}
+
+// Release all the pending leases
+void FrameRing::clear()
+{
+	FrameLease* frameLease = NULL;
+	while ( (frameLease = popOldest())!=NULL )
+		frameLease->release();
+}
+
+void FrameRing::resetCounters()
+{
+	mNumPushedFrames = 0;
+	mNumPoppedFrames = 0;
+	mNumOverwrittenFrames = 0;
+	mNumBlockedPushes = 0;
+	mNumRejectedFrames = 0;
+}
+
+bool FrameRing::waitSemaphore( sem_t* semaphore, int timeoutInMs )
+{
+	if ( timeoutInMs==0 )
+		return sem_trywait( semaphore )==0;
+
+	if ( timeoutInMs<0 )
+	{
+		while ( sem_wait( semaphore )==-1 )
+		{
+			if ( errno!=EINTR )
+				return false;
+		}
+		return true;
+	}
+	
+	struct timespec deadline;
+	clock_gettime( CLOCK_REALTIME, &deadline );
+	deadline.tv_sec += timeoutInMs / 1000;
+	deadline.tv_nsec += (timeoutInMs % 1000) * 1000000L;
+	if ( deadline.tv_nsec>=1000000000L )
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	while ( sem_timedwait( semaphore, &deadline )==-1 )
+	{
+		if ( errno!=EINTR )
+			return false;
+	}
+	return true;
+}
+
+}
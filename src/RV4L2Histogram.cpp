@@ -0,0 +1,159 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include "RV4L2Histogram.h"
+
+#include <assert.h>
+
+namespace RV4L2
+{
+
+const unsigned int Histogram::NumSubBucketBits;
+const unsigned int Histogram::NumSubBuckets;
+const unsigned int Histogram::NumBuckets;
+
+Histogram::Histogram()
+	: mCount(0),
+	  mSum(0),
+	  mMin(UINT64_MAX),
+	  mMax(0)
+{
+	for ( unsigned int i=0; i<NumBuckets; ++i )
+		mBuckets[i] = 0;
+}
+
+// Relaxed atomics are enough here: each counter is consistent on its own, and a reader 
+// tolerates seeing a value recorded in one counter but not yet in another
+void Histogram::record( uint64_t value )
+{
+	mBuckets[ getBucketIndex(value) ].fetch_add( 1, std::memory_order_relaxed );
+	mCount.fetch_add( 1, std::memory_order_relaxed );
+	mSum.fetch_add( value, std::memory_order_relaxed );
+
+	uint64_t min = mMin.load( std::memory_order_relaxed );
+	while ( value<min && !mMin.compare_exchange_weak( min, value, std::memory_order_relaxed ) )
+	{
+	}
+	uint64_t max = mMax.load( std::memory_order_relaxed );
+	while ( value>max && !mMax.compare_exchange_weak( max, value, std::memory_order_relaxed ) )
+	{
+	}
+}
+
+// Not atomic as a whole: values recorded concurrently may be partially kept
+void Histogram::reset()
+{
+	for ( unsigned int i=0; i<NumBuckets; ++i )
+		mBuckets[i].store( 0, std::memory_order_relaxed );
+	mCount = 0;
+	mSum = 0;
+	mMin = UINT64_MAX;
+	mMax = 0;
+}
+
+uint64_t Histogram::getMin() const
+{
+	uint64_t min = mMin;
+	return min==UINT64_MAX ? 0 : min;
+}
+
+double Histogram::getMean() const
+{
+	uint64_t count = mCount;
+	if ( count==0 )
+		return 0.0;
+	return static_cast<double>(mSum) / static_cast<double>(count);
+}
+
+// The value below which the given percentage (0 to 100) of the recorded values fall. 
+// It is the upper bound of the bucket reached, clamped to the maximum recorded value
+uint64_t Histogram::getValueAtPercentile( double percentile ) const
+{
+	uint64_t count = mCount;
+	if ( count==0 )
+		return 0;
+	if ( percentile<0.0 )
+		percentile = 0.0;
+	if ( percentile>100.0 )
+		percentile = 100.0;
+
+	uint64_t targetCount = static_cast<uint64_t>( percentile * static_cast<double>(count) / 100.0 + 0.5 );
+	if ( targetCount==0 )
+		targetCount = 1;
+
+	uint64_t cumulatedCount = 0;
+	for ( unsigned int i=0; i<NumBuckets; ++i )
+	{
+		cumulatedCount += mBuckets[i].load( std::memory_order_relaxed );
+		if ( cumulatedCount>=targetCount )
+		{
+			uint64_t value = getBucketUpperBound(i);
+			uint64_t max = mMax;
+			return value<max ? value : max;
+		}
+	}
+	return mMax;
+}
+
+uint64_t Histogram::getBucketCount( unsigned int bucketIndex ) const
+{
+	if ( bucketIndex>=NumBuckets )
+		return 0;
+	return mBuckets[bucketIndex];
+}
+
+// Values below NumSubBuckets have a bucket each. Above, the bucket is given by the position
+// of the most significant bit and the NumSubBucketBits bits that follow it
+unsigned int Histogram::getBucketIndex( uint64_t value )
+{
+	if ( value<NumSubBuckets )
+		return static_cast<unsigned int>(value);
+
+	unsigned int msb = 63 - static_cast<unsigned int>( __builtin_clzll(value) );
+	unsigned int shift = msb - NumSubBucketBits;
+	unsigned int subBucketIndex = static_cast<unsigned int>( (value >> shift) - NumSubBuckets );
+	unsigned int bucketIndex = NumSubBuckets + shift*NumSubBuckets + subBucketIndex;
+	assert( bucketIndex<NumBuckets );
+	return bucketIndex;
+}
+
+uint64_t Histogram::getBucketLowerBound( unsigned int bucketIndex )
+{
+	if ( bucketIndex<NumSubBuckets )
+		return bucketIndex;
+
+	unsigned int shift = (bucketIndex - NumSubBuckets) / NumSubBuckets;
+	unsigned int subBucketIndex = (bucketIndex - NumSubBuckets) % NumSubBuckets;
+	return static_cast<uint64_t>( NumSubBuckets + subBucketIndex ) << shift;
+}
+
+uint64_t Histogram::getBucketUpperBound( unsigned int bucketIndex )
+{
+	if ( bucketIndex<NumSubBuckets )
+		return bucketIndex;
+
+	unsigned int shift = (bucketIndex - NumSubBuckets) / NumSubBuckets;
+	return getBucketLowerBound(bucketIndex) + ( (static_cast<uint64_t>(1) << shift) - 1 );
+}
+
+}
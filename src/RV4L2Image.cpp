@@ -26,30 +26,132 @@
 #include <stdio.h>
 #include <cstring>
 #include <assert.h>
+#include <utility>
 
 namespace RV4L2
 {
 
+const unsigned int Image::MaxNumPlanes;
+
 // Construct an empty image with zero size. The image instance obtained can still  
 // be filled with data later using the assignment operator (which can modify its format).
 Image::Image()
 	: mFormat(),
-	  mBuffer()
+	  mPlaneBuffers(),
+	  mNumPlanes(1)
 {
 }
 
 // Construct a blank image of a specific format. The internal image data is allocated and zero-filled
 Image::Image( const ImageFormat& imageFormat )
 	: mFormat( imageFormat), 
-	  mBuffer( imageFormat.getDataSizeInBytes() )
+	  mPlaneBuffers{ MemoryBuffer( imageFormat.getDataSizeInBytes() ), MemoryBuffer(), MemoryBuffer() },
+	  mNumPlanes(1)
+{
+}
+
+// Construct an image that refers to data owned by someone else. The data must be large enough
+// for the format and outlive the image (or be re-attached through getBuffer())
+Image::Image( const ImageFormat& imageFormat, unsigned char* externalBytes )
+	: mFormat( imageFormat), 
+	  mPlaneBuffers{ MemoryBuffer( externalBytes, imageFormat.getDataSizeInBytes() ), MemoryBuffer(), MemoryBuffer() },
+	  mNumPlanes(1)
+{
+}
+
+// Construct an image that refers to data split into separate planes owned by someone else.
+// The planes are never repacked into a single buffer
+Image::Image( const ImageFormat& imageFormat, unsigned char* const* externalPlaneBytes, const unsigned int* planeSizesInBytes, unsigned int numPlanes )
+	: mFormat( imageFormat), 
+	  mPlaneBuffers(),
+	  mNumPlanes( numPlanes<MaxNumPlanes ? numPlanes : MaxNumPlanes )
 {
+	assert( numPlanes>0 && numPlanes<=MaxNumPlanes );
+	for ( unsigned int i=0; i<mNumPlanes; ++i )
+		mPlaneBuffers[i].attach( externalPlaneBytes[i], planeSizesInBytes[i] );
 }
 
 // Construct an image from another one. The source image data is copied during the process
 Image::Image( const Image& other )
 	: mFormat( other.getFormat() ), 
-	  mBuffer( other.getBuffer() )
+	  mPlaneBuffers{ other.mPlaneBuffers[0], other.mPlaneBuffers[1], other.mPlaneBuffers[2] },
+	  mNumPlanes( other.getNumPlanes() )
+{
+}
+
+// Take the data of another image over without copying it, whether it owns it or refers to 
+// external planes. The other image is left empty
+Image::Image( Image&& other )
+	: mFormat( other.getFormat() ), 
+	  mPlaneBuffers{ std::move(other.mPlaneBuffers[0]), std::move(other.mPlaneBuffers[1]), std::move(other.mPlaneBuffers[2]) },
+	  mNumPlanes( other.getNumPlanes() )
+{
+	other.mFormat = ImageFormat();
+	other.mNumPlanes = 1;
+}
+
+// The data is copied (into an owned buffer) as in the copy constructor
+Image& Image::operator=( const Image& other )
+{
+	Image image( other );
+	swap( image );
+	return *this;
+}
+
+Image& Image::operator=( Image&& other )
+{
+	Image image( std::move(other) );
+	swap( image );
+	return *this;
+}
+
+void Image::swap( Image& other )
+{
+	std::swap( mFormat, other.mFormat );
+	for ( unsigned int i=0; i<MaxNumPlanes; ++i )
+		mPlaneBuffers[i].swap( other.mPlaneBuffers[i] );
+	std::swap( mNumPlanes, other.mNumPlanes );
+}
+
+MemoryBuffer& Image::getPlaneBuffer( unsigned int planeIndex )
+{
+	assert( planeIndex<mNumPlanes );
+	return mPlaneBuffers[planeIndex];
+}
+
+const MemoryBuffer& Image::getPlaneBuffer( unsigned int planeIndex ) const
 {
+	assert( planeIndex<mNumPlanes );
+	return mPlaneBuffers[planeIndex];
 }
 
+// Total size of the image data, whether it is held in a single buffer or in separate planes
+unsigned int Image::getSizeInBytes() const
+{
+	unsigned int sizeInBytes = 0;
+	for ( unsigned int i=0; i<mNumPlanes; ++i )
+		sizeInBytes += mPlaneBuffers[i].getSizeInBytes();
+	return sizeInBytes;
+}
+
+// Change the format of the image. Owned data is resized, the previous allocation being reused 
+// if it is large enough. Data owned by someone else is left as is and must be re-attached
+void Image::setFormat( const ImageFormat& imageFormat )
+{
+	mFormat = imageFormat;
+	if ( mPlaneBuffers[0].ownsBytes() )
+		mPlaneBuffers[0].resize( imageFormat.getDataSizeInBytes() );
 }
+
+// Make the image refer to planes owned by someone else, keeping its format
+void Image::attachPlanes( unsigned char* const* externalPlaneBytes, const unsigned int* planeSizesInBytes, unsigned int numPlanes )
+{
+	assert( numPlanes>0 && numPlanes<=MaxNumPlanes );
+	mNumPlanes = numPlanes<MaxNumPlanes ? numPlanes : MaxNumPlanes;
+	for ( unsigned int i=0; i<mNumPlanes; ++i )
+		mPlaneBuffers[i].attach( externalPlaneBytes[i], planeSizesInBytes[i] );
+	for ( unsigned int i=mNumPlanes; i<MaxNumPlanes; ++i )
+		mPlaneBuffers[i].attach( NULL, 0 );
+}
+
+}
\ No newline at end of file
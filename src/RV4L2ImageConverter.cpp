@@ -24,6 +24,8 @@
 #include "RV4L2ImageConverter.h"
 
 #include <assert.h>
+#include <cstring>
+#include <utility>
 
 namespace RV4L2
 {
@@ -34,6 +36,25 @@ ImageConverter::ImageConverter( const ImageFormat& outputImageFormat )
 	mImage = new Image( outputImageFormat );
 }
 
+// The output image itself is handed over, it keeps its address
+ImageConverter::ImageConverter( ImageConverter&& other )
+	: mImage(other.mImage)
+{
+	other.mImage = NULL;
+}
+
+ImageConverter& ImageConverter::operator=( ImageConverter&& other )
+{
+	ImageConverter converter( std::move(other) );
+	swap( converter );
+	return *this;
+}
+
+void ImageConverter::swap( ImageConverter& other )
+{
+	std::swap( mImage, other.mImage );
+}
+
 ImageConverter::~ImageConverter()
 {
 	delete mImage;
@@ -43,24 +64,89 @@ ImageConverter::~ImageConverter()
 bool ImageConverter::update( const Image& sourceImage )
 {
 	if ( sourceImage.getFormat()==mImage->getFormat() )
-		return mImage->getBuffer().copyFrom( sourceImage.getBuffer() );
+	{
+		if ( sourceImage.getNumPlanes()==1 )
+			return mImage->getBuffer().copyFrom( sourceImage.getBuffer() );
+
+		// Pack the separate planes one after the other
+		const ImageFormat& format = mImage->getFormat();
+		unsigned char* destBytes = mImage->getBuffer().getBytes();
+		for ( unsigned int i=0; i<format.getNumPlanes(); ++i )
+		{
+			const unsigned char* planeBytes = getPlaneBytes( sourceImage, i );
+			if ( !planeBytes )
+				return false;
+			memcpy( destBytes + format.getPlaneOffsetInBytes(i), planeBytes, format.getPlaneSizeInBytes(i) );
+		}
+		return true;
+	}
 	return convertImage( sourceImage, *mImage );
 }
 
+// Check the encodings and that the source and destination images have the same size
+bool ImageConverter::checkConversion( const Image& sourceImage, ImageFormat::Encoding sourceEncoding, const Image& destImage )
+{
+	if ( sourceImage.getFormat().getEncoding()!=sourceEncoding )
+		return false;
+	if ( destImage.getFormat().getEncoding()!=ImageFormat::RGB24 )
+		return false;
+	if ( destImage.getFormat().getWidth()!=sourceImage.getFormat().getWidth() || 
+		 destImage.getFormat().getHeight()!=sourceImage.getFormat().getHeight() )
+		 return false;
+	return true;
+}
+
+// Locate a plane of the image data, whether the planes are stored in separate buffers
+// or one after the other in a single one
+const unsigned char* ImageConverter::getPlaneBytes( const Image& image, unsigned int planeIndex )
+{
+	const ImageFormat& format = image.getFormat();
+	if ( planeIndex>=format.getNumPlanes() )
+		return NULL;
+
+	if ( image.getNumPlanes()==1 )
+	{
+		const MemoryBuffer& buffer = image.getBuffer();
+		if ( buffer.getSizeInBytes()<format.getDataSizeInBytes() )
+			return NULL;
+		return buffer.getBytes() + format.getPlaneOffsetInBytes(planeIndex);
+	}
+
+	if ( planeIndex>=image.getNumPlanes() )
+		return NULL;
+	const MemoryBuffer& buffer = image.getPlaneBuffer(planeIndex);
+	if ( buffer.getSizeInBytes()<format.getPlaneSizeInBytes(planeIndex) )
+		return NULL;
+	return buffer.getBytes();
+}
+
+bool ImageConverter::isBayerEncoding( ImageFormat::Encoding encoding )
+{
+	return	encoding==ImageFormat::BayerBGGR8 || encoding==ImageFormat::BayerGBRG8 || 
+			encoding==ImageFormat::BayerGRBG8 || encoding==ImageFormat::BayerRGGB8;
+}
+
 #define CLIP_INT_TO_UCHAR(value) ( (value)<0 ? 0 : ( (value)>255 ? 255 : static_cast<unsigned char>(value) ) ) 
 
+// BT.601 conversion of a single pixel, see convertYUYVImageToRGB24Image() 
+#define YUV_TO_RGB24(y, u, v, destBytes) \
+	{ \
+		int c = (y) - 16; \
+		int d = (u) - 128; \
+		int e = (v) - 128; \
+		(destBytes)[0] = CLIP_INT_TO_UCHAR(( 298 * c           + 409 * e + 128) >> 8); \
+		(destBytes)[1] = CLIP_INT_TO_UCHAR(( 298 * c - 100 * d - 208 * e + 128) >> 8); \
+		(destBytes)[2] = CLIP_INT_TO_UCHAR(( 298 * c + 516 * d           + 128) >> 8); \
+	}
+
 bool ImageConverter::convertYUYVImageToRGB24Image( const Image& sourceImage, Image& destImage )
 {
 	// Pre-checks
-	if ( sourceImage.getFormat().getEncoding()!=ImageFormat::YUYV )
-		return false;
-	if ( destImage.getFormat().getEncoding()!=ImageFormat::RGB24 )
+	if ( !checkConversion( sourceImage, ImageFormat::YUYV, destImage ) )
 		return false;
 
 	unsigned int width = sourceImage.getFormat().getWidth();
 	unsigned int height = sourceImage.getFormat().getHeight();
-	if ( destImage.getFormat().getWidth()!=width || destImage.getFormat().getHeight()!=height )
-		 return false;
 
 	// General information about YUV color space can be found here:
 	// http://en.wikipedia.org/wiki/YUV 
@@ -99,6 +185,157 @@ bool ImageConverter::convertYUYVImageToRGB24Image( const Image& sourceImage, Ima
 	return true;
 }
 
+// Same as YUYV with the luma and chroma bytes swapped
+bool ImageConverter::convertUYVYImageToRGB24Image( const Image& sourceImage, Image& destImage )
+{
+	if ( !checkConversion( sourceImage, ImageFormat::UYVY, destImage ) )
+		return false;
+
+	unsigned int width = sourceImage.getFormat().getWidth();
+	unsigned int height = sourceImage.getFormat().getHeight();
+	const unsigned char* sourceBytes = sourceImage.getBuffer().getBytes();
+	unsigned char* destBytes = destImage.getBuffer().getBytes();
+	for ( unsigned int y=0; y<height; ++y )
+	{
+		for ( unsigned int i=0; i<width/2; ++i )
+		{
+			int u0 = sourceBytes[0];
+			int y0 = sourceBytes[1];
+			int v0 = sourceBytes[2];
+			int y1 = sourceBytes[3];
+			sourceBytes += 4;	
+			YUV_TO_RGB24( y0, u0, v0, destBytes );
+			YUV_TO_RGB24( y1, u0, v0, destBytes+3 );
+			destBytes += 6;
+		}
+	}
+	return true;
+}
+
+bool ImageConverter::convertNV12ImageToRGB24Image( const Image& sourceImage, Image& destImage )
+{
+	if ( !checkConversion( sourceImage, ImageFormat::NV12, destImage ) )
+		return false;
+
+	const ImageFormat& format = sourceImage.getFormat();
+	const unsigned char* lumaBytes = getPlaneBytes( sourceImage, 0 );
+	const unsigned char* chromaBytes = getPlaneBytes( sourceImage, 1 );
+	if ( !lumaBytes || !chromaBytes )
+		return false;
+
+	unsigned int width = format.getWidth();
+	unsigned int height = format.getHeight();
+	unsigned int chromaBytesPerLine = format.getPlaneNumBytesPerLine(1);
+	unsigned char* destBytes = destImage.getBuffer().getBytes();
+	for ( unsigned int y=0; y<height; ++y )
+	{
+		const unsigned char* chromaLine = chromaBytes + (y/2)*chromaBytesPerLine;
+		for ( unsigned int x=0; x<width; ++x )
+		{
+			const unsigned char* chroma = chromaLine + (x/2)*2;
+			YUV_TO_RGB24( lumaBytes[x], chroma[0], chroma[1], destBytes );
+			destBytes += 3;
+		}
+		lumaBytes += width;
+	}
+	return true;
+}
+
+bool ImageConverter::convertI420ImageToRGB24Image( const Image& sourceImage, Image& destImage )
+{
+	if ( !checkConversion( sourceImage, ImageFormat::I420, destImage ) )
+		return false;
+
+	const ImageFormat& format = sourceImage.getFormat();
+	const unsigned char* lumaBytes = getPlaneBytes( sourceImage, 0 );
+	const unsigned char* uBytes = getPlaneBytes( sourceImage, 1 );
+	const unsigned char* vBytes = getPlaneBytes( sourceImage, 2 );
+	if ( !lumaBytes || !uBytes || !vBytes )
+		return false;
+
+	unsigned int width = format.getWidth();
+	unsigned int height = format.getHeight();
+	unsigned int chromaBytesPerLine = format.getPlaneNumBytesPerLine(1);
+	unsigned char* destBytes = destImage.getBuffer().getBytes();
+	for ( unsigned int y=0; y<height; ++y )
+	{
+		const unsigned char* uLine = uBytes + (y/2)*chromaBytesPerLine;
+		const unsigned char* vLine = vBytes + (y/2)*chromaBytesPerLine;
+		for ( unsigned int x=0; x<width; ++x )
+		{
+			YUV_TO_RGB24( lumaBytes[x], uLine[x/2], vLine[x/2], destBytes );
+			destBytes += 3;
+		}
+		lumaBytes += width;
+	}
+	return true;
+}
+
+bool ImageConverter::convertGrayscale8ImageToRGB24Image( const Image& sourceImage, Image& destImage )
+{
+	if ( !checkConversion( sourceImage, ImageFormat::Grayscale8, destImage ) )
+		return false;
+
+	unsigned int numPixels = sourceImage.getFormat().getWidth() * sourceImage.getFormat().getHeight();
+	const unsigned char* sourceBytes = sourceImage.getBuffer().getBytes();
+	unsigned char* destBytes = destImage.getBuffer().getBytes();
+	for ( unsigned int i=0; i<numPixels; ++i )
+	{
+		destBytes[0] = sourceBytes[i];
+		destBytes[1] = sourceBytes[i];
+		destBytes[2] = sourceBytes[i];
+		destBytes += 3;
+	}
+	return true;
+}
+
+// Simple demosaicing: each 2x2 Bayer cell gives the red, the average of the two greens and 
+// the blue of its four destination pixels. This is cheap and good enough for previews
+bool ImageConverter::convertBayerImageToRGB24Image( const Image& sourceImage, Image& destImage )
+{
+	ImageFormat::Encoding encoding = sourceImage.getFormat().getEncoding();
+	if ( !isBayerEncoding(encoding) || !checkConversion( sourceImage, encoding, destImage ) )
+		return false;
+
+	// Position of the red and blue samples in the 2x2 cell (as 2*row+column)
+	unsigned int redIndex = 0;
+	unsigned int blueIndex = 0;
+	switch ( encoding )
+	{
+		case ImageFormat::BayerBGGR8:	redIndex = 3; blueIndex = 0; break;
+		case ImageFormat::BayerGBRG8:	redIndex = 2; blueIndex = 1; break;
+		case ImageFormat::BayerGRBG8:	redIndex = 1; blueIndex = 2; break;
+		default:						redIndex = 0; blueIndex = 3; break;
+	}
+	
+	unsigned int width = sourceImage.getFormat().getWidth();
+	unsigned int height = sourceImage.getFormat().getHeight();
+	const unsigned char* sourceBytes = sourceImage.getBuffer().getBytes();
+	unsigned char* destBytes = destImage.getBuffer().getBytes();
+	for ( unsigned int y=0; y+1<height; y+=2 )
+	{
+		const unsigned char* line0 = sourceBytes + y*width;
+		const unsigned char* line1 = line0 + width;
+		unsigned char* destLine0 = destBytes + y*width*3;
+		unsigned char* destLine1 = destLine0 + width*3;
+		for ( unsigned int x=0; x+1<width; x+=2 )
+		{
+			unsigned char cell[4] = { line0[x], line0[x+1], line1[x], line1[x+1] };
+			unsigned char red = cell[redIndex];
+			unsigned char blue = cell[blueIndex];
+			unsigned char green = static_cast<unsigned char>( (cell[1]+cell[2]+cell[0]+cell[3]-red-blue) / 2 );
+			unsigned char* pixels[4] = { destLine0 + x*3, destLine0 + (x+1)*3, destLine1 + x*3, destLine1 + (x+1)*3 };
+			for ( unsigned int i=0; i<4; ++i )
+			{
+				pixels[i][0] = red;
+				pixels[i][1] = green;
+				pixels[i][2] = blue;
+			}
+		}
+	}
+	return true;
+}
+
 bool ImageConverter::convertImage( const Image& sourceImage, Image& destinationImage )
 {
 	if ( sourceImage.getFormat()==destinationImage.getFormat() )
@@ -107,8 +344,21 @@ bool ImageConverter::convertImage( const Image& sourceImage, Image& destinationI
 	ImageFormat::Encoding sourceEncoding = sourceImage.getFormat().getEncoding();
 	ImageFormat::Encoding destinationEncoding = destinationImage.getFormat().getEncoding();
 
-	if ( sourceEncoding==ImageFormat::YUYV && destinationEncoding==ImageFormat::RGB24 )
-		return convertYUYVImageToRGB24Image( sourceImage, destinationImage );
+	if ( destinationEncoding!=ImageFormat::RGB24 )
+		return false;
+
+	switch ( sourceEncoding )
+	{
+		case ImageFormat::YUYV:			return convertYUYVImageToRGB24Image( sourceImage, destinationImage );
+		case ImageFormat::UYVY:			return convertUYVYImageToRGB24Image( sourceImage, destinationImage );
+		case ImageFormat::NV12:			return convertNV12ImageToRGB24Image( sourceImage, destinationImage );
+		case ImageFormat::I420:			return convertI420ImageToRGB24Image( sourceImage, destinationImage );
+		case ImageFormat::Grayscale8:	return convertGrayscale8ImageToRGB24Image( sourceImage, destinationImage );
+		default:
+			if ( isBayerEncoding(sourceEncoding) )
+				return convertBayerImageToRGB24Image( sourceImage, destinationImage );
+			break;
+	}
 	
 	return false;
 }
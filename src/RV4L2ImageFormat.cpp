@@ -34,6 +34,13 @@ unsigned int ImageFormat::mEncodingBitsPerPixel[EncodingCount] =
 		8,
 		24,
 		16,
+		16,
+		12,
+		12,
+		8,
+		8,
+		8,
+		8,
 		32
 	};
 
@@ -42,6 +49,13 @@ const char* ImageFormat::mEncodingNames[EncodingCount] =
 		"Grayscale8",
 		"RGB24",
 		"YUYV",
+		"UYVY",
+		"NV12",
+		"I420",
+		"BayerBGGR8",
+		"BayerGBRG8",
+		"BayerGRBG8",
+		"BayerRGGB8",
 		"_32Bits"
 	};
 	
@@ -73,10 +87,51 @@ const char* ImageFormat::getEncodingName( Encoding encoding )
 	return mEncodingNames[encoding];
 }
 
+unsigned int ImageFormat::getNumPlanes( Encoding encoding )
+{
+	switch ( encoding )
+	{
+		case NV12:	return 2;
+		case I420:	return 3;
+		default:	return 1;
+	}
+}
+
+// The chroma planes of the 4:2:0 encodings are subsampled by two in both directions 
+// (rounded up for odd sizes). Packed encodings have a single plane covering the whole image
+unsigned int ImageFormat::getPlaneNumBytesPerLine( unsigned int planeIndex ) const
+{
+	if ( planeIndex>=getNumPlanes() )
+		return 0;
+
+	unsigned int chromaWidth = (getWidth()+1)/2;
+	switch ( getEncoding() )
+	{
+		case NV12:	return planeIndex==0 ? getWidth() : chromaWidth*2;
+		case I420:	return planeIndex==0 ? getWidth() : chromaWidth;
+		default:	return getNumBitsPerPixel()*getWidth()/8;	// Note: rounded to the upper byte?
+	}
+}
+
+unsigned int ImageFormat::getPlaneHeight( unsigned int planeIndex ) const
+{
+	if ( planeIndex>=getNumPlanes() )
+		return 0;
+	return planeIndex==0 ? getHeight() : (getHeight()+1)/2;
+}
+
+// Offset of a plane when all the planes are stored one after the other in a single buffer
+unsigned int ImageFormat::getPlaneOffsetInBytes( unsigned int planeIndex ) const
+{
+	unsigned int offset = 0;
+	for ( unsigned int i=0; i<planeIndex && i<getNumPlanes(); ++i )
+		offset += getPlaneSizeInBytes(i);
+	return offset;
+}
+
 unsigned int ImageFormat::getDataSizeInBytes() const
 {
-	unsigned int size = getHeight() * getNumBytesPerLine();
-	return size;
+	return getPlaneOffsetInBytes( getNumPlanes() );
 }
 
 bool ImageFormat::operator==( const ImageFormat& other ) const
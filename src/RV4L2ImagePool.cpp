@@ -0,0 +1,269 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include "RV4L2ImagePool.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace RV4L2
+{
+
+/*
+	ImagePool::Handle
+*/
+ImagePool::Handle::Handle()
+	: mEntry(NULL)
+{
+}
+
+ImagePool::Handle::Handle( Entry* entry )
+	: mEntry(entry)
+{
+}
+
+ImagePool::Handle::Handle( const Handle& other )
+	: mEntry(other.mEntry)
+{
+	if ( mEntry )
+		mEntry->numReferences++;
+}
+
+ImagePool::Handle& ImagePool::Handle::operator=( const Handle& other )
+{
+	if ( other.mEntry )
+		other.mEntry->numReferences++;
+	release();
+	mEntry = other.mEntry;
+	return *this;
+}
+
+// The reference is handed over, the count doesn't change
+ImagePool::Handle::Handle( Handle&& other )
+	: mEntry(other.mEntry)
+{
+	other.mEntry = NULL;
+}
+
+ImagePool::Handle& ImagePool::Handle::operator=( Handle&& other )
+{
+	Handle handle( std::move(other) );
+	swap( handle );
+	return *this;
+}
+
+void ImagePool::Handle::swap( Handle& other )
+{
+	std::swap( mEntry, other.mEntry );
+}
+
+ImagePool::Handle::~Handle()
+{
+	release();
+}
+
+unsigned int ImagePool::Handle::getNumReferences() const
+{
+	return mEntry ? mEntry->numReferences.load() : 0;
+}
+
+const CapturedImage& ImagePool::Handle::getCapturedImage() const
+{
+	assert( mEntry );
+	return mEntry->capturedImage;
+}
+
+CapturedImage& ImagePool::Handle::getCapturedImage()
+{
+	assert( mEntry );
+	return mEntry->capturedImage;
+}
+
+// Let go of the image, giving it back to the pool if this was the last handle onto it
+void ImagePool::Handle::release()
+{
+	if ( !mEntry )
+		return;
+	Entry* entry = mEntry;
+	mEntry = NULL;
+	if ( entry->numReferences.fetch_sub( 1 )==1 )
+		entry->pool->recycle( entry );
+}
+
+/*
+	ImagePool::Entry
+*/
+ImagePool::Entry::Entry( ImagePool* pool, const ImageFormat& imageFormat )
+	: pool(pool),
+	  capturedImage(imageFormat),
+	  numReferences(0)
+{
+}
+
+/*
+	ImagePool
+*/
+ImagePool::ImagePool( unsigned int maxNumFreeImagesPerFormat )
+	: mMaxNumFreeImagesPerFormat(maxNumFreeImagesPerFormat),
+	  mMutex(),
+	  mFreeLists(),
+	  mNumUsedImages(0),
+	  mNumAllocatedImages(0),
+	  mNumRecycledImages(0)
+{
+}
+
+ImagePool::~ImagePool()
+{
+	assert( mNumUsedImages==0 );
+	trim();
+}
+
+ImagePool::Handle ImagePool::acquire( const ImageFormat& imageFormat )
+{
+	Entry* entry = NULL;
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		for ( std::size_t i=0; i<mFreeLists.size(); ++i )
+		{
+			std::vector<Entry*>& entries = mFreeLists[i].entries;
+			if ( mFreeLists[i].imageFormat==imageFormat && !entries.empty() )
+			{
+				entry = entries.back();
+				entries.pop_back();
+				mNumRecycledImages++;
+				break;
+			}
+		}
+		mNumUsedImages++;
+		if ( !entry )
+			mNumAllocatedImages++;
+	}
+	
+	// Allocate outside the lock. A recycled image doesn't keep the capture info of its previous use
+	if ( !entry )
+		entry = new Entry( this, imageFormat );
+	else
+		entry->capturedImage.resetCaptureInfo();
+	entry->numReferences = 1;
+	return Handle( entry );
+}
+
+// Keep a copy of an image that is only valid for the time of its notification (zero-copy 
+// delivery, FrameLease about to be released...)
+ImagePool::Handle ImagePool::acquireCopy( const CapturedImage& capturedImage )
+{
+	const Image& sourceImage = capturedImage.getImage();
+	const ImageFormat& imageFormat = sourceImage.getFormat();
+	Handle handle = acquire( imageFormat );
+	Image& image = handle.getImage();
+	if ( sourceImage.getNumPlanes()==1 )
+	{
+		// A lease image spans the whole driver buffer, which can be larger than the image data
+		MemoryBuffer& buffer = image.getBuffer();
+		const MemoryBuffer& sourceBuffer = sourceImage.getBuffer();
+		memcpy( buffer.getBytes(), sourceBuffer.getBytes(), std::min( sourceBuffer.getSizeInBytes(), buffer.getSizeInBytes() ) );
+	}
+	else
+	{
+		unsigned char* bytes = image.getBuffer().getBytes();
+		for ( unsigned int i=0; i<sourceImage.getNumPlanes(); ++i )
+		{
+			const MemoryBuffer& planeBuffer = sourceImage.getPlaneBuffer(i);
+			unsigned int planeSizeInBytes = std::min( planeBuffer.getSizeInBytes(), imageFormat.getPlaneSizeInBytes(i) );
+			memcpy( bytes + imageFormat.getPlaneOffsetInBytes(i), planeBuffer.getBytes(), planeSizeInBytes );
+		}
+	}
+	handle.getCapturedImage().copyCaptureInfo( capturedImage );
+	return handle;
+}
+
+void ImagePool::trim()
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	for ( std::size_t i=0; i<mFreeLists.size(); ++i )
+	{
+		for ( std::size_t j=0; j<mFreeLists[i].entries.size(); ++j )
+			delete mFreeLists[i].entries[j];
+	}
+	mFreeLists.clear();
+}
+
+unsigned int ImagePool::getNumUsedImages() const
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	return mNumUsedImages;
+}
+
+uint64_t ImagePool::getNumAllocatedImages() const
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	return mNumAllocatedImages;
+}
+
+uint64_t ImagePool::getNumRecycledImages() const
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	return mNumRecycledImages;
+}
+
+unsigned int ImagePool::getNumFreeImages() const
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+	std::size_t numFreeImages = 0;
+	for ( std::size_t i=0; i<mFreeLists.size(); ++i )
+		numFreeImages += mFreeLists[i].entries.size();
+	return static_cast<unsigned int>( numFreeImages );
+}
+
+// The free lists are reserved to their maximum size when created, so that recycling an image 
+// doesn't allocate. An image that doesn't fit is deleted
+void ImagePool::recycle( Entry* entry )
+{
+	const ImageFormat& imageFormat = entry->capturedImage.getImage().getFormat();
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		assert( mNumUsedImages>0 );
+		mNumUsedImages--;
+		std::size_t index = 0;
+		while ( index<mFreeLists.size() && mFreeLists[index].imageFormat!=imageFormat )
+			index++;
+		if ( index==mFreeLists.size() && mMaxNumFreeImagesPerFormat>0 )
+		{
+			mFreeLists.push_back( FreeList() );
+			mFreeLists.back().imageFormat = imageFormat;
+			mFreeLists.back().entries.reserve( mMaxNumFreeImagesPerFormat );
+		}
+		if ( index<mFreeLists.size() && mFreeLists[index].entries.size()<mMaxNumFreeImagesPerFormat )
+		{
+			mFreeLists[index].entries.push_back( entry );
+			return;
+		}
+	}
+	delete entry;
+}
+
+}
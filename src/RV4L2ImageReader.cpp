@@ -26,15 +26,16 @@
 #include <stdio.h>
 #include <cstring>
 #include <assert.h>
+#include <utility>
 
 namespace RV4L2
 {
 
-Image* ImageReader::readBinaryPGMImage( const char* filename )
+bool ImageReader::readBinaryPGMImage( const char* filename, Image& image )
 {
 	FILE* file = fopen( filename, "rb" );
 	if ( !file )
-		return NULL;
+		return false;
 	
 	int width = 0;
 	int height = 0;
@@ -43,21 +44,21 @@ Image* ImageReader::readBinaryPGMImage( const char* filename )
 	{
 		// Couldn't read header
 		fclose( file );
-		return NULL;
+		return false;
 	}
 
 	if ( width<=0 || height<=0 )
 	{
 		// Invalid image size
 		fclose( file );
-		return NULL;
+		return false;
 	}
 	
 	if ( maxValue>0xFF )
 	{
 		// Only support 1-byte pixel value
 		fclose( file );
-		return NULL;
+		return false;
 	}
 
 	while ( fgetc( file )!=0x0a )
@@ -65,27 +66,36 @@ Image* ImageReader::readBinaryPGMImage( const char* filename )
 		if ( feof( file ) )
 		{
 			// Reached end of file before any image data could be found
-			return NULL;
+			fclose( file );
+			return false;
 		}
 	}
 
 	// Create image
 	ImageFormat imageFormat( width, height, ImageFormat::Grayscale8 );
-	Image* image = new Image( imageFormat );
+	Image readImage( imageFormat );
 	
 	// Read image data 
-	int numBytes = image->getBuffer().getSizeInBytes();
-	unsigned char* bytes = image->getBuffer().getBytes();
+	int numBytes = readImage.getBuffer().getSizeInBytes();
+	unsigned char* bytes = readImage.getBuffer().getBytes();
 	if ( fread( bytes, numBytes, 1, file )!=1 )
 	{
 		// Failed to read the image data
 		fclose( file );
-		delete image;
-		image = NULL;
-		return NULL;
+		return false;
 	}
 
 	fclose( file );		
-	return image;
+	image = std::move( readImage );
+	return true;
+}
+
+// The caller owns the image returned, NULL on failure
+Image* ImageReader::readBinaryPGMImage( const char* filename )
+{
+	Image image;
+	if ( !readBinaryPGMImage( filename, image ) )
+		return NULL;
+	return new Image( std::move(image) );
 }
 }
@@ -25,37 +25,86 @@
 
 #include <stddef.h>		// For NULL
 #include <memory.h>
+#include <utility>
 
 namespace RV4L2
 {
 
 MemoryBuffer::MemoryBuffer()
 	: mBytes(NULL),
-	  mSizeInBytes(0)
+	  mSizeInBytes(0),
+	  mCapacityInBytes(0),
+	  mOwnsBytes(true)
 {
 }
 
 MemoryBuffer::MemoryBuffer( unsigned int sizeInBytes )
 	: mBytes(NULL),
-	  mSizeInBytes(sizeInBytes)
+	  mSizeInBytes(sizeInBytes),
+	  mCapacityInBytes(sizeInBytes),
+	  mOwnsBytes(true)
 {
 	mBytes = new unsigned char[mSizeInBytes];
 	fill(0);
 }
 
+// Construct a buffer that refers to memory owned by someone else (an mmap'd driver 
+// buffer for instance). The memory is neither copied nor freed by the MemoryBuffer
+MemoryBuffer::MemoryBuffer( unsigned char* externalBytes, unsigned int sizeInBytes )
+	: mBytes(externalBytes),
+	  mSizeInBytes(sizeInBytes),
+	  mCapacityInBytes(0),
+	  mOwnsBytes(false)
+{
+}
+
+// The copy always owns its data, even when the source buffer refers to external memory
 MemoryBuffer::MemoryBuffer( const MemoryBuffer& other )
 	: mBytes(NULL),
-	  mSizeInBytes( other.getSizeInBytes() )
+	  mSizeInBytes( other.getSizeInBytes() ),
+	  mCapacityInBytes( other.getSizeInBytes() ),
+	  mOwnsBytes(true)
 {
 	mBytes = new unsigned char[mSizeInBytes];
-	memcpy( mBytes, other.getBytes(), other.getSizeInBytes() );
+	if ( mSizeInBytes>0 )
+		memcpy( mBytes, other.getBytes(), mSizeInBytes );
+}
+
+// Take the data over, owned or not. The other buffer is left empty
+MemoryBuffer::MemoryBuffer( MemoryBuffer&& other )
+	: mBytes(other.mBytes),
+	  mSizeInBytes(other.mSizeInBytes),
+	  mCapacityInBytes(other.mCapacityInBytes),
+	  mOwnsBytes(other.mOwnsBytes)
+{
+	other.mBytes = NULL;
+	other.mSizeInBytes = 0;
+	other.mCapacityInBytes = 0;
+	other.mOwnsBytes = true;
+}
+
+MemoryBuffer& MemoryBuffer::operator=( MemoryBuffer&& other )
+{
+	MemoryBuffer buffer( std::move(other) );
+	swap( buffer );
+	return *this;
+}
+
+void MemoryBuffer::swap( MemoryBuffer& other )
+{
+	std::swap( mBytes, other.mBytes );
+	std::swap( mSizeInBytes, other.mSizeInBytes );
+	std::swap( mCapacityInBytes, other.mCapacityInBytes );
+	std::swap( mOwnsBytes, other.mOwnsBytes );
 }
 
 MemoryBuffer::~MemoryBuffer()
 {
-	delete[] mBytes;
+	if ( mOwnsBytes )
+		delete[] mBytes;
 	mBytes = NULL;
 	mSizeInBytes = 0;
+	mCapacityInBytes = 0;
 }
 
 void MemoryBuffer::fill( char value )
@@ -76,4 +125,31 @@ bool MemoryBuffer::copyFrom( const unsigned char* otherBytes, unsigned int numOt
 	return true;
 }
 
+// Make the buffer refer to external memory. Any data previously owned is released
+void MemoryBuffer::attach( unsigned char* externalBytes, unsigned int sizeInBytes )
+{
+	if ( mOwnsBytes )
+		delete[] mBytes;
+	mBytes = externalBytes;
+	mSizeInBytes = sizeInBytes;
+	mCapacityInBytes = 0;
+	mOwnsBytes = false;
+}
+
+// Change the size of the buffer, which then owns its data. The current allocation is kept 
+// when it is large enough, otherwise a new zero-filled one is made (the content is lost)
+void MemoryBuffer::resize( unsigned int sizeInBytes )
+{
+	if ( !mOwnsBytes || sizeInBytes>mCapacityInBytes )
+	{
+		if ( mOwnsBytes )
+			delete[] mBytes;
+		mBytes = new unsigned char[sizeInBytes];
+		mCapacityInBytes = sizeInBytes;
+		mOwnsBytes = true;
+		memset( mBytes, 0, sizeInBytes );
+	}
+	mSizeInBytes = sizeInBytes;
+}
+
 }
\ No newline at end of file
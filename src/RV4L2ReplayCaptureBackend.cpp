@@ -0,0 +1,353 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include "RV4L2ReplayCaptureBackend.h"
+#include "RV4L2FrameRecorder.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <algorithm>
+
+namespace RV4L2
+{
+
+// Skip the whitespace and the comments of a PNM header, then read a decimal value
+static bool readPNMValue( const unsigned char* data, std::size_t length, std::size_t& offset, unsigned int& value )
+{
+	while ( offset<length && (isspace(data[offset]) || data[offset]=='#') )
+	{
+		if ( data[offset]=='#' )
+		{
+			while ( offset<length && data[offset]!='\n' )
+				offset++;
+		}
+		else
+		{
+			offset++;
+		}
+	}
+	if ( offset>=length || !isdigit(data[offset]) )
+		return false;
+	value = 0;
+	while ( offset<length && isdigit(data[offset]) )
+		value = value*10 + (data[offset++]-'0');
+	return true;
+}
+
+// Binary PGM (P5) and PPM (P6) files with 8-bit samples only
+static bool parsePNMHeader( const unsigned char* data, std::size_t length, ImageFormat& imageFormat, std::size_t& headerSize )
+{
+	if ( length<2 || data[0]!='P' || (data[1]!='5' && data[1]!='6') )
+		return false;
+	std::size_t offset = 2;
+	unsigned int width = 0;
+	unsigned int height = 0;
+	unsigned int maxValue = 0;
+	if ( !readPNMValue( data, length, offset, width ) || 
+		 !readPNMValue( data, length, offset, height ) ||
+		 !readPNMValue( data, length, offset, maxValue ) )
+		return false;
+	if ( width==0 || height==0 || maxValue==0 || maxValue>0xFF || offset>=length || !isspace(data[offset]) )
+		return false;
+	imageFormat = ImageFormat( width, height, data[1]=='5' ? ImageFormat::Grayscale8 : ImageFormat::RGB24 );
+	headerSize = offset+1;		// A single whitespace precedes the samples
+	return headerSize + imageFormat.getDataSizeInBytes() <= length;
+}
+
+ReplayCaptureBackend::ReplayCaptureBackend()
+	:	EmulatedCaptureBackend( "rapav4l2-replay", "RapaV4L2 replay device", "replay:" ),
+		mSpeed(1.f),
+		mIsLooping(false),
+		mImageFrameRateInHz(30),
+		mIsFinished(false),
+		mMappings(),
+		mFrames(),
+		mSourceImageFormat(),
+		mNumSkippedFrames(0)
+{
+}
+
+ReplayCaptureBackend::~ReplayCaptureBackend()
+{
+	close();
+}
+
+void ReplayCaptureBackend::setSpeed( float speed )
+{
+	if ( speed>0.f )
+		mSpeed = speed;
+}
+
+void ReplayCaptureBackend::setImageFrameRate( unsigned int frameRateInHz )
+{
+	if ( frameRateInHz>0 )
+		mImageFrameRateInHz = frameRateInHz;
+}
+
+bool ReplayCaptureBackend::hasExtension( const std::string& fileName, const char* extension )
+{
+	std::size_t extensionLength = strlen( extension );
+	return fileName.size()>=extensionLength && fileName.compare( fileName.size()-extensionLength, extensionLength, extension )==0;
+}
+
+// The regular files of the directory, sorted by name
+bool ReplayCaptureBackend::listFiles( const std::string& directory, std::vector<std::string>& fileNames )
+{
+	fileNames.clear();
+	DIR* dir = opendir( directory.c_str() );
+	if ( !dir )
+	{
+		fprintf( stderr, "Cannot open directory %s. %s (%d)\n", directory.c_str(), strerror(errno), errno );
+		return false;
+	}
+	struct dirent* entry = NULL;
+	while ( (entry=readdir(dir))!=NULL )
+	{
+		if ( entry->d_name[0]!='.' )
+			fileNames.push_back( directory + "/" + entry->d_name );
+	}
+	closedir( dir );
+	std::sort( fileNames.begin(), fileNames.end() );
+	return true;
+}
+
+// The mapping stays until the source is closed. The file itself can be closed right away
+const unsigned char* ReplayCaptureBackend::mapFile( const std::string& fileName, std::size_t& length )
+{
+	int handle = ::open( fileName.c_str(), O_RDONLY | O_CLOEXEC );
+	if ( handle==-1 )
+	{
+		fprintf( stderr, "Cannot open %s. %s (%d)\n", fileName.c_str(), strerror(errno), errno );
+		return NULL;
+	}
+	struct stat st;
+	if ( fstat( handle, &st )==-1 || st.st_size==0 )
+	{
+		::close( handle );
+		return NULL;
+	}
+	length = static_cast<std::size_t>( st.st_size );
+	void* address = ::mmap( NULL, length, PROT_READ, MAP_PRIVATE, handle, 0 );
+	::close( handle );
+	if ( address==MAP_FAILED )
+	{
+		fprintf( stderr, "MMAP failed for %s. %s (%d)\n", fileName.c_str(), strerror(errno), errno );
+		return NULL;
+	}
+	madvise( address, length, MADV_SEQUENTIAL );
+
+	Mapping mapping;
+	mapping.address = address;
+	mapping.length = length;
+	mMappings.push_back( mapping );
+	return static_cast<const unsigned char*>( address );
+}
+
+bool ReplayCaptureBackend::addFrame( const ImageFormat& imageFormat, const unsigned char* data, int64_t timestampInNs )
+{
+	if ( mFrames.empty() )
+	{
+		mSourceImageFormat = imageFormat;
+	}
+	else if ( imageFormat!=mSourceImageFormat )
+	{
+		mNumSkippedFrames++;
+		return false;
+	}
+	Frame frame;
+	frame.data = data;
+	frame.timestampInNs = timestampInNs;
+	mFrames.push_back( frame );
+	return true;
+}
+
+bool ReplayCaptureBackend::addImageFile( const std::string& fileName )
+{
+	std::size_t length = 0;
+	const unsigned char* data = mapFile( fileName, length );
+	if ( !data )
+		return false;
+	ImageFormat imageFormat;
+	std::size_t headerSize = 0;
+	if ( !parsePNMHeader( data, length, imageFormat, headerSize ) )
+	{
+		fprintf( stderr, "%s is not a binary PGM or PPM image\n", fileName.c_str() );
+		return false;
+	}
+	return addFrame( imageFormat, data + headerSize, 0 );
+}
+
+// A FrameRecorder segment: a sequence of records, each one starting with a FrameHeader
+bool ReplayCaptureBackend::addRecordingFile( const std::string& fileName )
+{
+	std::size_t length = 0;
+	const unsigned char* data = mapFile( fileName, length );
+	if ( !data )
+		return false;
+
+	std::size_t offset = 0;
+	while ( offset + sizeof(FrameRecorder::FrameHeader) <= length )
+	{
+		FrameRecorder::FrameHeader header;
+		memcpy( &header, data + offset, sizeof(header) );
+		if ( header.magic!=FrameRecorder::FrameHeaderMagic )
+			break;
+		if ( header.recordSizeInBytes==0 || header.encoding>=ImageFormat::EncodingCount ||
+			 static_cast<uint64_t>(header.headerSizeInBytes) + header.dataSizeInBytes > header.recordSizeInBytes ||
+			 offset + header.recordSizeInBytes > length )
+		{
+			fprintf( stderr, "Invalid frame record at offset %d of %s\n", static_cast<int>(offset), fileName.c_str() );
+			break;
+		}
+
+		ImageFormat imageFormat( header.width, header.height, static_cast<ImageFormat::Encoding>(header.encoding) );
+		if ( imageFormat.getDataSizeInBytes()==header.dataSizeInBytes )
+			addFrame( imageFormat, data + offset + header.headerSizeInBytes, header.timestampInNs );
+		else
+			mNumSkippedFrames++;
+		offset += header.recordSizeInBytes;
+	}
+	return true;
+}
+
+bool ReplayCaptureBackend::openSource( const std::string& deviceName )
+{
+	closeSource();
+
+	struct stat st;
+	if ( stat( deviceName.c_str(), &st )==-1 )
+	{
+		fprintf( stderr, "Cannot identify '%s'. %s (%d)\n", deviceName.c_str(), strerror(errno), errno );
+		return false;
+	}
+
+	// A directory holds either recording segments or images
+	std::vector<std::string> fileNames;
+	if ( S_ISDIR(st.st_mode) )
+	{
+		if ( !listFiles( deviceName, fileNames ) )
+			return false;
+		bool isRecording = false;
+		for ( std::size_t i=0; i<fileNames.size(); ++i )
+			isRecording = isRecording || hasExtension( fileNames[i], ".rv4l2raw" );
+		for ( std::size_t i=0; i<fileNames.size(); ++i )
+		{
+			if ( isRecording && hasExtension( fileNames[i], ".rv4l2raw" ) )
+				addRecordingFile( fileNames[i] );
+			else if ( !isRecording && (hasExtension( fileNames[i], ".pgm" ) || hasExtension( fileNames[i], ".ppm" )) )
+				addImageFile( fileNames[i] );
+		}
+	}
+	else if ( hasExtension( deviceName, ".pgm" ) || hasExtension( deviceName, ".ppm" ) )
+	{
+		addImageFile( deviceName );
+	}
+	else
+	{
+		addRecordingFile( deviceName );
+	}
+
+	if ( mFrames.empty() )
+	{
+		fprintf( stderr, "No image to replay in %s\n", deviceName.c_str() );
+		closeSource();
+		return false;
+	}
+	if ( mNumSkippedFrames>0 )
+		fprintf( stderr, "Skipped %d images of %s that don't have the format of the first one\n", static_cast<int>(mNumSkippedFrames), deviceName.c_str() );
+
+	// The nominal frame rate of a recording is its average one
+	unsigned int frameRateInHz = mImageFrameRateInHz;
+	int64_t durationInNs = mFrames.back().timestampInNs - mFrames.front().timestampInNs;
+	if ( mFrames.size()>1 && mFrames.front().timestampInNs!=0 && durationInNs>0 )
+	{
+		double frameRate = static_cast<double>(mFrames.size()-1) * 1000000000.0 / static_cast<double>(durationInNs);
+		frameRateInHz = std::max( 1u, static_cast<unsigned int>( frameRate + 0.5 ) );
+	}
+
+	mEncodings.push_back( mSourceImageFormat.getEncoding() );
+	mFrameSizes.push_back( std::make_pair( mSourceImageFormat.getWidth(), mSourceImageFormat.getHeight() ) );
+	mFrameRates.push_back( frameRateInHz );
+	return true;
+}
+
+void ReplayCaptureBackend::closeSource()
+{
+	for ( std::size_t i=0; i<mMappings.size(); ++i )
+		::munmap( mMappings[i].address, mMappings[i].length );
+	mMappings.clear();
+	mFrames.clear();
+	mNumSkippedFrames = 0;
+	mEncodings.clear();
+	mFrameSizes.clear();
+	mFrameRates.clear();
+	mIsFinished = false;
+}
+
+std::size_t ReplayCaptureBackend::getFrameIndex( uint32_t sequenceNumber ) const
+{
+	return static_cast<std::size_t>( sequenceNumber ) % mFrames.size();
+}
+
+bool ReplayCaptureBackend::hasFrame( uint32_t sequenceNumber ) const
+{
+	bool hasFrame = mIsLooping || sequenceNumber<mFrames.size();
+	mIsFinished = !hasFrame;
+	return hasFrame;
+}
+
+// The recorded interval to the next image when known, scaled by the speed
+int64_t ReplayCaptureBackend::getFrameIntervalInNs( uint32_t sequenceNumber ) const
+{
+	std::size_t frameIndex = getFrameIndex( sequenceNumber );
+	int64_t frameIntervalInNs = 1000000000LL / getFrameRateInHz();
+	if ( frameIndex+1<mFrames.size() && mFrames[frameIndex].timestampInNs!=0 && 
+		 mFrames[frameIndex+1].timestampInNs>mFrames[frameIndex].timestampInNs )
+		frameIntervalInNs = mFrames[frameIndex+1].timestampInNs - mFrames[frameIndex].timestampInNs;
+	return static_cast<int64_t>( static_cast<double>(frameIntervalInNs) / mSpeed );
+}
+
+// Copy the image, and have the kernel read the next one ahead
+void ReplayCaptureBackend::generateFrame( unsigned char* data, uint32_t sequenceNumber )
+{
+	std::size_t frameIndex = getFrameIndex( sequenceNumber );
+	std::size_t dataSizeInBytes = mSourceImageFormat.getDataSizeInBytes();
+	memcpy( data, mFrames[frameIndex].data, dataSizeInBytes );
+
+	if ( frameIndex+1<mFrames.size() )
+	{
+		static const uintptr_t pageMask = ~static_cast<uintptr_t>( sysconf( _SC_PAGESIZE )-1 );
+		uintptr_t start = reinterpret_cast<uintptr_t>( mFrames[frameIndex+1].data ) & pageMask;
+		uintptr_t end = reinterpret_cast<uintptr_t>( mFrames[frameIndex+1].data ) + dataSizeInBytes;
+		madvise( reinterpret_cast<void*>(start), end-start, MADV_WILLNEED );
+	}
+}
+
+}
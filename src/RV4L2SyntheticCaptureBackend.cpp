@@ -0,0 +1,273 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include "RV4L2SyntheticCaptureBackend.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+namespace RV4L2
+{
+
+// Studio-range BT.601, the conversion the ImageConverter reverts
+static inline unsigned char getY( const unsigned char* rgb )
+{
+	return static_cast<unsigned char>( ((66*rgb[0] + 129*rgb[1] + 25*rgb[2] + 128) >> 8) + 16 );
+}
+
+static inline unsigned char getU( const unsigned char* rgb )
+{
+	return static_cast<unsigned char>( ((-38*rgb[0] - 74*rgb[1] + 112*rgb[2] + 128) >> 8) + 128 );
+}
+
+static inline unsigned char getV( const unsigned char* rgb )
+{
+	return static_cast<unsigned char>( ((112*rgb[0] - 94*rgb[1] - 18*rgb[2] + 128) >> 8) + 128 );
+}
+
+// Copy the rows preceding y0+period over the remaining rows up to y1
+static void replicateRows( unsigned char* plane, unsigned int bytesPerLine, unsigned int y0, unsigned int y1, unsigned int period )
+{
+	for ( unsigned int y=y0+period; y<y1; ++y )
+		memcpy( plane + y*bytesPerLine, plane + (y-period)*bytesPerLine, bytesPerLine );
+}
+
+SyntheticCaptureBackend::SyntheticCaptureBackend( Pattern pattern )
+	:	EmulatedCaptureBackend( "rapav4l2-synthetic", "RapaV4L2 synthetic device", "synthetic:" ),
+		mPattern(pattern),
+		mNoiseState(0x9E3779B97F4A7C15ULL),
+		mRGBRow()
+{
+	mEncodings = getSupportedEncodings();
+	mFrameSizes.push_back( std::make_pair(320, 240) );
+	mFrameSizes.push_back( std::make_pair(640, 480) );
+	mFrameSizes.push_back( std::make_pair(1280, 720) );
+	mFrameSizes.push_back( std::make_pair(1920, 1080) );
+	mFrameRates.push_back( 30 );
+	mFrameRates.push_back( 60 );
+}
+
+SyntheticCaptureBackend::~SyntheticCaptureBackend()
+{
+	close();
+}
+
+// The chroma subsampling and the Bayer patterns need even sizes
+void SyntheticCaptureBackend::addFrameSize( unsigned int width, unsigned int height )
+{
+	if ( width==0 || height==0 || (width%2)!=0 || (height%2)!=0 )
+	{
+		fprintf( stderr, "Unsupported synthetic frame size %dx%d, the width and height must be even\n", width, height );
+		return;
+	}
+	if ( !hasFrameSize( width, height ) )
+		mFrameSizes.push_back( std::make_pair(width, height) );
+}
+
+void SyntheticCaptureBackend::addFrameRate( unsigned int frameRateInHz )
+{
+	if ( frameRateInHz==0 )
+		return;
+	for ( std::size_t i=0; i<mFrameRates.size(); ++i )
+		if ( mFrameRates[i]==frameRateInHz )
+			return;
+	mFrameRates.push_back( frameRateInHz );
+}
+
+// Nothing to open, the configuration was done beforehand
+bool SyntheticCaptureBackend::openSource( const std::string& /*deviceName*/ )
+{
+	return true;
+}
+
+void SyntheticCaptureBackend::generateFrame( unsigned char* data, uint32_t sequenceNumber )
+{
+	const ImageFormat& imageFormat = getImageFormat();
+	unsigned int width = imageFormat.getWidth();
+	unsigned int height = imageFormat.getHeight();
+	if ( mRGBRow.size()<width*3 )
+		mRGBRow.resize( width*3 );
+	unsigned char* rgbRow = &mRGBRow[0];
+	switch ( mPattern )
+	{
+		case NoisePattern:
+			renderNoise( data, imageFormat.getDataSizeInBytes() );
+			break;
+
+		case MovingBarsPattern:
+		{
+			static const unsigned char barColors[8][3] = 
+			{
+				{ 255, 255, 255 }, { 255, 255, 0 }, { 0, 255, 255 }, { 0, 255, 0 },
+				{ 255, 0, 255 }, { 255, 0, 0 }, { 0, 0, 255 }, { 0, 0, 0 }
+			};
+			unsigned int offset = (sequenceNumber * 4) % width;
+			for ( unsigned int x=0; x<width; ++x )
+				memcpy( rgbRow + x*3, barColors[ ((x+offset)%width) * 8 / width ], 3 );
+			renderRows( data, 0, height, rgbRow );
+			break;
+		}
+
+		case CounterPattern:
+		{
+			unsigned int bandHeight = (height/8) & ~1u;
+			if ( bandHeight==0 )
+				bandHeight = 2;
+			for ( unsigned int x=0; x<width; ++x )
+			{
+				unsigned int bitIndex = 31 - x*32/width;
+				memset( rgbRow + x*3, ((sequenceNumber >> bitIndex) & 1) ? 255 : 0, 3 );
+			}
+			renderRows( data, 0, bandHeight, rgbRow );
+			memset( rgbRow, 128, width*3 );
+			renderRows( data, bandHeight, height, rgbRow );
+			break;
+		}
+	}
+}
+
+// Write the rows y0 to y1 (both even) of the current format, all of them showing rgbRow. Only 
+// the first row (or pair of rows) of each plane gets converted, the others are copies
+void SyntheticCaptureBackend::renderRows( unsigned char* data, unsigned int y0, unsigned int y1, const unsigned char* rgbRow )
+{
+	if ( y0>=y1 )
+		return;
+	const ImageFormat& imageFormat = getImageFormat();
+	unsigned int width = imageFormat.getWidth();
+	unsigned int bytesPerLine = imageFormat.getPlaneNumBytesPerLine(0);
+	unsigned char* row = data + y0*bytesPerLine;
+	ImageFormat::Encoding encoding = imageFormat.getEncoding();
+	switch ( encoding )
+	{
+		case ImageFormat::Grayscale8:
+			for ( unsigned int x=0; x<width; ++x )
+				row[x] = getY( rgbRow + x*3 );
+			replicateRows( data, bytesPerLine, y0, y1, 1 );
+			break;
+
+		case ImageFormat::RGB24:
+			memcpy( row, rgbRow, width*3 );
+			replicateRows( data, bytesPerLine, y0, y1, 1 );
+			break;
+
+		case ImageFormat::YUYV:
+		case ImageFormat::UYVY:
+		{
+			unsigned int yIndex = encoding==ImageFormat::YUYV ? 0 : 1;
+			unsigned int cIndex = 1 - yIndex;
+			for ( unsigned int x=0; x<width; x+=2 )
+			{
+				unsigned char* dst = row + x*2;
+				dst[yIndex] = getY( rgbRow + x*3 );
+				dst[yIndex+2] = getY( rgbRow + x*3 + 3 );
+				dst[cIndex] = getU( rgbRow + x*3 );
+				dst[cIndex+2] = getV( rgbRow + x*3 );
+			}
+			replicateRows( data, bytesPerLine, y0, y1, 1 );
+			break;
+		}
+
+		case ImageFormat::NV12:
+		case ImageFormat::I420:
+		{
+			for ( unsigned int x=0; x<width; ++x )
+				row[x] = getY( rgbRow + x*3 );
+			replicateRows( data, bytesPerLine, y0, y1, 1 );
+
+			unsigned int cy0 = y0/2;
+			unsigned int cy1 = (y1+1)/2;
+			unsigned char* uPlane = data + imageFormat.getPlaneOffsetInBytes(1);
+			unsigned int uBytesPerLine = imageFormat.getPlaneNumBytesPerLine(1);
+			unsigned char* uRow = uPlane + cy0*uBytesPerLine;
+			if ( encoding==ImageFormat::NV12 )
+			{
+				for ( unsigned int x=0; x<width; x+=2 )
+				{
+					uRow[x] = getU( rgbRow + x*3 );
+					uRow[x+1] = getV( rgbRow + x*3 );
+				}
+				replicateRows( uPlane, uBytesPerLine, cy0, cy1, 1 );
+			}
+			else
+			{
+				unsigned char* vPlane = data + imageFormat.getPlaneOffsetInBytes(2);
+				unsigned int vBytesPerLine = imageFormat.getPlaneNumBytesPerLine(2);
+				unsigned char* vRow = vPlane + cy0*vBytesPerLine;
+				for ( unsigned int x=0; x<width; x+=2 )
+				{
+					uRow[x/2] = getU( rgbRow + x*3 );
+					vRow[x/2] = getV( rgbRow + x*3 );
+				}
+				replicateRows( uPlane, uBytesPerLine, cy0, cy1, 1 );
+				replicateRows( vPlane, vBytesPerLine, cy0, cy1, 1 );
+			}
+			break;
+		}
+
+		case ImageFormat::BayerBGGR8:
+		case ImageFormat::BayerGBRG8:
+		case ImageFormat::BayerGRBG8:
+		case ImageFormat::BayerRGGB8:
+		{
+			// RGB component sampled at each position of the 2x2 pattern
+			static const unsigned char bayerComponents[4][4] = 
+			{
+				{ 2, 1, 1, 0 },		// BGGR
+				{ 1, 2, 0, 1 },		// GBRG
+				{ 1, 0, 2, 1 },		// GRBG
+				{ 0, 1, 1, 2 }		// RGGB
+			};
+			const unsigned char* components = bayerComponents[encoding-ImageFormat::BayerBGGR8];
+			unsigned char* nextRow = row + bytesPerLine;
+			for ( unsigned int x=0; x<width; ++x )
+			{
+				row[x] = rgbRow[x*3 + components[x%2]];
+				if ( y0+1<y1 )
+					nextRow[x] = rgbRow[x*3 + components[2 + x%2]];
+			}
+			replicateRows( data, bytesPerLine, y0, y1, 2 );
+			break;
+		}
+
+		default:
+			break;
+	}
+}
+
+// xorshift64*, 8 bytes at a time
+void SyntheticCaptureBackend::renderNoise( unsigned char* data, std::size_t size )
+{
+	uint64_t state = mNoiseState;
+	for ( std::size_t i=0; i<size; i+=sizeof(uint64_t) )
+	{
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		uint64_t value = state * 0x2545F4914F6CDD1DULL;
+		memcpy( data+i, &value, std::min( sizeof(value), size-i ) );
+	}
+	mNoiseState = state;
+}
+
+}
@@ -0,0 +1,106 @@
+/*
+   The MIT License (MIT) (http://opensource.org/licenses/MIT)
+   
+   Copyright (c) 2015 Jacques Menuet
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include "RV4L2V4L2CaptureBackend.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+
+namespace RV4L2
+{
+
+V4L2CaptureBackend::V4L2CaptureBackend()
+	:	mHandle(-1)
+{
+}
+
+V4L2CaptureBackend::~V4L2CaptureBackend()
+{
+	close();
+}
+
+bool V4L2CaptureBackend::open( const std::string& deviceName )
+{
+	if ( mHandle!=-1 )
+		return false;
+
+	struct stat st;
+	if ( stat(deviceName.c_str(), &st)==-1 )
+	{
+		fprintf( stderr, "Cannot identify '%s'. %s (%d)\n", deviceName.c_str(), strerror(errno), errno );
+		return false;
+	}
+
+	if ( !S_ISCHR(st.st_mode) ) 
+	{
+		fprintf( stderr, "%s is not a device\n", deviceName.c_str() );
+		return false;	
+	}
+
+	mHandle = ::open( deviceName.c_str(), O_RDWR | O_NONBLOCK, 0 );
+    if ( mHandle==-1 )
+	{
+		fprintf( stderr, "Cannot open %s. %s (%d)\n", deviceName.c_str(), strerror(errno), errno );
+		return false;	
+	}
+	return true;
+}
+
+void V4L2CaptureBackend::close()
+{
+	if ( mHandle!=-1 )
+	{
+		::close( mHandle );
+		mHandle = -1;
+	}
+}
+
+// Restarts the calls interrupted by a signal
+int V4L2CaptureBackend::ioctl( unsigned long request, void* arg )
+{
+	int r;
+	do 
+	{
+		r = ::ioctl( mHandle, request, arg );
+	} 
+	while ( r==-1 && errno==EINTR );
+	return r;
+}
+
+void* V4L2CaptureBackend::mmap( std::size_t length, off_t offset )
+{
+	return ::mmap( NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, mHandle, offset );
+}
+
+int V4L2CaptureBackend::munmap( void* start, std::size_t length )
+{
+	return ::munmap( start, length );
+}
+
+}